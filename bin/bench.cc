@@ -0,0 +1,343 @@
+#include "bench_util.h"
+#include "dexe/handler.h"
+#include "dexe/network.h"
+#include "dexe/optimizer.h"
+#include "dexe/util.h"
+
+#include "cereal/archives/json.hpp"
+#include "cereal/types/string.hpp"
+#include "cereal/types/vector.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+using namespace std;
+using namespace dexe;
+
+// Benchmark suite: every operation type at 2D and 3D shapes, unet training steps at several
+// patch sizes and widths, and the optimizer updates on a large parameter vector.
+//
+//   bench [--filter substring] [--warmup n] [--reps n] [--json out.json]
+//         [--baseline baseline.json] [--threshold 0.1]
+//
+// With a baseline every benchmark whose median is more than threshold slower than the stored one
+// is reported and the exit code is 1. Without a cuda device nothing is measured and it exits 0.
+
+struct BenchResult {
+    string name;
+    int reps = 0;
+    double min_ms = 0, median_ms = 0, mean_ms = 0, stddev_ms = 0, p95_ms = 0;
+
+    template <class Archive> void serialize(Archive &ar) {
+        ar(cereal::make_nvp("name", name), cereal::make_nvp("reps", reps),
+           cereal::make_nvp("min_ms", min_ms), cereal::make_nvp("median_ms", median_ms),
+           cereal::make_nvp("mean_ms", mean_ms), cereal::make_nvp("stddev_ms", stddev_ms),
+           cereal::make_nvp("p95_ms", p95_ms));
+    }
+};
+
+struct BenchReport {
+    string device;
+    bool skipped = false;
+    vector<BenchResult> benchmarks;
+
+    template <class Archive> void serialize(Archive &ar) {
+        ar(cereal::make_nvp("device", device), cereal::make_nvp("skipped", skipped),
+           cereal::make_nvp("benchmarks", benchmarks));
+    }
+};
+
+struct Suite {
+    string filter;
+    int warmup = 3, reps = 10;
+    BenchReport report;
+
+    // step has to leave its work queued on the handler stream, it's synced around every rep
+    void run(string name, function<void()> step) {
+        if (name.find(filter) == string::npos)
+            return;
+        for (int n(0); n < warmup; ++n)
+            step();
+        Handler::sync();
+
+        vector<double> times;
+        for (int n(0); n < reps; ++n) {
+            Timer timer;
+            step();
+            Handler::sync();
+            times.push_back(timer.since() * 1e3);
+        }
+        sort(times.begin(), times.end());
+
+        BenchResult r;
+        r.name = name;
+        r.reps = reps;
+        r.min_ms = times.front();
+        r.median_ms = times[times.size() / 2];
+        for (auto t : times)
+            r.mean_ms += t / times.size();
+        for (auto t : times)
+            r.stddev_ms += (t - r.mean_ms) * (t - r.mean_ms) / times.size();
+        r.stddev_ms = sqrt(r.stddev_ms);
+        r.p95_ms = times[min<size_t>(times.size() - 1, ceil(0.95 * times.size()) - 1)]; // nearest rank
+
+        cout << left << setw(44) << name << right << fixed << setprecision(3) << setw(12)
+             << r.median_ms << " ms median" << setw(12) << r.stddev_ms << " ms stddev" << endl;
+        report.benchmarks.push_back(r);
+    }
+};
+
+using Build = function<Node<float>(Network<float> &, vector<Node<float>> &)>;
+
+// Forward and backward of a single operation on inputs of the given shape
+void bench_operation(Suite &suite, string name, TensorShape shape, int n_inputs, Build build,
+                     bool fuse = false) {
+    if (name.find(suite.filter) == string::npos)
+        return;
+    Network<float> network;
+    vector<Node<float>> inputs;
+    for (int i(0); i < n_inputs; ++i)
+        inputs.push_back(shape.n_dimensions() == 4 ? network.input_2D(shape.c())
+                                                   : network.input_3D(shape.c()));
+    auto node = build(network, inputs);
+    network.init_uniform(0.05);
+
+    vector<unique_ptr<Tensor<float>>> xs;
+    vector<int> input_indices;
+    for (auto &in : inputs) {
+        xs.emplace_back(new Tensor<float>(shape));
+        xs.back()->init_normal(0.0, 0.1);
+        input_indices.push_back(in.index);
+    }
+    auto load = [&] {
+        for (size_t i(0); i < xs.size(); ++i)
+            network.load_input(input_indices[i], *xs[i]);
+    };
+
+    if (fuse) {
+        load();
+        network.forward(input_indices, node.index);
+        auto remap = network.fuse({node.index}).remap;
+        node.index = remap[node.index];
+        for (auto &index : input_indices)
+            index = remap[index];
+    }
+
+    suite.run(name, [&] {
+        load();
+        network.forward(input_indices, node.index);
+        network.zero_grad();
+        network.backward();
+    });
+}
+
+void bench_operations(Suite &suite) {
+    TensorShape s2{8, 32, 128, 128};
+    TensorShape s3{1, 16, 48, 48, 48};
+    for (auto shape : {s2, s3}) {
+        bool is_3d = shape.n_dimensions() == 5;
+        string dim = is_3d ? "3d" : "2d";
+        int c = shape.c();
+
+        bench_operation(suite, "op/convolution_" + dim, shape, 1,
+                        [&](Network<float> &n, vector<Node<float>> &in) {
+                            return is_3d ? n.convolution_3D(c, 3)(in[0])
+                                         : n.convolution_2D(c, 3)(in[0]);
+                        });
+        bench_operation(suite, "op/convolution_relu_" + dim, shape, 1,
+                        [&](Network<float> &n, vector<Node<float>> &in) {
+                            auto conv = is_3d ? n.convolution_3D(c, 3)(in[0])
+                                              : n.convolution_2D(c, 3)(in[0]);
+                            return n.relu()(conv);
+                        },
+                        true);
+        bench_operation(suite, "op/downscale_" + dim, shape, 1,
+                        [&](Network<float> &n, vector<Node<float>> &in) {
+                            return is_3d ? n.convolution_downscale_3D(2 * c, 2)(in[0])
+                                         : n.convolution_downscale(2 * c, 2)(in[0]);
+                        });
+        bench_operation(suite, "op/upscale_" + dim, shape, 1,
+                        [&](Network<float> &n, vector<Node<float>> &in) {
+                            return is_3d ? n.convolution_upscale_3D(c / 2, 2)(in[0])
+                                         : n.convolution_upscale(c / 2, 2)(in[0]);
+                        });
+        bench_operation(suite, "op/relu_" + dim, shape, 1,
+                        [](Network<float> &n, vector<Node<float>> &in) { return n.relu()(in[0]); });
+        bench_operation(suite, "op/tanh_" + dim, shape, 1,
+                        [](Network<float> &n, vector<Node<float>> &in) { return n.tanh()(in[0]); });
+        bench_operation(
+            suite, "op/sigmoid_" + dim, shape, 1,
+            [](Network<float> &n, vector<Node<float>> &in) { return n.sigmoid()(in[0]); });
+        bench_operation(suite, "op/local_normalisation_" + dim, shape, 1,
+                        [&](Network<float> &n, vector<Node<float>> &in) {
+                            return is_3d ? n.local_normalisation_3D(5)(in[0])
+                                         : n.local_normalisation(5)(in[0]);
+                        });
+        bench_operation(suite, "op/instance_normalisation_" + dim, shape, 1,
+                        [](Network<float> &n, vector<Node<float>> &in) {
+                            return n.instance_normalisation()(in[0]);
+                        });
+        bench_operation(suite, "op/addition_" + dim, shape, 2,
+                        [](Network<float> &n, vector<Node<float>> &in) {
+                            return n.addition()(in[0], in[1]);
+                        });
+        bench_operation(suite, "op/addition_relu_" + dim, shape, 2,
+                        [](Network<float> &n, vector<Node<float>> &in) {
+                            return n.relu()(n.addition()(in[0], in[1]));
+                        },
+                        true);
+        bench_operation(suite, "op/squared_loss_" + dim, shape, 2,
+                        [](Network<float> &n, vector<Node<float>> &in) {
+                            return n.squared_loss()(in[0], in[1]);
+                        });
+        bench_operation(suite, "op/support_loss_" + dim, shape, 2,
+                        [](Network<float> &n, vector<Node<float>> &in) {
+                            return n.support_loss(0.5)(in[0], in[1]);
+                        });
+    }
+}
+
+// Training step of a unet, forward and backward of the loss
+void bench_unets(Suite &suite) {
+    for (int size : {32, 64}) {
+        for (int channels : {2, 8}) {
+            ostringstream name;
+            name << "unet/size_" << size << "_channels_" << channels;
+            if (name.str().find(suite.filter) == string::npos)
+                continue;
+
+            UnetFixture fixture(size, channels);
+            suite.run(name.str(), [&] {
+                fixture.loss({fixture.y, fixture.sample});
+                fixture.network.zero_grad();
+                fixture.loss.backward();
+            });
+        }
+    }
+}
+
+// update() of every optimizer on a network of about 4.7M parameters
+void bench_optimizers(Suite &suite) {
+    Network<float> network;
+    auto node = network.input_2D(256);
+    for (int n(0); n < 8; ++n)
+        node = network.convolution_2D(256, 3)(node);
+    network.init_uniform(0.05);
+    network.grad_vec.init_normal(0.0, 0.01);
+
+    SGDOptimizer<float> sgd(0.001);
+    sgd.register_network(network);
+    suite.run("optimizer/sgd", [&] { sgd.update(); });
+
+    AdaOptimizer<float> ada(0.001);
+    ada.register_network(network);
+    suite.run("optimizer/ada", [&] { ada.update(); });
+
+    AdamOptimizer<float> adam(0.001);
+    adam.register_network(network);
+    suite.run("optimizer/adam", [&] { adam.update(); });
+}
+
+// Regressions of current against baseline, medians more than threshold slower
+int compare(BenchReport &current, string path, double threshold) {
+    BenchReport baseline;
+    {
+        ifstream in(path);
+        if (!in)
+            throw std::runtime_error("Couldn't open baseline " + path);
+        cereal::JSONInputArchive ar(in);
+        ar(cereal::make_nvp("report", baseline));
+    }
+
+    map<string, BenchResult> stored;
+    for (auto &r : baseline.benchmarks)
+        stored[r.name] = r;
+
+    int regressions(0), compared(0);
+    for (auto &r : current.benchmarks) {
+        if (!stored.count(r.name))
+            continue;
+        ++compared;
+        double ratio = r.median_ms / stored[r.name].median_ms;
+        if (ratio > 1 + threshold) {
+            cout << "REGRESSION " << r.name << ": " << stored[r.name].median_ms << " -> "
+                 << r.median_ms << " ms (" << setprecision(1) << 100 * (ratio - 1) << "%)"
+                 << setprecision(3) << endl;
+            ++regressions;
+        }
+    }
+    cout << regressions << " regressions in " << compared << " benchmarks against " << path
+         << " (threshold " << 100 * threshold << "%)" << endl;
+    // a comparison that measured nothing mustn't pass as one without regressions
+    if (!compared)
+        cout << "no benchmark to compare with the baseline" << endl;
+    return regressions || !compared ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    Suite suite;
+    string json, baseline;
+    double threshold = 0.1;
+    for (int i(1); i < argc; ++i) {
+        string arg = argv[i];
+        if (i + 1 == argc) {
+            cerr << "missing value for " << arg << endl;
+            return 2;
+        }
+        string value = argv[++i];
+        if (arg == "--filter")
+            suite.filter = value;
+        else if (arg == "--warmup")
+            suite.warmup = atoi(value.c_str());
+        else if (arg == "--reps")
+            suite.reps = max(1, atoi(value.c_str()));
+        else if (arg == "--json")
+            json = value;
+        else if (arg == "--baseline")
+            baseline = value;
+        else if (arg == "--threshold")
+            threshold = atof(value.c_str());
+        else {
+            cerr << "unknown option " << arg << endl;
+            return 2;
+        }
+    }
+
+    // this is a cuda library, without a device there is nothing to measure
+    int n_devices(0);
+    if (cudaGetDeviceCount(&n_devices) != cudaSuccess || n_devices == 0) {
+        cout << "no cuda device, benchmarks skipped" << endl;
+        suite.report.skipped = true;
+    } else {
+        cudaDeviceProp prop;
+        handle_error(cudaGetDeviceProperties(&prop, 0));
+        suite.report.device = prop.name;
+
+        bench_operations(suite);
+        bench_unets(suite);
+        bench_optimizers(suite);
+    }
+
+    if (!json.empty()) {
+        ofstream out(json);
+        cereal::JSONOutputArchive ar(out);
+        ar(cereal::make_nvp("report", suite.report));
+    }
+
+    int result(0);
+    if (!baseline.empty() && suite.report.skipped) {
+        cout << "baseline comparison asked for, but nothing ran" << endl;
+        result = 1;
+    } else if (!baseline.empty())
+        result = compare(suite.report, baseline, threshold);
+
+    if (!suite.report.skipped)
+        Handler::deinit();
+    return result;
+}
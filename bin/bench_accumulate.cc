@@ -0,0 +1,87 @@
+#include "bench_util.h"
+#include "dexe/handler.h"
+#include "dexe/optimizer.h"
+#include "dexe/util.h"
+
+#include <iostream>
+#include <memory>
+
+using namespace std;
+using namespace dexe;
+
+// One Adam step on k samples, once as a single batch and once accumulating k single sample
+// micro-batches. Reports the parameter difference, step times and resident memory of both.
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 32;
+    int k = argc > 2 ? atoi(argv[2]) : 4;
+
+    TensorShape sample_shape{1, 1, size, size, size};
+    vector<unique_ptr<Tensor<float>>> samples, targets;
+    vector<float> sample_data, target_data;
+    for (int i(0); i < k; ++i) {
+        samples.emplace_back(new Tensor<float>(sample_shape));
+        targets.emplace_back(new Tensor<float>(sample_shape));
+        samples.back()->init_normal(0.0, 0.1);
+        targets.back()->init_normal(0.0, 0.1);
+        auto s = samples.back()->to_vector(), t = targets.back()->to_vector();
+        sample_data.insert(sample_data.end(), s.begin(), s.end());
+        target_data.insert(target_data.end(), t.begin(), t.end());
+    }
+
+    UnetModel batched;
+    batched.network.init_uniform(0.05);
+    auto initial = batched.network.to_vector();
+    AdamOptimizer<float> batched_adam(0.001);
+    batched_adam.register_network(batched.network);
+    TensorShape batch_shape{k, 1, size, size, size};
+    Tensor<float> batch(batch_shape), batch_target(batch_shape);
+    batch.from_vector(sample_data);
+    batch_target.from_vector(target_data);
+
+    Handler::sync();
+    Timer timer;
+    batched.loss({batch_target, batch});
+    batched.network.zero_grad();
+    batched.loss.backward();
+    batched_adam.update();
+    Handler::sync();
+    double batched_time = timer.since();
+    auto expected = batched.network.to_vector();
+    size_t batched_bytes = batched.network.resident_bytes();
+
+    UnetModel accumulated;
+    accumulated.network.init_uniform(0.05);
+    accumulated.network.from_vector(initial);
+    AdamOptimizer<float> adam(0.001);
+    adam.register_network(accumulated.network);
+    accumulated.network.set_accumulate_grads(true);
+
+    Handler::sync();
+    timer.start();
+    accumulated.network.zero_grad();
+    for (int i(0); i < k; ++i) {
+        accumulated.loss({*targets[i], *samples[i]});
+        if (i > 0)
+            accumulated.network.zero_activation_grads();
+        accumulated.loss.backward();
+    }
+    adam.grad_scale = 1.0 / k;
+    adam.update();
+    Handler::sync();
+    double accumulated_time = timer.since();
+    auto result = accumulated.network.to_vector();
+    size_t accumulated_bytes = accumulated.network.resident_bytes();
+
+    // micro-batch gradients are summed in another order than the batch
+    auto param_diff = max_diff(result, expected);
+
+    cout << "batch of " << k << ": " << batched_time << "s, " << batched_bytes / (1 << 20)
+         << " MiB" << endl;
+    cout << k << " accumulated: " << accumulated_time << "s, " << accumulated_bytes / (1 << 20)
+         << " MiB" << endl;
+    cout << "max param diff: " << param_diff << endl;
+    check_diff("accumulated parameters", param_diff, 1e-5);
+
+    Handler::deinit();
+    return check_status();
+}
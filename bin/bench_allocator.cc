@@ -0,0 +1,76 @@
+#include "dexe/allocator.h"
+#include "dexe/util.h"
+
+#include <cuda_runtime.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace dexe;
+
+// Allocation latency under the churn of varying patch sizes: every round frees the buffers of
+// the previous patch and allocates those of a new one, on n_threads threads at once.
+// Compares the caching allocator with its caching turned off (budget 0), on the host backend,
+// which needs no GPU, and on the device backend when there is a device.
+double churn(CachingAllocator &allocator, int n_threads, int n_rounds) {
+    auto run = [&](int thread_index) {
+        mt19937 engine(thread_index + 1);
+        uniform_int_distribution<int> patch(24, 64);
+        vector<pair<void *, size_t>> live;
+        for (int round(0); round < n_rounds; ++round) {
+            for (auto &block : live)
+                allocator.release(block.first, block.second);
+            live.clear();
+            // activations of a few layers of a 16 channel volume of float
+            size_t voxels = size_t(patch(engine)) * patch(engine) * patch(engine);
+            for (int layer(0); layer < 8; ++layer) {
+                size_t bytes = voxels * 16 * sizeof(float) >> (layer / 2);
+                live.emplace_back(allocator.allocate(bytes), bytes);
+            }
+        }
+        for (auto &block : live)
+            allocator.release(block.first, block.second);
+    };
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int t(0); t < n_threads; ++t)
+        threads.emplace_back(run, t);
+    for (auto &t : threads)
+        t.join();
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return elapsed / (double(n_threads) * n_rounds * 8 * 2); // per allocate or release
+}
+
+void compare(AllocatorBackend backend, string name, int n_threads, int n_rounds) {
+    CachingAllocator uncached(backend, 0, 0);
+    double uncached_latency = churn(uncached, n_threads, n_rounds);
+
+    CachingAllocator caching(backend);
+    double cached_latency = churn(caching, n_threads, n_rounds);
+
+    cout << name << ", " << n_threads << " threads: uncached " << uncached_latency * 1e6
+         << " us, cached " << cached_latency * 1e6 << " us per call" << endl;
+    caching.stats().describe(cout);
+}
+
+int main(int argc, char **argv) {
+    int n_rounds = argc > 1 ? atoi(argv[1]) : 200;
+    int max_threads = argc > 2 ? atoi(argv[2]) : 4;
+
+    for (int n(1); n <= max_threads; n *= 2)
+        compare(AllocatorBackend::HOST, "host", n, n_rounds);
+
+    int n_devices(0);
+    if (cudaGetDeviceCount(&n_devices) != cudaSuccess || n_devices == 0) {
+        cout << "no cuda device, skipping the device backend" << endl;
+        return 0;
+    }
+    for (int n(1); n <= max_threads; n *= 2)
+        compare(AllocatorBackend::DEVICE, "device", n, n_rounds / 4);
+}
@@ -0,0 +1,72 @@
+#include "dexe/batcher.h"
+#include "dexe/handler.h"
+#include "dexe/models.h"
+#include "dexe/network.h"
+#include "dexe/util.h"
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <thread>
+
+using namespace std;
+using namespace dexe;
+
+// Load generator for the batcher: closed loop clients send single volumes of two
+// sizes and wait for the answer. Reports throughput and latency percentiles for
+// unbatched and batched serving
+int main(int argc, char **argv) {
+    int n_clients = argc > 1 ? atoi(argv[1]) : 16;
+    int n_requests = argc > 2 ? atoi(argv[2]) : 50; // per client
+    int max_batch = argc > 3 ? atoi(argv[3]) : 8;
+    double max_delay = argc > 4 ? atof(argv[4]) : 0.005;
+
+    Network<float> network;
+    auto prediction = make_unet(&network, 1, 1);
+    network.init_uniform(0.05);
+
+    vector<int> sizes{16, 24}; // separate shape buckets
+
+    auto serve = [&](int batch, double delay) {
+        Batcher<float> batcher(&network, prediction.index, batch, delay);
+        vector<vector<double>> latencies(n_clients);
+
+        Timer timer;
+        vector<thread> clients;
+        for (int c(0); c < n_clients; ++c)
+            clients.emplace_back([&, c] {
+                mt19937 rng(c);
+                normal_distribution<float> normal(0.0, 0.1);
+                for (int r(0); r < n_requests; ++r) {
+                    int size = sizes[rng() % sizes.size()];
+                    TensorShape shape{1, 1, size, size, size};
+                    vector<float> volume(shape.n_elements());
+                    for (auto &v : volume)
+                        v = normal(rng);
+
+                    Timer latency;
+                    batcher.submit(volume, shape).get();
+                    latencies[c].push_back(latency.since());
+                }
+            });
+        for (auto &client : clients)
+            client.join();
+        double elapsed = timer.since();
+
+        vector<double> all;
+        for (auto &l : latencies)
+            all.insert(all.end(), l.begin(), l.end());
+        sort(all.begin(), all.end());
+        auto percentile = [&all](double p) { return all[min<size_t>(all.size() - 1, p * all.size())]; };
+
+        cout << "max batch: " << batch << " delay: " << delay << " batches: " << batcher.n_batches
+             << " padded samples: " << batcher.n_padded << endl;
+        cout << "  throughput: " << all.size() / elapsed << " req/s p50: " << percentile(0.5)
+             << " p99: " << percentile(0.99) << endl;
+    };
+
+    serve(1, 0.0);
+    serve(max_batch, max_delay);
+
+    Handler::deinit();
+}
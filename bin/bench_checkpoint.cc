@@ -0,0 +1,51 @@
+#include "bench_util.h"
+#include "dexe/handler.h"
+#include "dexe/util.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace dexe;
+
+// Trains one unet step with and without checkpointing, reports the activation memory
+// left after forward and the step time, and checks that the gradients agree
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 32;
+
+    UnetFixture fixture(size);
+    auto &network = fixture.network;
+
+    auto step = [&](vector<float> &grad, size_t &bytes) {
+        Handler::sync();
+        Timer timer;
+        fixture.loss({fixture.y, fixture.sample});
+        bytes = network.resident_bytes();
+        network.zero_grad();
+        fixture.loss.backward();
+        Handler::sync();
+        grad = network.gradient();
+        return timer.since();
+    };
+
+    vector<float> full_grad, checkpointed_grad;
+    size_t full_bytes(0), checkpointed_bytes(0);
+    step(full_grad, full_bytes); // warm up
+    auto full_time = step(full_grad, full_bytes);
+
+    network.checkpointing = true;
+    step(checkpointed_grad, checkpointed_bytes);
+    auto checkpointed_time = step(checkpointed_grad, checkpointed_bytes);
+
+    // recomputation runs the same kernels on the same inputs
+    auto grad_diff = max_diff(full_grad, checkpointed_grad);
+
+    cout << "resident bytes after forward full: " << full_bytes
+         << " checkpointed: " << checkpointed_bytes << endl;
+    cout << "step time full: " << full_time << "s checkpointed: " << checkpointed_time << "s"
+         << endl;
+    cout << "max grad diff: " << grad_diff << endl;
+    check_diff("checkpointed gradient", grad_diff, 1e-5);
+
+    Handler::deinit();
+    return check_status();
+}
@@ -0,0 +1,38 @@
+#include "bench_util.h"
+#include "dexe/handler.h"
+#include "dexe/util.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace dexe;
+
+// Roofline report of a unet training step per node, at a few patch sizes.
+// Optional peaks (GFLOP/s, GB/s) override the estimate from the device properties.
+int main(int argc, char **argv) {
+    double peak_gflops = argc > 1 ? atof(argv[1]) : 0;
+    double peak_gbs = argc > 2 ? atof(argv[2]) : 0;
+
+    for (int size : {16, 32, 64}) {
+        UnetFixture fixture(size);
+        auto &network = fixture.network;
+        auto &loss = fixture.loss;
+        loss.load_inputs({fixture.y, fixture.sample});
+
+        auto report = network.cost_report({loss.index}, 5, true, peak_gflops, peak_gbs);
+        cout << "patch " << size << "^3" << endl;
+        report.describe(cout);
+
+        int compute(0);
+        double time(0);
+        for (auto &node : report.nodes) {
+            compute += report.compute_bound(node.forward_flops, node.forward_bytes);
+            time += node.forward_time + node.backward_time;
+        }
+        cout << compute << " of " << report.nodes.size()
+             << " nodes compute bound in forward, step time " << time * 1e3 << " ms" << endl
+             << endl;
+    }
+
+    Handler::deinit();
+}
@@ -0,0 +1,86 @@
+#include "bench_util.h"
+#include "dexe/data_parallel.h"
+#include "dexe/handler.h"
+#include "dexe/optimizer.h"
+#include "dexe/util.h"
+
+#include <iostream>
+#include <memory>
+#include <thread>
+
+using namespace std;
+using namespace dexe;
+
+// Training throughput of data parallel replicas, doubling up to the number of cores,
+// and the difference of a parallel step with the single network step on the same samples
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 16;
+    int n_steps = argc > 2 ? atoi(argv[2]) : 10;
+    int max_replicas = argc > 3 ? atoi(argv[3]) : thread::hardware_concurrency();
+    max_replicas = max(max_replicas, 1);
+
+    TensorShape sample_shape{1, 1, size, size, size};
+    vector<unique_ptr<Tensor<float>>> samples, targets;
+    for (int r(0); r < max_replicas; ++r) {
+        samples.emplace_back(new Tensor<float>(sample_shape));
+        targets.emplace_back(new Tensor<float>(sample_shape));
+        samples.back()->init_normal(0.0, 0.1);
+        targets.back()->init_normal(0.0, 0.1);
+    }
+
+    UnetModel reference;
+    reference.network.init_uniform(0.05);
+    auto initial = reference.network.to_vector();
+
+    for (int n(1); n <= max_replicas; n *= 2) {
+        // one step of a single network on all n samples at once
+        vector<float> sample_data, target_data;
+        for (int r(0); r < n; ++r) {
+            auto s = samples[r]->to_vector(), t = targets[r]->to_vector();
+            sample_data.insert(sample_data.end(), s.begin(), s.end());
+            target_data.insert(target_data.end(), t.begin(), t.end());
+        }
+        TensorShape batch_shape{n, 1, size, size, size};
+        Tensor<float> batch(batch_shape), batch_target(batch_shape);
+        batch.from_vector(sample_data);
+        batch_target.from_vector(target_data);
+
+        reference.network.from_vector(initial);
+        SGDOptimizer<float> single_sgd(0.01);
+        single_sgd.register_network(reference.network);
+        reference.loss({batch_target, batch});
+        reference.network.zero_grad();
+        reference.loss.backward();
+        single_sgd.update();
+        auto expected = reference.network.to_vector();
+
+        UnetModel model;
+        model.network.init_uniform(0.05);
+        model.network.from_vector(initial);
+        SGDOptimizer<float> sgd(0.01);
+        sgd.register_network(model.network);
+        DataParallel<float> trainer(model.network, sgd, model.loss.index, n);
+
+        vector<vector<Tensor<float> *>> batches;
+        for (int r(0); r < n; ++r)
+            batches.push_back({targets[r].get(), samples[r].get()});
+        trainer.step(batches);
+        auto result = model.network.to_vector();
+        auto param_diff = max_diff(result, expected);
+
+        Handler::sync();
+        Timer timer;
+        for (int i(0); i < n_steps; ++i)
+            trainer.step(batches);
+        Handler::sync();
+        double elapsed = timer.since();
+
+        cout << "replicas: " << n << " samples/s: " << n * n_steps / elapsed
+             << " max param diff with single network: " << param_diff << endl;
+        // replicas sum their gradients in another order than the batch
+        check_diff(to_string(n) + " replica parameters", param_diff, 1e-5);
+    }
+
+    Handler::deinit();
+    return check_status();
+}
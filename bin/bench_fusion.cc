@@ -0,0 +1,70 @@
+#include "bench_util.h"
+#include "dexe/handler.h"
+#include "dexe/util.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace dexe;
+
+// Times unet training steps before and after fusing activations, checks that loss and
+// gradient don't change and that the fused network survives a save and load
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 32;
+    int n_steps = argc > 2 ? atoi(argv[2]) : 10;
+
+    Network<float> network;
+    auto target = network.input_3D(1);
+    auto prediction = make_unet(&network, 1, 1);
+    auto residual = network.convolution_3D(1, 3)(prediction);
+    auto rectified = network.relu()(network.addition()(prediction, residual));
+    auto loss = network.support_loss(0.5)(rectified, target);
+
+    Tensor<float> sample(TensorShape{1, 1, size, size, size});
+    Tensor<float> y(TensorShape{1, 1, size, size, size});
+    network.init_uniform(0.05);
+    sample.init_normal(0.0, 0.1);
+    y.init_normal(0.0, 0.1);
+
+    auto time_steps = [&](Node<float> loss_node, float &loss_value, vector<float> &grad) {
+        Handler::sync();
+        Timer timer;
+        for (int n(0); n < n_steps; ++n) {
+            loss_node({y, sample});
+            network.zero_grad();
+            loss_node.backward();
+        }
+        Handler::sync();
+        loss_value = loss_node.x().to_vector()[0];
+        grad = network.gradient();
+        return timer.since() / n_steps;
+    };
+
+    float unfused_loss, fused_loss, loaded_loss;
+    vector<float> unfused_grad, fused_grad, loaded_grad;
+    auto unfused_time = time_steps(loss, unfused_loss, unfused_grad);
+
+    auto report = network.fuse({loss.index});
+    Node<float> fused(report.remap[loss.index], &network);
+    auto fused_time = time_steps(fused, fused_loss, fused_grad);
+
+    network.save("fused.net");
+    network.load("fused.net");
+    time_steps(fused, loaded_loss, loaded_grad);
+
+    auto fused_diff = max_diff(unfused_grad, fused_grad);
+    auto loaded_diff = max_diff(fused_grad, loaded_grad);
+
+    report.describe(cout);
+    cout << endl;
+    cout << "step unfused: " << unfused_time << " fused: " << fused_time << endl;
+    cout << "loss unfused: " << unfused_loss << " fused: " << fused_loss
+         << " loaded: " << loaded_loss << endl;
+    cout << "max grad diff fused: " << fused_diff << " loaded: " << loaded_diff << endl;
+    check_diff("fused loss", abs(unfused_loss - fused_loss), 1e-5);
+    check_diff("fused gradient", fused_diff, 1e-4);
+    check_diff("loaded gradient", loaded_diff, 1e-5);
+
+    Handler::deinit();
+    return check_status();
+}
@@ -0,0 +1,57 @@
+#include "bench_util.h"
+#include "dexe/handler.h"
+#include "dexe/util.h"
+
+#include <iostream>
+#include <memory>
+
+using namespace std;
+using namespace dexe;
+
+// Evaluates the loss of one unet prediction against a sweep of targets, with and without
+// incremental mode. Incremental runs should only recompute the loss node per target
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 32;
+    int n_targets = argc > 2 ? atoi(argv[2]) : 20;
+
+    UnetFixture fixture(size);
+    auto &network = fixture.network;
+    auto &loss = fixture.loss;
+    auto &sample = fixture.sample;
+
+    vector<unique_ptr<Tensor<float>>> targets;
+    for (int t(0); t < n_targets; ++t) {
+        targets.emplace_back(make_unique<Tensor<float>>(TensorShape{1, 1, size, size, size}));
+        targets.back()->init_normal(0.0, 0.1);
+    }
+
+    auto sweep = [&](vector<float> &losses) {
+        network.n_executed = network.n_skipped = 0;
+        Handler::sync();
+        Timer timer;
+        for (auto &y : targets) {
+            loss({*y, sample});
+            losses.push_back(loss.x().to_vector()[0]);
+        }
+        Handler::sync();
+        return timer.since();
+    };
+
+    vector<float> full_losses, incremental_losses;
+    auto full_time = sweep(full_losses);
+    size_t full_executed = network.n_executed;
+
+    network.set_incremental(true);
+    auto incremental_time = sweep(incremental_losses);
+
+    auto loss_diff = max_diff(full_losses, incremental_losses);
+
+    cout << "full: " << full_time << "s, nodes executed: " << full_executed << endl;
+    cout << "incremental: " << incremental_time << "s, nodes executed: " << network.n_executed
+         << " skipped: " << network.n_skipped << endl;
+    cout << "max loss diff: " << loss_diff << endl;
+    check_diff("incremental loss", loss_diff, 1e-6);
+
+    Handler::deinit();
+    return check_status();
+}
@@ -0,0 +1,66 @@
+#include "bench_util.h"
+#include "dexe/handler.h"
+#include "dexe/util.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace dexe;
+
+// Times unet forward and backward in NCHW and after converting the graph to channels last
+// (NDHWC), and checks that loss and gradient stay the same
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 32;
+    int n_steps = argc > 2 ? atoi(argv[2]) : 10;
+    int channels = argc > 3 ? atoi(argv[3]) : 4;
+
+    UnetFixture fixture(size, channels);
+    auto &network = fixture.network;
+    auto &sample = fixture.sample;
+    auto &y = fixture.y;
+
+    auto time_steps = [&](Node<float> loss_node, float &loss_value, vector<float> &grad,
+                          double &forward_time) {
+        loss_node({y, sample}); // warm up, compiles the plan
+        Handler::sync();
+        Timer timer;
+        forward_time = 0;
+        for (int n(0); n < n_steps; ++n) {
+            Timer forward_timer;
+            loss_node({y, sample});
+            Handler::sync();
+            forward_time += forward_timer.since();
+            network.zero_grad();
+            loss_node.backward();
+        }
+        Handler::sync();
+        forward_time /= n_steps;
+        loss_value = loss_node.x().to_vector()[0];
+        grad = network.gradient();
+        return timer.since() / n_steps;
+    };
+
+    float nchw_loss, nhwc_loss;
+    vector<float> nchw_grad, nhwc_grad;
+    double nchw_forward, nhwc_forward;
+    auto nchw_time = time_steps(fixture.loss, nchw_loss, nchw_grad, nchw_forward);
+
+    auto report = network.convert_layout({fixture.loss.index}, CUDNN_TENSOR_NHWC);
+    Node<float> converted(report.remap[fixture.loss.index], &network);
+    auto nhwc_time = time_steps(converted, nhwc_loss, nhwc_grad, nhwc_forward);
+
+    // channels last picks other convolution algorithms, so results agree up to rounding
+    auto grad_diff = max_diff(nchw_grad, nhwc_grad);
+
+    report.describe(cout);
+    cout << endl;
+    cout << "step nchw: " << nchw_time << " (forward " << nchw_forward << ") nhwc: " << nhwc_time
+         << " (forward " << nhwc_forward << ")" << endl;
+    cout << "loss nchw: " << nchw_loss << " nhwc: " << nhwc_loss << " max grad diff: " << grad_diff
+         << endl;
+    check_diff("channels last loss", abs(nchw_loss - nhwc_loss), 1e-4);
+    check_diff("channels last gradient", grad_diff, 1e-3);
+
+    Handler::deinit();
+    return check_status();
+}
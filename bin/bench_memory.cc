@@ -0,0 +1,74 @@
+#include "bench_util.h"
+#include "dexe/handler.h"
+#include "dexe/util.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace dexe;
+
+// Resident tensor memory of a unet evaluated with Network::infer, compared to a plain forward
+void inference(int size) {
+    Network<float> network;
+    auto prediction = make_unet(&network, 1, 1);
+
+    Tensor<float> sample(TensorShape{1, 1, size, size, size});
+    network.init_uniform(0.05);
+    sample.init_normal(0.0, 0.1);
+
+    prediction.infer({sample});
+    auto inferred = prediction.x().to_vector();
+    auto infer_bytes = network.resident_bytes();
+
+    prediction({sample});
+    auto forwarded = prediction.x().to_vector();
+    auto forward_bytes = network.resident_bytes();
+
+    auto output_diff = max_diff(inferred, forwarded);
+    cout << "resident bytes forward: " << forward_bytes << " infer: " << infer_bytes
+         << " max output diff: " << output_diff << endl;
+    check_diff("inferred output", output_diff, 1e-5);
+}
+
+// Reports planned versus naive activation memory of a unet training step,
+// and checks that running from the arena gives the same loss and gradient
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 32;
+
+    UnetFixture fixture(size);
+    auto &network = fixture.network;
+    auto &loss = fixture.loss;
+    auto &sample = fixture.sample;
+    auto &y = fixture.y;
+
+    loss({y, sample});
+    network.zero_grad();
+    loss.backward();
+    auto naive_loss = loss.x().to_vector()[0];
+    auto naive_grad = network.gradient();
+    auto naive_bytes = network.resident_bytes();
+
+    auto &memory = network.plan_memory();
+    memory.describe(cout);
+    cout << endl;
+
+    loss({y, sample});
+    network.zero_grad();
+    loss.backward();
+    auto planned_loss = loss.x().to_vector()[0];
+    auto planned_grad = network.gradient();
+    auto planned_bytes = network.resident_bytes();
+
+    auto grad_diff = max_diff(naive_grad, planned_grad);
+    cout << "loss naive: " << naive_loss << " planned: " << planned_loss
+         << " max grad diff: " << grad_diff << endl;
+    check_diff("planned loss", abs(naive_loss - planned_loss), 1e-5);
+    check_diff("planned gradient", grad_diff, 1e-4);
+    cout << "resident bytes training naive: " << naive_bytes << " planned: " << planned_bytes
+         << endl;
+
+    inference(size);
+
+    Handler::deinit();
+    return check_status();
+}
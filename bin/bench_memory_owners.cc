@@ -0,0 +1,55 @@
+#include "bench_util.h"
+#include "dexe/handler.h"
+#include "dexe/memory.h"
+#include "dexe/optimizer.h"
+#include "dexe/profiler.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace dexe;
+
+// Device memory of unet training steps with Adam by owner and phase.
+// Writes the allocation timeline as csv and, together with the profile, as a chrome trace.
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 32;
+    int n_steps = argc > 2 ? atoi(argv[2]) : 3;
+
+    MemoryTracker::enable();
+    Profiler::enable();
+
+    UnetFixture fixture(size);
+    auto &network = fixture.network;
+    auto &loss = fixture.loss;
+    auto &sample = fixture.sample;
+    auto &y = fixture.y;
+
+    AdamOptimizer<float> optimizer(0.001);
+    optimizer.register_network(network);
+
+    for (int n(0); n < n_steps; ++n) {
+        loss({y, sample});
+        network.zero_grad();
+        loss.backward();
+        optimizer.update();
+    }
+    Handler::sync();
+
+    MemoryTracker::summary(cout);
+
+    size_t parameters(0), optimizer_state(0);
+    for (auto &owner : MemoryTracker::owners()) {
+        if (owner.name == "parameters")
+            parameters = owner.current;
+        if (owner.name.find("AdamOptimizer::") == 0)
+            optimizer_state += owner.current;
+    }
+    if (parameters)
+        cout << "adam state is " << double(optimizer_state) / parameters
+             << "x the parameter memory" << endl;
+
+    MemoryTracker::write_timeline("memory.csv");
+    Profiler::write_trace("memory_trace.json");
+
+    Handler::deinit();
+}
@@ -0,0 +1,68 @@
+#include "bench_util.h"
+#include "dexe/handler.h"
+#include "dexe/util.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace dexe;
+
+// Builds a network with foldable convolution chains, nested additions, redundant
+// activations and a branch that doesn't reach the output, optimizes it and checks
+// that the output didn't change
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 32;
+    int n_iterations = argc > 2 ? atoi(argv[2]) : 10;
+
+    Network<float> network;
+    auto in = network.input_3D(1, "input");
+
+    auto a = network.convolution_3D(8, 3)(in);
+    a = network.convolution_3D(8, 1)(a); // folds into the 3x3x3 convolution
+    a = network.relu()(a);
+    a = network.relu()(a); // relu of a relu
+
+    auto b = network.convolution_3D(8, 1)(in);
+    b = network.convolution_3D(8, 3)(b); // pointwise first, folds unless its bias is padded
+    auto c = network.convolution_3D(8, 3)(a);
+    auto sum = network.addition()(network.addition()(a, b), c); // nested sums merge
+
+    auto unused = network.convolution_3D(4, 3)(sum); // never evaluated for the output
+    network.relu()(unused);
+
+    auto out = network.convolution_3D(1, 3, "output")(sum);
+
+    Tensor<float> sample(TensorShape{1, 1, size, size, size});
+    network.init_uniform(0.05);
+    sample.init_normal(0.0, 0.1);
+
+    auto time_forward = [&](Node<float> output) {
+        output({sample});
+        Handler::sync();
+        Timer timer;
+        for (int n(0); n < n_iterations; ++n)
+            output({sample});
+        Handler::sync();
+        return timer.since() / n_iterations;
+    };
+
+    auto before_time = time_forward(out);
+    auto before = out.x().to_vector();
+
+    auto report = network.optimize({out.index});
+    Node<float> optimized(report.remap[out.index], &network);
+    auto after_time = time_forward(optimized);
+    auto after = optimized.x().to_vector();
+
+    // folded convolutions sum in another order
+    auto output_diff = max_diff(before, after);
+
+    report.describe(cout);
+    cout << endl;
+    cout << "forward before: " << before_time << " after: " << after_time
+         << " max output diff: " << output_diff << endl;
+    check_diff("optimized output", output_diff, 1e-4);
+
+    Handler::deinit();
+    return check_status();
+}
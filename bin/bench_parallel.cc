@@ -0,0 +1,60 @@
+#include "bench_util.h"
+#include "dexe/handler.h"
+#include "dexe/util.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace dexe;
+
+// Times unet training steps run serially and with the parallel executor at several
+// thread counts, and checks the parallel gradient against the serial one
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 16;
+    int n_steps = argc > 2 ? atoi(argv[2]) : 20;
+
+    UnetFixture fixture(size);
+    auto &network = fixture.network;
+    auto &loss = fixture.loss;
+
+    // weights are never updated, so every run computes the same gradient
+    auto time_steps = [&](int n_threads, vector<float> &grad) {
+        network.set_threads(n_threads);
+
+        // warm up, also creates the handles of every worker
+        for (int n(0); n < 3; ++n) {
+            loss({fixture.y, fixture.sample});
+            network.zero_grad();
+            loss.backward();
+        }
+        Handler::sync();
+
+        Timer timer;
+        for (int n(0); n < n_steps; ++n) {
+            loss({fixture.y, fixture.sample});
+            network.zero_grad();
+            loss.backward();
+        }
+        Handler::sync();
+        grad = network.gradient();
+        return timer.since() / n_steps;
+    };
+
+    vector<float> serial_grad, grad;
+    auto serial = time_steps(0, serial_grad);
+    cout << "serial:     " << serial * 1e3 << " ms" << endl;
+
+    for (int n_threads : {1, 4, 16}) {
+        auto parallel = time_steps(n_threads, grad);
+
+        // branches may finish in another order, which changes the order gradients are summed
+        auto grad_diff = max_diff(grad, serial_grad);
+        cout << n_threads << " threads: " << parallel * 1e3 << " ms, speedup "
+             << serial / parallel << "x, max grad diff " << grad_diff << endl;
+        check_diff(to_string(n_threads) + " thread gradient", grad_diff, 1e-4);
+    }
+
+    network.set_threads(0);
+    Handler::deinit();
+    return check_status();
+}
@@ -0,0 +1,81 @@
+#include "bench_util.h"
+#include "dexe/handler.h"
+#include "dexe/optimizer.h"
+#include "dexe/pipeline.h"
+#include "dexe/util.h"
+
+#include <iostream>
+#include <memory>
+
+using namespace std;
+using namespace dexe;
+
+// Training throughput of pipelines with an increasing number of stages, and the difference
+// of a pipeline step with the single network step on the same micro-batches
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 32;
+    int n_steps = argc > 2 ? atoi(argv[2]) : 10;
+    int n_micro = argc > 3 ? atoi(argv[3]) : 8;
+    int max_stages = argc > 4 ? atoi(argv[4]) : 4;
+
+    TensorShape sample_shape{1, 1, size, size, size};
+    vector<unique_ptr<Tensor<float>>> samples, targets;
+    vector<float> sample_data, target_data;
+    for (int m(0); m < n_micro; ++m) {
+        samples.emplace_back(new Tensor<float>(sample_shape));
+        targets.emplace_back(new Tensor<float>(sample_shape));
+        samples.back()->init_normal(0.0, 0.1);
+        targets.back()->init_normal(0.0, 0.1);
+        auto s = samples.back()->to_vector(), t = targets.back()->to_vector();
+        sample_data.insert(sample_data.end(), s.begin(), s.end());
+        target_data.insert(target_data.end(), t.begin(), t.end());
+    }
+    vector<vector<Tensor<float> *>> micro_batches;
+    for (int m(0); m < n_micro; ++m)
+        micro_batches.push_back({targets[m].get(), samples[m].get()});
+
+    // one step of a single network on all micro-batches at once
+    UnetModel reference;
+    reference.network.init_uniform(0.05);
+    auto initial = reference.network.to_vector();
+    TensorShape batch_shape{n_micro, 1, size, size, size};
+    Tensor<float> batch(batch_shape), batch_target(batch_shape);
+    batch.from_vector(sample_data);
+    batch_target.from_vector(target_data);
+    SGDOptimizer<float> single_sgd(0.01);
+    single_sgd.register_network(reference.network);
+    reference.loss({batch_target, batch});
+    reference.network.zero_grad();
+    reference.loss.backward();
+    single_sgd.update();
+    auto expected = reference.network.to_vector();
+
+    for (int n(1); n <= max_stages; ++n) {
+        UnetModel model;
+        model.network.init_uniform(0.05);
+        model.network.from_vector(initial);
+        SGDOptimizer<float> sgd(0.01);
+        sgd.register_network(model.network);
+        Pipeline<float> pipeline(model.network, sgd, model.loss.index, n);
+
+        pipeline.step(micro_batches);
+        auto result = model.network.to_vector();
+        auto param_diff = max_diff(result, expected);
+        pipeline.describe(cout);
+
+        Handler::sync();
+        Timer timer;
+        for (int i(0); i < n_steps; ++i)
+            pipeline.step(micro_batches);
+        Handler::sync();
+        double elapsed = timer.since();
+
+        cout << "stages: " << n << " samples/s: " << n_micro * n_steps / elapsed
+             << " max param diff with single network: " << param_diff << endl;
+        // micro-batch gradients are summed in another order than the batch
+        check_diff(to_string(n) + " stage parameters", param_diff, 1e-5);
+    }
+
+    Handler::deinit();
+    return check_status();
+}
@@ -0,0 +1,57 @@
+#include "dexe/handler.h"
+#include "dexe/models.h"
+#include "dexe/network.h"
+#include "dexe/util.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace dexe;
+
+// Measures the host side overhead of a training step on a deep unet graph.
+// The patch is kept tiny so kernel time is negligible compared to graph traversal,
+// argument building and dry runs.
+double time_steps(bool cache_plans, int n_steps) {
+    Network<float> network;
+    network.cache_plans = cache_plans;
+
+    auto target = network.input_3D(1);
+    auto prediction = make_unet(&network, 1, 1);
+    auto loss = network.support_loss(0.5)(prediction, target);
+
+    Tensor<float> sample(TensorShape{1, 1, 8, 8, 8});
+    Tensor<float> y(TensorShape{1, 1, 8, 8, 8});
+    network.init_uniform(0.05);
+    sample.init_normal(0.0, 0.1);
+    y.init_normal(0.0, 0.1);
+
+    // warm up, makes sure all buffers and the plan are in place
+    for (int n(0); n < 3; ++n) {
+        loss({y, sample});
+        network.zero_grad();
+        loss.backward();
+    }
+    Handler::sync();
+
+    Timer timer;
+    for (int n(0); n < n_steps; ++n) {
+        loss({y, sample});
+        network.zero_grad();
+        loss.backward();
+    }
+    Handler::sync();
+    return timer.since() / n_steps;
+}
+
+int main(int argc, char **argv) {
+    int n_steps = argc > 1 ? atoi(argv[1]) : 100;
+
+    auto uncached = time_steps(false, n_steps);
+    auto cached = time_steps(true, n_steps);
+
+    cout << "unet step without plan cache: " << uncached * 1e6 << " us" << endl;
+    cout << "unet step with plan cache:    " << cached * 1e6 << " us" << endl;
+    cout << "speedup: " << uncached / cached << "x" << endl;
+
+    Handler::deinit();
+}
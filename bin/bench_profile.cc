@@ -0,0 +1,58 @@
+#include "bench_util.h"
+#include "dexe/handler.h"
+#include "dexe/optimizer.h"
+#include "dexe/profiler.h"
+#include "dexe/util.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace dexe;
+
+// Profiles unet training steps: prints the per operation summary and writes a chrome trace.
+// Also times the steps with the profiler disabled and enabled without syncing, to show its overhead.
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 16;
+    int n_steps = argc > 2 ? atoi(argv[2]) : 10;
+    string trace = argc > 3 ? argv[3] : "trace.json";
+
+    UnetFixture fixture(size);
+    auto &network = fixture.network;
+    auto &loss = fixture.loss;
+    auto &sample = fixture.sample;
+    auto &y = fixture.y;
+
+    AdamOptimizer<float> optimizer(0.001);
+    optimizer.register_network(network);
+
+    auto time_steps = [&]() {
+        Handler::sync();
+        Timer timer;
+        for (int n(0); n < n_steps; ++n) {
+            loss({y, sample});
+            network.zero_grad();
+            loss.backward();
+            optimizer.update();
+        }
+        Handler::sync();
+        return timer.since() / n_steps;
+    };
+
+    // the first step includes the dry runs
+    Profiler::enable();
+    time_steps();
+    Profiler::summary(cout);
+    Profiler::write_trace(trace);
+    cout << "wrote " << Profiler::events().size() << " events to " << trace << endl;
+
+    Profiler::disable();
+    Profiler::clear();
+    auto disabled = time_steps();
+    Profiler::enable(false);
+    auto enabled = time_steps();
+    Profiler::disable();
+    cout << "step time disabled: " << disabled << "s enabled without sync: " << enabled << "s"
+         << endl;
+
+    Handler::deinit();
+}
@@ -0,0 +1,59 @@
+#include "bench_util.h"
+#include "dexe/handler.h"
+#include "dexe/util.h"
+
+#include <iostream>
+#include <memory>
+#include <thread>
+
+using namespace std;
+using namespace dexe;
+
+// Inference throughput of weight sharing replicas, one thread per replica,
+// doubling the number of replicas up to the number of cores
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 32;
+    int n_requests = argc > 2 ? atoi(argv[2]) : 20; // per replica
+    int max_replicas = argc > 3 ? atoi(argv[3]) : thread::hardware_concurrency();
+
+    Network<float> network;
+    auto prediction = make_unet(&network, 1, 1);
+    network.init_uniform(0.05);
+
+    Tensor<float> sample(TensorShape{1, 1, size, size, size});
+    sample.init_normal(0.0, 0.1);
+    prediction.infer({sample});
+    auto reference = prediction.x().to_vector();
+
+    for (int n(1); n <= max(max_replicas, 1); n *= 2) {
+        auto replicas = network.replicate(n);
+        vector<double> max_diff(n);
+
+        Handler::sync();
+        Timer timer;
+        vector<thread> workers;
+        for (int r(0); r < n; ++r)
+            workers.emplace_back([&, r] {
+                Node<float> output(prediction.index, replicas[r].get());
+                Tensor<float> input(sample.shape);
+                input.from_tensor(sample);
+                for (int i(0); i < n_requests; ++i)
+                    output.infer({input});
+                auto result = output.x().to_vector();
+                for (size_t i(0); i < result.size(); ++i)
+                    max_diff[r] = max<double>(max_diff[r], abs(result[i] - reference[i]));
+                Handler::deinit();
+            });
+        for (auto &worker : workers)
+            worker.join();
+        double elapsed = timer.since();
+
+        auto output_diff = *max_element(max_diff.begin(), max_diff.end());
+        cout << "replicas: " << n << " throughput: " << n * n_requests / elapsed
+             << " req/s max output diff: " << output_diff << endl;
+        check_diff(to_string(n) + " replica output", output_diff, 1e-5);
+    }
+
+    Handler::deinit();
+    return check_status();
+}
@@ -0,0 +1,65 @@
+#include "bench_util.h"
+#include "dexe/checkpoint.h"
+#include "dexe/handler.h"
+#include "dexe/optimizer.h"
+#include "dexe/util.h"
+
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+using namespace dexe;
+
+// Trains a unet with a checkpoint every few steps. Compares the time training stands still for
+// a synchronous Network::save with the snapshot of an asynchronous checkpoint,
+// and checks that loading the last checkpoint restores the parameters
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 32;
+    int base_channels = argc > 2 ? atoi(argv[2]) : 16;
+    int n_steps = argc > 3 ? atoi(argv[3]) : 20;
+    int every = argc > 4 ? atoi(argv[4]) : 5;
+    string path = argc > 5 ? argv[5] : "bench_save.ckpt";
+
+    UnetFixture fixture(size, base_channels);
+    auto &network = fixture.network;
+    auto &loss = fixture.loss;
+    AdamOptimizer<float> adam(0.001);
+    adam.register_network(network);
+
+    Checkpointer<float> checkpointer(network, &adam);
+    vector<float> expected; // parameters at the last checkpoint
+    double sync_time(0);
+    int n_sync(0);
+    for (int step(1); step <= n_steps; ++step) {
+        loss({fixture.y, fixture.sample});
+        network.zero_grad();
+        loss.backward();
+        adam.update();
+        if (step % every)
+            continue;
+
+        Timer timer;
+        network.save(path + ".sync");
+        sync_time += timer.since();
+        ++n_sync;
+        checkpointer.save(path, step);
+        expected = network.to_vector();
+    }
+    checkpointer.wait();
+
+    cout << "synchronous save: " << sync_time / max(n_sync, 1) << "s per checkpoint" << endl;
+    checkpointer.stats.describe(cout);
+
+    UnetModel restored(base_channels);
+    AdamOptimizer<float> restored_adam(0.001);
+    restored_adam.register_network(restored.network);
+    auto step = Checkpointer<float>::load(path, restored.network, &restored_adam);
+    auto param_diff = max_diff(restored.network.to_vector(), expected);
+    cout << "restored step " << step << ", max param diff: " << param_diff << endl;
+    check_diff("restored parameters", param_diff, 0);
+
+    remove(path.c_str());
+    remove((path + ".sync").c_str());
+    Handler::deinit();
+    return check_status();
+}
@@ -0,0 +1,80 @@
+#include "dexe/handler.h"
+#include "dexe/models.h"
+#include "dexe/network.h"
+#include "dexe/optimizer.h"
+#include "dexe/process_group.h"
+#include "dexe/util.h"
+
+#include <iostream>
+#include <unistd.h>
+
+using namespace std;
+using namespace dexe;
+
+// Multi-process data parallel unet training over shared memory, one process per NUMA node
+// (at least two). Reports the gradient all-reduce bandwidth and checks that all ranks end
+// with the same parameters.
+int main(int argc, char **argv) {
+    int world_size = argc > 1 ? atoi(argv[1]) : max(2, ProcessGroup::n_numa_nodes());
+    int size = argc > 2 ? atoi(argv[2]) : 16;
+    int n_steps = argc > 3 ? atoi(argv[3]) : 10;
+    string name = "dexe_bench_" + to_string(getpid());
+
+    // nothing may touch cuda before the fork
+    int failed = ProcessGroup::launch(world_size, [&](int rank) {
+        int n_devices(0);
+        handle_error(cudaGetDeviceCount(&n_devices));
+        handle_error(cudaSetDevice(rank % n_devices));
+
+        Network<float> network;
+        auto target = network.input_3D(1);
+        auto prediction = make_unet(&network, 1, 1);
+        auto loss = network.support_loss(0.5)(prediction, target);
+        network.init_uniform(0.05);
+
+        ProcessGroup group(name, rank, world_size, network.n_params * sizeof(float));
+        group.broadcast_parameters(network);
+
+        SGDOptimizer<float> optimizer(0.01);
+        optimizer.register_network(network);
+
+        // every rank trains on its own samples
+        Tensor<float> sample(TensorShape{1, 1, size, size, size});
+        Tensor<float> y(TensorShape{1, 1, size, size, size});
+
+        double reduce_time(0);
+        Timer timer;
+        for (int n(0); n < n_steps; ++n) {
+            sample.init_normal(0.0, 0.1);
+            y.init_normal(0.0, 0.1);
+            loss({y, sample});
+            network.zero_grad();
+            loss.backward();
+
+            Timer reduce;
+            group.all_reduce_gradients(network);
+            reduce_time += reduce.since();
+            optimizer.update();
+        }
+        Handler::sync();
+        double elapsed = timer.since();
+
+        auto params = network.to_vector();
+        auto reference = params;
+        group.broadcast(reference.data(), reference.size());
+        double max_diff(0);
+        for (size_t i(0); i < params.size(); ++i)
+            max_diff = max<double>(max_diff, abs(params[i] - reference[i]));
+
+        double bytes = network.n_params * sizeof(float);
+        cout << "rank " << rank << " steps/s: " << n_steps / elapsed
+             << " all-reduce GB/s: " << bytes * n_steps / reduce_time / 1e9
+             << " max param diff with rank 0: " << max_diff << endl;
+
+        Handler::deinit();
+        return max_diff == 0 ? 0 : 1;
+    });
+
+    cout << world_size << " ranks, " << failed << " failed" << endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,62 @@
+#include "dexe/handler.h"
+#include "dexe/models.h"
+#include "dexe/network.h"
+#include "dexe/util.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace dexe;
+
+// Compares whole-volume inference of a unet with tiled inference: time, device memory
+// and how far the blended output is from the whole-volume one
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 96;
+    int tile = argc > 2 ? atoi(argv[2]) : 48;
+    int overlap = argc > 3 ? atoi(argv[3]) : 16;
+
+    Network<float> network;
+    auto prediction = make_unet(&network, 1, 1);
+    network.init_uniform(0.05);
+
+    Tensor<float> volume(TensorShape{1, 1, size, size, size});
+    volume.init_normal(0.0, 0.1);
+
+    Handler::sync();
+    Timer timer;
+    prediction.infer({volume});
+    auto whole = prediction.x().to_vector();
+    auto whole_time = timer.since();
+    auto whole_bytes = network.resident_bytes();
+
+    network.clear_plans(); // drops the arena of the whole volume
+
+    TileOptions options;
+    options.tile = {tile, tile, tile};
+    options.overlap = {overlap, overlap, overlap};
+    Tensor<float> result;
+
+    Handler::sync();
+    timer.start();
+    auto report = prediction.infer_tiled(volume, result, options);
+    auto tiled = result.to_vector();
+    auto tiled_time = timer.since();
+
+    // tiles see zero padding instead of their neighbourhood, so the outputs differ near tile edges
+    double max_diff(0), mean_diff(0);
+    for (size_t i(0); i < whole.size(); ++i) {
+        double diff = abs(whole[i] - tiled[i]);
+        max_diff = max(max_diff, diff);
+        mean_diff += diff / whole.size();
+    }
+
+    // the whole volume run holds the input next to the network, the tiled one also the result
+    cout << "whole time: " << whole_time
+         << " resident bytes: " << whole_bytes + volume.size() * sizeof(float) << endl;
+    cout << "tiled time: " << tiled_time << " resident bytes: " << report.total_bytes() << endl;
+    report.describe(cout);
+    cout << endl;
+    cout << "output diff max: " << max_diff << " mean: " << mean_diff << endl;
+
+    Handler::deinit();
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "dexe/models.h"
+#include "dexe/network.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace dexe {
+
+// The unet with a support loss most benches train: the target is input 0, the sample input 1
+struct UnetModel {
+    Network<float> network;
+    Node<float> prediction, loss;
+
+    UnetModel(int base_channels = 2) {
+        auto target = network.input_3D(1);
+        prediction = make_unet(&network, 1, 1, false, base_channels);
+        loss = network.support_loss(0.5)(prediction, target);
+    }
+};
+
+// A UnetModel with initialised weights and one random sample and target
+struct UnetFixture : UnetModel {
+    Tensor<float> sample, y;
+
+    UnetFixture(int size, int base_channels = 2)
+        : UnetModel(base_channels), sample(TensorShape{1, 1, size, size, size}),
+          y(TensorShape{1, 1, size, size, size}) {
+        network.init_uniform(0.05);
+        sample.init_normal(0.0, 0.1);
+        y.init_normal(0.0, 0.1);
+    }
+};
+
+inline double max_diff(std::vector<float> const &a, std::vector<float> const &b) {
+    if (a.size() != b.size())
+        return std::numeric_limits<double>::infinity();
+    double diff(0);
+    for (size_t i(0); i < a.size(); ++i)
+        diff = std::max<double>(diff, std::abs(a[i] - b[i]));
+    return diff;
+}
+
+inline int &n_failed_checks() {
+    static int n(0);
+    return n;
+}
+
+// Reports a difference that exceeds its tolerance and counts it as a failure
+inline bool check_diff(std::string const &name, double diff, double tolerance) {
+    if (diff <= tolerance) // also fails on nan
+        return true;
+    std::cerr << "FAILED " << name << ": " << diff << " exceeds tolerance " << tolerance
+              << std::endl;
+    ++n_failed_checks();
+    return false;
+}
+
+// Exit code of a bench: non-zero if any check failed
+inline int check_status() { return n_failed_checks() ? 1 : 0; }
+
+} // namespace dexe
@@ -0,0 +1,57 @@
+#include "dexe/handler.h"
+#include "dexe/tensor.h"
+#include "dexe/util.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace dexe;
+
+// Cuts patches out of a volume and samples out of a batch, through views compared with
+// the copy the same data needs without them
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 192;
+    int patch = argc > 2 ? atoi(argv[2]) : 64;
+    int n_runs = argc > 3 ? atoi(argv[3]) : 100;
+
+    Tensor<float> volume(TensorShape{1, 4, size, size, size});
+    volume.init_normal(0.0, 1.0);
+    Tensor<float> window(TensorShape{1, 4, patch, patch, patch});
+
+    // patch out of a volume: one strided copy instead of a crop kernel plus a copy
+    Handler::sync();
+    Timer timer;
+    for (int r(0); r < n_runs; ++r) {
+        int origin = (r * 7) % (size - patch);
+        window.from_tensor(volume.view().crop({origin, origin, origin}, {patch, patch, patch}));
+    }
+    Handler::sync();
+    cout << "crop " << patch << "^3 out of " << size << "^3: " << timer.since() / n_runs * 1e3
+         << " ms" << endl;
+
+    // sample out of a batch: contiguous, so it binds instead of copying
+    Tensor<float> batch(TensorShape{8, 4, patch, patch, patch});
+    batch.init_normal(0.0, 1.0);
+    Handler::sync();
+    timer.start();
+    float total(0);
+    for (int r(0); r < n_runs; ++r)
+        total += batch.view().sample(r % 8).contiguous()->asum();
+    Handler::sync();
+    cout << "sample view: " << timer.since() / n_runs * 1e3 << " ms" << endl;
+
+    timer.start();
+    Tensor<float> sample(TensorShape{1, 4, patch, patch, patch});
+    for (int r(0); r < n_runs; ++r) {
+        sample.from_tensor(batch.view().sample(r % 8));
+        total -= sample.asum();
+    }
+    Handler::sync();
+    cout << "sample copy: " << timer.since() / n_runs * 1e3 << " ms (difference " << total << ")"
+         << endl;
+
+    // channel selection, materialised because the channels aren't contiguous per sample
+    auto channels = batch.view().channels(1, 3);
+    cout << "channels 1-2 contiguous: " << channels.is_contiguous()
+         << ", first sample: " << batch.view().sample(0).channels(1, 3).is_contiguous() << endl;
+}
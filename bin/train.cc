@@ -1,35 +1,60 @@
+#include "dexe/handler.h"
+#include "dexe/models.h"
 #include "dexe/network.h"
+#include "dexe/optimizer.h"
+#include "dexe/trainer.h"
+#include "dexe/util.h"
 
-#include "dexe/tensor.h"
-#include <vector>
-#include <thread>
+#include <iostream>
+#include <random>
 
 using namespace std;
 using namespace dexe;
 
-typedef function<void(vector<unique_ptr<Tensor<float>>>*)> GrabSamplesFunc;
-
-struct Trainer {
-    Trainer(GrabSamplesFunc func) : grab_samples_func(func) {}
-
-
-    void start() {
-        grab_samples_func(&samples);
-
-        while (true) {
-            thread t(grab_samples_func, &next_samples);
-            
-        }
-    }
-
-    vector<unique_ptr<Tensor<float>>> samples;
-    vector<unique_ptr<Tensor<float>>> next_samples;
-
-    GrabSamplesFunc grab_samples_func;
-};
-
+// Trains a unet to segment the positive voxels of smooth noise, with batches prepared by
+// worker threads while the network trains. Reports the loss and whether training is input bound.
 int main(int argc, char **argv) {
-    Network<float> network;
+    int size = argc > 1 ? atoi(argv[1]) : 32;
+    int n_steps = argc > 2 ? atoi(argv[2]) : 200;
+    int n_workers = argc > 3 ? atoi(argv[3]) : 2;
+    int n_buffers = argc > 4 ? atoi(argv[4]) : 3;
 
-    
+    Network<float> network;
+    auto target = network.input_3D(1);
+    auto prediction = make_unet(&network, 1, 1); // adds the second input
+    auto loss = network.support_loss(0.5)(prediction, target);
+    network.init_uniform(0.05);
+    AdamOptimizer<float> optimizer(0.001);
+    optimizer.register_network(network);
+
+    TensorShape shape{1, 1, size, size, size};
+    auto fill = [&](vector<unique_ptr<Tensor<float>>> &batch, int worker) {
+        thread_local mt19937 engine(worker + 1);
+        normal_distribution<float> normal;
+        int n = shape.n_elements();
+        vector<float> noise(n), smooth(n), label(n);
+        for (auto &v : noise)
+            v = normal(engine);
+        // box filter along x, then threshold
+        for (int i(0); i < n; ++i) {
+            int x = i % size;
+            float sum(0);
+            for (int dx(-2); dx <= 2; ++dx)
+                sum += noise[i - x + (x + dx + size) % size];
+            smooth[i] = sum / 5;
+            label[i] = smooth[i] > 0 ? 1 : 0;
+        }
+        batch[0]->reshape(shape);
+        batch[1]->reshape(shape);
+        batch[0]->from_vector(label);
+        batch[1]->from_vector(smooth);
+    };
+
+    Trainer<float> trainer(network, optimizer, loss.index, fill, n_workers, n_buffers);
+    for (int done(0); done < n_steps; done += 20)
+        cout << "step " << done << " loss: " << trainer.train(min(20, n_steps - done)) << endl;
+    trainer.stop();
+    trainer.stats.describe(cout);
+
+    Handler::deinit();
 }
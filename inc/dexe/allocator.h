@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "config.h"
+
+namespace dexe {
+
+enum class AllocatorBackend { DEVICE, HOST };
+
+// Counters of a CachingAllocator. Held bytes are in use plus cached, all taken from the system
+struct DEXE_API AllocatorStats {
+    size_t hits = 0;        // served from the thread's own free list
+    size_t shared_hits = 0; // served from the shared free list
+    size_t misses = 0;      // had to allocate from the system
+    size_t releases = 0, trimmed = 0; // trimmed: blocks returned to the system
+    size_t bytes_in_use = 0, bytes_cached = 0, peak_bytes_held = 0;
+
+    void describe(std::ostream &out);
+};
+
+// Keeps freed blocks for reuse instead of returning them to the system, so reshaping tensors
+// and varying patch sizes don't pay a cudaMalloc/cudaFree each time.
+// Requests are rounded up to size classes of four per power of two (at most 25% waste).
+// Every thread has its own free lists; a block is reused by the thread that freed it, so its
+// stream orders the reuse after earlier work. Frees beyond thread_budget, and the lists of
+// threads that exit, go to a shared list. Blocks taken from there are handed out after a
+// device synchronise, as cudaFree would do.
+// The MemoryTracker sees blocks in use at their size class and cached blocks as owned by
+// "allocator cache".
+// Once more than budget bytes are cached, the shared list and then the thread lists are
+// trimmed. A budget of 0 turns caching off.
+// The HOST backend uses malloc, so the allocator can be exercised without a GPU.
+struct DEXE_API CachingAllocator {
+    CachingAllocator(AllocatorBackend backend = AllocatorBackend::DEVICE,
+                     size_t budget = size_t(1) << 30, size_t thread_budget = size_t(256) << 20);
+    ~CachingAllocator(); // returns the cached blocks, blocks in use must be released before
+
+    void *allocate(size_t bytes);
+    void release(void *ptr, size_t bytes); // bytes as passed to allocate
+
+    void trim(size_t target = 0); // returns cached blocks until at most target bytes are cached
+    void set_budget(size_t budget, size_t thread_budget);
+
+    AllocatorStats stats();
+    void reset_stats();
+
+    static size_t size_class(size_t bytes);
+
+    // Allocator of all CudaVecs, never destroyed so vectors can outlive static destruction
+    static CachingAllocator &device();
+
+    AllocatorBackend backend = AllocatorBackend::DEVICE;
+
+    CachingAllocator(const CachingAllocator &) = delete;
+    CachingAllocator &operator=(const CachingAllocator &) = delete;
+
+    struct ThreadCaches; // of the calling thread, in allocator.cc
+
+  private:
+    using FreeLists = std::map<size_t, std::vector<void *>>; // size class to blocks
+
+    struct ThreadCache {
+        std::mutex mutex; // only contended by trim
+        FreeLists blocks;
+        size_t bytes = 0;
+    };
+
+    ThreadCache &local();
+    void abandon(ThreadCache *cache);
+    void track_cached(void *ptr, size_t size);
+    void untrack_cached(void *ptr);
+    void *system_allocate(size_t bytes);
+    void system_release(void *ptr, size_t bytes);
+    size_t take_largest(FreeLists &lists, size_t &bytes, size_t target);
+
+    uint64_t id = 0; // tells the thread local caches of different allocators apart
+    std::atomic<size_t> budget, thread_budget;
+
+    std::mutex mutex; // guards shared, shared_bytes and caches
+    FreeLists shared;
+    size_t shared_bytes = 0;
+    std::vector<std::unique_ptr<ThreadCache>> caches;
+
+    std::atomic<size_t> n_hits{0}, n_shared_hits{0}, n_misses{0}, n_releases{0}, n_trimmed{0};
+    std::atomic<size_t> in_use{0}, cached{0}, held{0}, peak_held{0};
+};
+
+} // namespace dexe
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "network.h"
+
+namespace dexe {
+
+template <typename F>
+struct InferenceResult {
+    TensorShape shape;
+    std::vector<F> data;
+};
+
+// Queues independent inference requests and evaluates compatible ones as one batch.
+// Requests with the same input shapes (apart from N) share a bucket; a bucket runs once
+// it holds max_batch samples or its oldest request waited max_delay seconds.
+// Batches are padded to a power of two so every bucket compiles only a few plans.
+// The batcher owns the network while it runs, don't evaluate it from other threads.
+template <typename F>
+struct DEXE_API Batcher {
+    Batcher(Network<F> *network, int output, int max_batch = 8, double max_delay = 0.005);
+    ~Batcher();
+
+    // One host buffer and shape per network input, in the order of network->inputs
+    std::future<InferenceResult<F>> submit(std::vector<std::vector<F>> inputs,
+                                           std::vector<TensorShape> shapes);
+    std::future<InferenceResult<F>> submit(std::vector<F> input, TensorShape shape);
+
+    std::atomic<size_t> n_batches{0}, n_requests{0}, n_padded{0}; // padded: zero samples added
+
+    Batcher(const Batcher &) = delete;
+    Batcher &operator=(const Batcher &) = delete;
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Request {
+        std::vector<std::vector<F>> inputs;
+        std::vector<TensorShape> shapes;
+        int n = 0; // samples in this request
+        Clock::time_point arrival;
+        std::promise<InferenceResult<F>> result;
+    };
+    using Bucket = std::vector<std::unique_ptr<Request>>;
+
+    void work();
+    void run(Bucket &batch);
+
+    Network<F> *network = nullptr;
+    int output = -1;
+    int max_batch = 8;
+    Clock::duration max_delay;
+
+    std::map<std::vector<std::vector<int>>, Bucket> buckets; // keyed on the input dimensions without N
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stop = false;
+    std::thread worker;
+};
+
+} // namespace dexe
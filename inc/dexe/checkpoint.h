@@ -0,0 +1,70 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "network.h"
+#include "optimizer.h"
+
+namespace dexe {
+
+// Times in seconds. The snapshot is what training waits for, the write runs in the background
+struct DEXE_API CheckpointStats {
+    size_t n_checkpoints = 0, bytes = 0;
+    double snapshot_time = 0, write_time = 0, wait_time = 0; // wait: save blocked on the previous write
+    double last_snapshot_time = 0, last_write_time = 0;
+
+    void describe(std::ostream &out);
+};
+
+// Checkpoints the parameters and the optimizer state without stalling training for the write.
+// save copies param_vec and the optimizer state() buffers into a pinned staging buffer,
+// which is reused between checkpoints, and returns; a background thread serialises the copy
+// to path.tmp, fsyncs it and renames it to path, so path always holds a complete checkpoint.
+// Only the parameter values are stored: load them into a network with the same graph.
+template <typename F>
+struct DEXE_API Checkpointer {
+    Checkpointer(Network<F> &network, Optimizer<F> *optimizer = nullptr);
+    ~Checkpointer(); // finishes the pending write
+
+    // Waits for the previous write first, it owns the staging buffer
+    void save(std::string path, uint64_t step = 0);
+    void wait(); // until the pending write is on disk, rethrows its error
+
+    // Returns the step the checkpoint was saved at
+    static uint64_t load(std::string path, Network<F> &network, Optimizer<F> *optimizer = nullptr);
+
+    Network<F> &network;
+    Optimizer<F> *optimizer = nullptr;
+    CheckpointStats stats;
+
+    Checkpointer(const Checkpointer &) = delete;
+    Checkpointer &operator=(const Checkpointer &) = delete;
+
+  private:
+    void work();
+    void write();
+    void wait(std::unique_lock<std::mutex> &lock);
+
+    F *staging = nullptr; // pinned host memory
+    size_t staging_size = 0;
+    std::vector<size_t> sizes; // of param_vec and every state buffer, in staging order
+
+    std::string path;
+    uint64_t step = 0;
+    bool pending = false, stop = false;
+    std::exception_ptr error;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread writer;
+};
+
+} // namespace dexe
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "allocator.h"
+#include "memory.h"
 #include "util.h"
 #include <cuda.h>
 #include <vector>
@@ -23,7 +25,8 @@ template <typename F> struct CudaVec {
     ~CudaVec() {
         if (own && N) {
             memory_counter -= N;
-            handle_error(cudaFree(data));
+            MemoryTracker::released(data);
+            CachingAllocator::device().release(data, sizeof(F) * N);
         }
     }
 
@@ -52,7 +55,7 @@ template <typename F> struct CudaVec {
 
     void zero(int offset = 0) {
         if (N)
-            handle_error(cudaMemset(data + offset, 0, sizeof(F) * (N - offset)));
+            handle_error(cudaMemsetAsync(data + offset, 0, sizeof(F) * (N - offset), Handler::stream()));
     }
 
     void init_normal(F mean, F std) { dexe::init_normal<F>(data, N, mean, std); }
@@ -63,30 +66,32 @@ template <typename F> struct CudaVec {
         if (N != other.N) {
             throw DexeException("can't share with CudaVec of different size");
         }
-        if (own)
-            cudaFree(data);
+        if (own) {
+            MemoryTracker::released(data);
+            CachingAllocator::device().release(data, sizeof(F) * N);
+        }
         own = false;
         data = other.data;
     }
 
     std::vector<F> to_vector() {
         std::vector<F> vec(N);
-        handle_error(cudaMemcpy(&vec[0], data, N * sizeof(F), cudaMemcpyDeviceToHost));
+        copy_gpu_to_cpu(data, &vec[0], N);
         return vec;
     }
 
     void to_ptr(F *target) {
-        handle_error(cudaMemcpy(target, data, N * sizeof(F), cudaMemcpyDeviceToHost));
+        copy_gpu_to_cpu(data, target, N);
     }
 
     void from_ptr(F const *source) {
-        handle_error(cudaMemcpy(data, source, N * sizeof(F), cudaMemcpyHostToDevice));
+        copy_cpu_to_gpu(source, data, N);
     }
 
     void from_vector(std::vector<F> const &vec) {
         if (vec.size() != N)
             allocate(vec.size());
-        handle_error(cudaMemcpy(data, &vec[0], N * sizeof(F), cudaMemcpyHostToDevice));
+        copy_cpu_to_gpu(&vec[0], data, N);
     }
 
     F sum() {
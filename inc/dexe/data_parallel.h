@@ -0,0 +1,50 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "config.h"
+#include "network.h"
+#include "optimizer.h"
+#include "threadpool.h"
+
+namespace dexe {
+
+// Data parallel training with one replica of the network per thread.
+// Replicas share the parameters of the network but have their own activations and gradients.
+// A step runs forward/backward of every replica on its own micro-batch, then every thread
+// sums its shard of the gradients of all replicas into the network's grad_vec (reduce-scatter)
+// and applies the optimizer to the same shard of param_vec. The parameters are shared,
+// so the all-gather is free.
+// Gradients are averaged, so with the mean losses of dexe a step matches a single network
+// step on the concatenated batch.
+template <typename F>
+struct DEXE_API DataParallel {
+    // optimizer has to be registered with network and support partial updates
+    DataParallel(Network<F> &network, Optimizer<F> &optimizer, int loss, int n_replicas);
+    ~DataParallel();
+
+    // batches[r] holds the inputs of replica r, one tensor per network input in the order of network.inputs.
+    // Returns the loss averaged over the replicas
+    F step(std::vector<std::vector<Tensor<F> *>> const &batches);
+
+    int size() { return replicas.size(); }
+
+    DataParallel(const DataParallel &) = delete;
+    DataParallel &operator=(const DataParallel &) = delete;
+
+    Network<F> &network;
+    Optimizer<F> &optimizer;
+    int loss = -1;
+
+    std::vector<Network<F> *> replicas; // replicas[0] is the network itself
+    std::vector<std::pair<int, int>> shards; // parameter range reduced and updated by each thread
+
+  private:
+    void run(std::function<void(int)> task);
+
+    std::vector<std::unique_ptr<Network<F>>> copies;
+    std::unique_ptr<ThreadPool> pool;
+};
+
+} // namespace dexe
@@ -3,6 +3,9 @@
 #include <cudnn.h>
 #include <curand.h>
 #include <cublas_v2.h>
+#include <cuda_runtime.h>
+
+#include <atomic>
 
 #include "config.h"
 
@@ -10,6 +13,8 @@ size_t const WORKSPACE_SIZE = size_t(128) * 1024 * 1024;
 
 namespace dexe {
 
+// Handles, workspace and stream of the calling thread. Every thread gets its own handler,
+// so operations can run concurrently from a ThreadPool.
 struct DEXE_API Handler {
   Handler();
   ~Handler();
@@ -18,8 +23,9 @@ struct DEXE_API Handler {
   static cudnnHandle_t &cudnn();
   static curandGenerator_t &curand();
   static cublasHandle_t &cublas();
-  static char *workspace();
-  static size_t workspace_size();
+  static cudaStream_t stream();
+  static char *workspace(size_t size); // at least size bytes, kept for later calls
+  static size_t workspace_size(); // limit for the workspace of one algorithm
   static void set_workspace_size(size_t workspace_size);
   static void clear_workspace();
 
@@ -35,15 +41,19 @@ struct DEXE_API Handler {
   static void print_mem_info();
 
   static void sync();
+  static void sync_stream(); // waits for the work of the calling thread only
 
   cudnnHandle_t h_cudnn;
   curandGenerator_t h_curand;
   cublasHandle_t h_cublas;
+  cudaStream_t h_stream = 0;
      
   char *s_workspace = nullptr;
-  size_t workspace_size_ = WORKSPACE_SIZE;
+  size_t workspace_size_ = 0; // size of s_workspace, at most s_workspace_size
+  static std::atomic<size_t> s_workspace_size;
+  static std::atomic<unsigned long long> s_n_handlers; // handlers created, offsets the seed
     
-  static Handler *s_handler;
+  static thread_local Handler *s_handler;
 
   //pointers to cuda memory containing 1 (needed for some blas functions)
   float *one_float_ = 0;
@@ -77,4 +77,32 @@ __global__ void threshold_kernel(F *input, size_t N, F threshold);
 template <typename F>
 void threshold_cuda(F *input, size_t N, F threshold);
 
+template <typename F>
+__global__ void add_relu_kernel(F const *in, F *out, size_t N);
+
+// out = max(out + in, 0)
+template <typename F>
+void add_relu_cuda(F const *in, F *out, size_t N);
+
+template <typename F>
+__global__ void relu_mask_kernel(F const *act, F *grad, size_t N);
+
+// Zeroes the gradient wherever the relu output act is not positive
+template <typename F>
+void relu_mask_cuda(F const *act, F *grad, size_t N);
+
+// A window of size[] voxels at origin[] inside a volume of c channels and dims[] voxels.
+// The weights of the window along dimension n start at weights[rows[n]].
+struct Window3D {
+	int c;
+	int dims[3], size[3], origin[3], rows[3];
+};
+
+template <typename F>
+__global__ void blend_window_kernel(F const *window, F const *weights, F *volume, Window3D w);
+
+// Adds the window into the volume, weighted by the product of its per dimension weights
+template <typename F>
+void blend_window_cuda(F const *window, F const *weights, F *volume, Window3D w);
+
 }
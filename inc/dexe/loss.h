@@ -13,6 +13,8 @@ struct Loss {
   virtual void calculate_loss(Tensor<F> &in, std::vector<int> answers, Tensor<F> &err){};
 	virtual void calculate_loss(Tensor<F> &in, int answer, Tensor<F> &err);
 	virtual void calculate_loss(Tensor<F> &in, Tensor<F> &target, Tensor<F> &err) = 0;
+	// target can be a strided view, e.g. a crop of a label volume; made contiguous if needed
+	virtual void calculate_loss(Tensor<F> &in, TensorView<F> const &target, Tensor<F> &err);
 	virtual void calculate_average_loss(Tensor<F> &in, Tensor<F> &err) { throw DexeException("not implemented"); }
 
 	virtual F loss();
@@ -31,6 +33,7 @@ struct SoftmaxLoss : public Loss<F> {
 	void calculate_loss(Tensor<F> &in, std::vector<int> answers, Tensor<F> &err);
     void calculate_average_loss(Tensor<F> &in, Tensor<F> &err);
 	void calculate_loss(Tensor<F> &in, Tensor<F> &target, Tensor<F> &err);
+	void calculate_loss(Tensor<F> &in, TensorView<F> const &target, Tensor<F> &err);
 };
 
 template <typename F>
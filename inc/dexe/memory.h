@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "config.h"
+
+namespace dexe {
+
+struct MemoryUsage {
+    std::string name;
+    size_t current = 0, peak = 0; // bytes
+    size_t allocations = 0;
+};
+
+struct MemoryEvent {
+    double time = 0; // microseconds, on the clock of the profiler
+    std::string owner;
+    char const *phase = "";
+    long long delta = 0; // bytes, negative for a release
+    size_t total = 0;    // tracked bytes after this event
+};
+
+// Device allocations by owner and phase, off by default.
+// CudaVec, the handler workspaces and device arenas report here. Owner and phase come from the
+// innermost MemoryTag or ProfileScope of the allocating thread, allocations outside of those
+// belong to "user" in phase "other". Memory allocated before enable isn't known.
+// Per owner peak is the owner's own high-water mark, per phase it's the high-water mark of
+// all tracked memory while in that phase.
+struct DEXE_API MemoryTracker {
+    static void enable();
+    static void disable();
+    static bool enabled();
+    static void reset();
+
+    static void allocated(void const *ptr, size_t bytes);
+    static void released(void const *ptr);
+
+    // Owner and phase of the calling thread, the setters return the previous value
+    static std::string set_owner(std::string owner);
+    static char const *set_phase(char const *phase);
+
+    static size_t current();
+    static size_t peak();
+    static std::vector<MemoryUsage> owners(); // sorted on peak
+    static std::vector<MemoryUsage> phases();
+    static std::vector<MemoryEvent> timeline();
+
+    static void summary(std::ostream &out);
+    static void write_timeline(std::string path); // csv, one line per event
+};
+
+// Sets the owner (and phase, unless nullptr) of allocations of this thread while it lives.
+// name() is only called while the tracker is enabled.
+struct MemoryTag {
+    MemoryTag() {}
+    explicit MemoryTag(std::string owner) {
+        if (MemoryTracker::enabled())
+            tag(nullptr, std::move(owner));
+    }
+    template <typename Name> MemoryTag(char const *phase, Name const &name) {
+        if (MemoryTracker::enabled())
+            tag(phase, name());
+    }
+
+    ~MemoryTag() {
+        if (!active)
+            return;
+        MemoryTracker::set_owner(std::move(previous_owner));
+        if (previous_phase)
+            MemoryTracker::set_phase(previous_phase);
+    }
+
+    void tag(char const *phase, std::string owner) {
+        active = true;
+        previous_owner = MemoryTracker::set_owner(std::move(owner));
+        if (phase)
+            previous_phase = MemoryTracker::set_phase(phase);
+    }
+
+    MemoryTag(const MemoryTag &) = delete;
+    MemoryTag &operator=(const MemoryTag &) = delete;
+
+    bool active = false;
+    std::string previous_owner;
+    char const *previous_phase = nullptr;
+};
+
+} // namespace dexe
@@ -8,5 +8,5 @@ namespace dexe {
         std::function<Node<F>(Node<F>)> basic_layer(int c, int c_out, int k);
     
     template <typename F>
-        Node<F> make_unet(Network<F> *network, int in_channels, int out_channels, bool local_normalization = false);
+        Node<F> make_unet(Network<F> *network, int in_channels, int out_channels, bool local_normalization = false, int base_channels = 2); // channels double at every level
 }
@@ -1,15 +1,20 @@
 #pragma once
 
+#include <atomic>
 #include <iostream>
 #include <vector>
 #include <set>
 #include <functional>
 #include <initializer_list>
+#include <memory>
+#include <tuple>
 
 #include "dexe/config.h"
 #include "dexe/util.h"
 #include "dexe/tensor.h"
 #include "dexe/cudavec.h"
+#include "dexe/planner.h"
+#include "dexe/threadpool.h"
 
 namespace dexe {
 
@@ -22,6 +27,29 @@ struct Parametrised;
 template <typename F>
 struct Network;
 
+enum class TileBlending { UNIFORM, GAUSSIAN };
+
+// How Network::infer_tiled cuts up a volume, sizes are depth, height, width in voxels
+struct TileOptions {
+	std::vector<int> tile{64, 64, 64}; // rounded down to a multiple of the downscale factors
+	std::vector<int> overlap{16, 16, 16};
+	TileBlending blending = TileBlending::GAUSSIAN;
+	double sigma = 0.125; // standard deviation of the gaussian weights, relative to the tile size
+};
+
+// Device memory Network::infer_tiled used. Only the input volume and the result scale with
+// the volume, the rest with the tile.
+struct DEXE_API TileReport {
+	int n_tiles = 0;
+	size_t network_bytes = 0; // resident bytes of the network on the last tile, arena included
+	size_t staging_bytes = 0; // the next tile, cut out while the network runs
+	size_t weight_bytes = 0;  // blending weights, a row per tile start and dimension
+	size_t input_bytes = 0, result_bytes = 0;
+
+	size_t total_bytes() { return network_bytes + staging_bytes + weight_bytes + input_bytes + result_bytes; }
+	void describe(std::ostream &out);
+};
+
 template <typename F>
 struct DEXE_API Node {
 	Node(int index_ = -1, Network<F> *network_ = nullptr) : index(index_), network(network_) {}
@@ -30,10 +58,16 @@ struct DEXE_API Node {
 	TensorSet<F> &tensor_set();
 
 	void operator()(std::initializer_list<std::reference_wrapper<Tensor<F>>> inputs); //call to evaluation
+	void infer(std::initializer_list<std::reference_wrapper<Tensor<F>>> inputs); //evaluation without gradients or backward
+	void load_inputs(std::initializer_list<std::reference_wrapper<Tensor<F>>> inputs);
+	TileReport infer_tiled(Tensor<F> &volume, Tensor<F> &result, TileOptions const &options = TileOptions());
 	void backward() { network->backward(); }
 
 	bool valid() { return index != -1; }
 
+	void checkpoint(); // keep this activation when the network runs with checkpointing
+	void touch(); // marks x as changed, after writing it directly
+
 	void set_x(Tensor<F> &x);
 	Tensor<F> &x();
     Tensor<F> &grad();
@@ -44,6 +78,77 @@ struct DEXE_API Node {
     std::string set_name(std::string name) { return network->names[index] = name; }
 };
 
+// Pre-resolved arguments for running a single node
+template <typename F>
+struct ExecutionStep {
+	int index = -1;
+	bool is_input = false;
+	int last_consumer = -1; // position in the plan of the last step reading our output
+	bool keep = false;      // activation survives a checkpointed forward
+	bool parametrised = false;
+	std::vector<int> input_steps; // positions in the plan of the steps producing our inputs
+	std::vector<Tensor<F>*> inputs, outputs, input_grads, output_grads;
+	std::vector<Tensor<F>*> zero_grads; // planned gradients that are first written by this backward step
+};
+
+// Compiled forward/backward pass, computed once per (inputs, outputs, input shapes)
+// and cached on the network, so repeated calls don't traverse the graph or allocate
+template <typename F>
+struct ExecutionPlan {
+	bool matches(std::vector<int> const &inputs_, int const *outputs_, size_t n_outputs, bool inference_, std::vector<TensorSet<F>> &tensors);
+
+	std::vector<int> inputs, outputs;
+	std::vector<TensorShape> input_shapes;
+	bool inference = false; // plan of Network::infer, activations are recycled and no gradients exist
+
+	std::vector<int> sequence;
+	std::vector<ExecutionStep<F>> steps;
+	std::vector<TensorShape> shapes; // output shape of every step, from Network::infer_shapes
+
+	// Dependency counts for the parallel executor, and one lock per step gradient
+	// so consumers that accumulate into the same gradient take turns
+	std::vector<int> n_inputs, n_consumers;
+	std::vector<std::vector<int>> consumer_steps, input_steps;
+	std::unique_ptr<std::mutex[]> grad_locks;
+
+	// Set by Network::plan_memory, tensors become views into a single arena
+	MemoryPlan memory;
+	std::unique_ptr<Arena> arena;
+	std::vector<Tensor<F>*> arena_tensors;
+	std::vector<TensorShape> arena_shapes;
+	bool forward_only = false; // memory was planned without gradients, backward would read recycled activations
+};
+
+// Outcome of Network::optimize
+struct DEXE_API OptimizeReport {
+	int nodes_before = 0, nodes_after = 0;
+	double flops_before = 0, flops_after = 0;    // forward pass from the inputs to the outputs
+	size_t bytes_before = 0, bytes_after = 0;    // activations of that pass plus all parameters
+	std::vector<int> remap; // new index of every old node, -1 if it was removed
+
+	void describe(std::ostream &out);
+};
+
+// Analytic work and measured time of one node, times are seconds per pass
+struct DEXE_API NodeCost {
+	int index = -1;
+	std::string name;
+	double forward_flops = 0, backward_flops = 0;
+	double forward_bytes = 0, backward_bytes = 0;
+	double forward_time = 0, backward_time = 0;
+};
+
+// Outcome of Network::cost_report. A pass is compute bound when its arithmetic intensity
+// (flops per byte) reaches the ridge point of the device, peak_gflops / peak_gbs
+struct DEXE_API CostReport {
+	std::vector<NodeCost> nodes;
+	double peak_gflops = 0, peak_gbs = 0;
+	int n_runs = 0;
+
+	bool compute_bound(double flops, double bytes) { return flops >= bytes * peak_gflops / peak_gbs; }
+	void describe(std::ostream &out);
+};
+
 template <typename F>
 struct DEXE_API Network {
 	Network();
@@ -80,11 +185,57 @@ struct DEXE_API Network {
 
 	std::vector<int> find_sequence(std::vector<int> inputs, std::vector<int> outputs);
 
-	void forward(std::vector<int> inputs, std::vector<int> outputs);
+	ExecutionPlan<F> &compile(std::vector<int> const &inputs, std::vector<int> const &outputs);
+	ExecutionPlan<F> &compile(std::vector<int> const &inputs, int const *outputs, size_t n_outputs, bool inference = false);
+	void clear_plans();
+	void evict_plan();
+	void infer_shapes(ExecutionPlan<F> &plan);
+
+	void forward(std::vector<int> const &inputs, std::vector<int> const &outputs);
+	void forward(std::vector<int> const &inputs, int output);
+	void forward(ExecutionPlan<F> &plan);
+	void prepare_backward(ExecutionPlan<F> &plan);
 	void backward();
 
+	void set_threads(int n_threads); // 0 runs the plans serially on the calling thread
+	void parallel_forward(ExecutionPlan<F> &plan);
+	void parallel_backward(ExecutionPlan<F> &plan);
+
+	void mark_checkpoints(ExecutionPlan<F> &plan);
+	void recompute(ExecutionPlan<F> &plan, int p);
+	void checkpointed_backward(ExecutionPlan<F> &plan);
+
+	void infer(std::vector<int> const &inputs, std::vector<int> const &outputs);
+	void infer(std::vector<int> const &inputs, int output);
+
+	void set_incremental(bool on);
+	void load_input(int index, Tensor<F> &source);
+	// Copies a view, e.g. a patch cropped out of a volume, straight into the input
+	void load_input(int index, TensorView<F> const &source);
+	void touch(int index);
+	void touch_parameters();
+	void invalidate();
+	bool up_to_date(ExecutionStep<F> &step);
+	void mark_evaluated(ExecutionStep<F> &step);
+
+	// Evaluates output on a volume of any size, tile by tile, so memory depends on the tile size only.
+	// Overlapping tiles are blended, the next tile is extracted while the current one runs.
+	// Needs a single input and an output at input resolution, result is reshaped if needed.
+	TileReport infer_tiled(Tensor<F> &volume, Tensor<F> &result, int output, TileOptions const &options = TileOptions());
+	std::vector<int> downscale_factors(); // product of convolution strides per spatial dimension
+	size_t resident_bytes();
+
+	MemoryPlan &plan_memory(bool training = true);
+	void bind_arena(ExecutionPlan<F> &plan);
+	void unbind_arena();
+
 	void zero_x();
+	// backward overwrites the gradients of the parameters. To accumulate several micro-batches,
+	// set_accumulate_grads(true), zero_grad before the first and zero_activation_grads before
+	// every other backward, then scale the sum with Optimizer::grad_scale
 	void zero_grad();
+	void zero_activation_grads();
+	void set_accumulate_grads(bool accumulate);
 
 	void finish();
 	void assert_finished();
@@ -95,12 +246,55 @@ struct DEXE_API Network {
     void init_uniform(F var);
 
 	void save(std::string path);
+	void save(std::ostream &out);
+	void save_graph(std::ostream &out); // without parameter values
+	void write(std::ostream &out, bool with_params);
 	void load(std::string path);
+	void load(std::istream &in);
+	void load_graph(std::istream &in);
+
+	std::vector<std::unique_ptr<Network<F>>> replicate(int n, bool own_grads = false);
+	void attach_params(Network<F> &other, bool own_grads);
+	void share_params(Network<F> &other);
+	void share_grads(Network<F> &other); // parameter gradients accumulate into those of other, turns on set_accumulate_grads
 
 	void describe(std::ostream &out);
+	std::string label(int index); // node name and operation, as shown by the profiler
 
 	void register_params();
 	void align_params();
+	void unalign_params();
+
+	// Rewrites the graph once for evaluating the outputs: folds linear chains, merges additions,
+	// drops identities, fuses activations and removes every node that doesn't contribute to the outputs.
+	// Node indices change, use the remap of the report. Parameters are re-aligned,
+	// so optimizers have to be registered again.
+	OptimizeReport optimize(std::vector<int> outputs);
+	// Only fuses relus into the convolution or addition before them, so this also applies to
+	// training. The parameter values stay the same, but they are re-aligned, so optimizers have
+	// to be registered again.
+	OptimizeReport fuse(std::vector<int> outputs);
+	OptimizeReport rewrite(std::vector<int> outputs, bool simplify, bool fuse);
+	bool fuse_activation(int index, std::vector<std::vector<int>> &consumers, std::set<int> &keep);
+	bool fold_convolution(int index, std::vector<std::vector<int>> &consumers, std::set<int> &keep);
+	bool merge_addition(int index, std::vector<std::vector<int>> &consumers, std::set<int> &keep);
+	bool drop_identity(int index, std::vector<std::vector<int>> &consumers, std::set<int> &keep);
+	std::vector<int> remove_dead_nodes(std::vector<int> const &outputs);
+
+	// Runs the graph in format (CUDNN_TENSOR_NHWC: channels last, NDHWC for volumes) where the
+	// operations allow it. Inputs and operations that need NCHW stay NCHW, and a layout transform
+	// is inserted wherever a node is read in the other layout, at most one per node.
+	// Outputs get an NCHW copy, the remap of an output points to it. Transforms of an earlier
+	// conversion are dropped first, so converting back to NCHW restores the original graph.
+	OptimizeReport convert_layout(std::vector<int> outputs, cudnnTensorFormat_t format);
+	void apply_layouts(); // gives every tensor the format of its node, called by compile
+	void graph_cost(std::vector<int> const &outputs, double &flops, size_t &bytes);
+
+	// Runs forward (and backward) n_runs times on the loaded inputs and combines the measured time
+	// of every node with its analytic cost. Peaks of 0 are estimated from the device properties.
+	// Overwrites the gradients when backward is on.
+	CostReport cost_report(std::vector<int> outputs, int n_runs = 5, bool backward = true,
+	                       double peak_gflops = 0, double peak_gbs = 0);
 
 	std::vector<F> to_vector();
 	void from_vector(std::vector<F> &vec);
@@ -121,6 +315,38 @@ struct DEXE_API Network {
 
 	std::vector<int> sequence;
 
+	std::vector<std::unique_ptr<ExecutionPlan<F>>> plans;
+	ExecutionPlan<F> *active_plan = nullptr;   // plan of the last forward call
+	ExecutionPlan<F> *forward_ready = nullptr;  // plan whose forward dry run is reflected in the tensors
+	ExecutionPlan<F> *backward_ready = nullptr; // plan whose backward dry run is reflected in the tensors
+	ExecutionPlan<F> *arena_plan = nullptr;     // plan whose arena the tensors are bound to
+	bool cache_plans = true;
+	size_t max_plans = 8; // least recently used plans beyond this are dropped, with their arenas
+	bool accumulate_grads = false; // see set_accumulate_grads
+
+	// Checkpointing: forward only keeps activations of checkpoint nodes, backward recomputes
+	// the rest segment by segment. Without marked nodes every sqrt(N)th step is a checkpoint.
+	bool checkpointing = false;
+	std::set<int> checkpoints;
+
+	// Independent nodes run concurrently when set, not combined with arenas or checkpointing
+	// whose buffer reuse assumes the serial order
+	std::unique_ptr<ThreadPool> pool;
+
+	// Incremental mode: forward skips nodes whose inputs and parameters didn't change since they
+	// were computed. Inputs are stamped by Node::set_x and Node::operator(), which also skips
+	// reloading a tensor that didn't change. Parameters are stamped by update and the optimizers.
+	// Not used for planned (arena) or checkpointed runs.
+	bool incremental = false;
+	std::atomic<uint64_t> clock{0};
+	uint64_t params_version = 0;
+	std::vector<uint64_t> versions;            // stamp of the last change of every node
+	std::vector<std::vector<uint64_t>> seen;   // input stamps every node was computed from
+	std::vector<uint64_t> seen_params;
+	std::vector<char> evaluated;               // x holds a valid result of the last computation
+	std::vector<std::tuple<Tensor<F> *, uint64_t, uint64_t>> loaded; // source, its version, input version
+	std::atomic<size_t> n_executed{0}, n_skipped{0};
+
 	std::vector<std::string> names;
 	std::vector<std::unique_ptr<Operation<F>>> operations;
 	std::vector<TensorSet<F>> tensors;
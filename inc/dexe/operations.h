@@ -15,12 +15,42 @@ int const CONV_MAX_MEM = 1024 * 1024 * 1024;
 
 namespace dexe {
 
+// Analytic work of one operation for given shapes, bytes count every tensor read or written once
+struct OperationCost {
+	double forward_flops = 0, backward_flops = 0;
+	double forward_bytes = 0, backward_bytes = 0;
+};
+
 template <typename F>
 struct Operation {
     virtual ~Operation() = default;
 
 	virtual TensorShape output_shape(TensorShape input) { return input; }
 
+	// Computes the output shape from the input shapes without touching memory, false if they don't fit.
+	// Input operations get their current shape in out
+	virtual bool infer_shape(std::vector<TensorShape> const &in, TensorShape &out) {
+		if (in.size())
+			out = output_shape(in[0]);
+		return true;
+	}
+
+	// Floating point operations of one forward step, for reports
+	virtual double flops(std::vector<TensorShape> const &in, TensorShape const &out) { return out.n_elements(); }
+
+	// Forward and backward flops and memory traffic. By default the backward does the same work
+	// as the forward, reading the output and its gradient and writing the input gradients
+	virtual OperationCost cost(std::vector<TensorShape> const &in, TensorShape const &out) {
+		double in_elements(0);
+		for (auto &s : in)
+			in_elements += s.n_elements();
+		OperationCost c;
+		c.forward_flops = c.backward_flops = flops(in, out);
+		c.forward_bytes = (in_elements + out.n_elements()) * sizeof(F);
+		c.backward_bytes = (in_elements + 2.0 * out.n_elements()) * sizeof(F);
+		return c;
+	}
+
 	// Runs the forward step
 	virtual void forward(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) { throw std::runtime_error("Not Implemented"); }
 
@@ -37,7 +67,13 @@ struct Operation {
 	
 	virtual OperationCode opcode() { throw std::runtime_error("Not Implemented"); }
 
+	// True if the operation works in any memory layout, as long as its inputs and output share it.
+	// Operations that compute NCHW offsets themselves return false and always get NCHW tensors
+	virtual bool any_layout() { return true; }
+
 	virtual void save(cereal::PortableBinaryOutputArchive &ar) {throw std::runtime_error("Not Implemented"); }
+	// Like save, without parameter values. Loading it leaves the parameters uninitialised
+	virtual void save_graph(cereal::PortableBinaryOutputArchive &ar) { save(ar); }
 	
 	// Virtual void forward_timed(Tensor<F> &in, Tensor<F> &out, int t, F beta = 0.0){ forward(in, out, beta); }
 	// virtual void backward_weights_timed(Tensor<F> &in, Tensor<F> &out_grad, int t, F beta = 0.0){}
@@ -70,6 +106,8 @@ struct Parametrised {
 	virtual void from_vector(std::vector<F> &v) { }
 	virtual int size() { return 0; }
 	virtual std::vector<F> grad_to_vector() { return std::vector<F>(); }
+
+	bool accumulate_grads = false; // backward adds into the parameter gradients instead of overwriting them
 };
 
 template <typename F>
@@ -79,6 +117,8 @@ struct InputOperation : public Operation<F> {
     InputOperation(int n_channels_, Tensor<F> *reference_ = nullptr) : n_channels(n_channels_), reference(reference_) {}
 	InputOperation(cereal::PortableBinaryInputArchive &ar);
 
+    bool infer_shape(std::vector<TensorShape> const &in, TensorShape &out) override;
+    double flops(std::vector<TensorShape> const &in, TensorShape const &out) override { return 0; }
     bool forward_dry_run(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) override;
     void forward(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) override;
 	void backward(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out, std::vector<Tensor<F>*> &in_grad, std::vector<Tensor<F>*> &out_grad) override;
@@ -100,15 +140,19 @@ struct ConvolutionOperation : public Operation<F>, public Parametrised<F> {
 	virtual void init_uniform(F var) override;
 	void init();
 
-	bool check_fit(Tensor<F> &in_tensor, Tensor<F> &out_tensor);
+	bool check_fit(TensorShape const &in_shape);
 
     // API
+	virtual bool infer_shape(std::vector<TensorShape> const &in, TensorShape &out) override;
+	virtual double flops(std::vector<TensorShape> const &in, TensorShape const &out) override;
+	virtual OperationCost cost(std::vector<TensorShape> const &in, TensorShape const &out) override;
 	virtual void forward(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) override;
 	virtual bool forward_dry_run(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) override;
     virtual bool backward_dry_run(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out, std::vector<Tensor<F>*> &in_grad, std::vector<Tensor<F>*> &out_grad) override;
 	virtual void backward(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out, std::vector<Tensor<F>*> &in_grad, std::vector<Tensor<F>*> &out_grad) override;
 	virtual OperationCode opcode() override { return CONVOLUTION; }
 	virtual void save(cereal::PortableBinaryOutputArchive &ar) override;
+	virtual void save_graph(cereal::PortableBinaryOutputArchive &ar) override;
 
     // regular
 	void forward(Tensor<F> &in, Tensor<F> &out, F beta = 0.0);
@@ -146,10 +190,7 @@ struct ConvolutionOperation : public Operation<F>, public Parametrised<F> {
 	cudnnConvolutionBwdDataAlgo_t algo_bwd = CUDNN_CONVOLUTION_BWD_DATA_ALGO_0;
 	cudnnConvolutionBwdFilterAlgo_t algo_bwd_filter = CUDNN_CONVOLUTION_BWD_FILTER_ALGO_0;
 
-	char *workspace = nullptr;
-	char *workspace_bwd = nullptr;
-	char *workspace_bwd_filter = nullptr;
-
+	// workspaces come from the Handler of the calling thread, only their sizes are kept
 	size_t workspace_size = 0;
 	size_t workspace_size_bwd = 0;
 	size_t workspace_size_bwd_filter = 0;
@@ -164,6 +205,8 @@ struct ConvolutionTransposeOperation : public ConvolutionOperation<F> {
 	ConvolutionTransposeOperation(cereal::PortableBinaryInputArchive &ar);
 
     // API
+	virtual bool infer_shape(std::vector<TensorShape> const &in, TensorShape &out) override;
+	virtual double flops(std::vector<TensorShape> const &in, TensorShape const &out) override;
 	virtual void forward(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) override;
 	virtual bool forward_dry_run(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) override;
     virtual bool backward_dry_run(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out, std::vector<Tensor<F>*> &in_grad, std::vector<Tensor<F>*> &out_grad) override;
@@ -174,10 +217,35 @@ struct ConvolutionTransposeOperation : public ConvolutionOperation<F> {
     virtual OperationCode opcode() override { return CONVOLUTION_TRANSPOSE; }
 };
 
+// Convolution with bias and relu applied in the epilogue, the pre-activation is never stored.
+// Made by Network::fuse from a convolution followed by a relu
+template <typename F>
+struct ConvolutionReluOperation : public ConvolutionOperation<F> {
+	ConvolutionReluOperation(std::vector<int> dimensions, std::vector<int> strides, bool keep_, bool has_bias = true, size_t workspace_limit_ = CONV_MAX_MEM);
+	ConvolutionReluOperation(cereal::PortableBinaryInputArchive &ar);
+	~ConvolutionReluOperation();
+
+	void init_activation();
+
+    // API
+	virtual double flops(std::vector<TensorShape> const &in, TensorShape const &out) override;
+	virtual void forward(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) override;
+	virtual bool forward_dry_run(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) override;
+	virtual void backward(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out, std::vector<Tensor<F>*> &in_grad, std::vector<Tensor<F>*> &out_grad) override;
+
+	void describe(std::ostream &out) override { out << this->filter_bank.dimensions() << " relu"; }
+	virtual OperationCode opcode() override { return CONVOLUTION_RELU; }
+
+	cudnnActivationDescriptor_t desc = nullptr;
+	bool fused = false; // cudnn runs bias and relu inside the convolution, only for some algorithms
+};
+
 template <typename F>
 struct SquaredLossOperation : public Operation<F> {
   SquaredLossOperation();
 
+  virtual bool infer_shape(std::vector<TensorShape> const &in, TensorShape &out) override;
+  virtual double flops(std::vector<TensorShape> const &in, TensorShape const &out) override { return 3.0 * in[0].n_elements(); }
   virtual void forward(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) override;
   virtual bool forward_dry_run(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) override;
   virtual bool backward_dry_run(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out, std::vector<Tensor<F>*> &in_grad, std::vector<Tensor<F>*> &out_grad) override;
@@ -195,6 +263,8 @@ struct SupportLossOperation : public Operation<F> {
   SupportLossOperation(F support);
 	SupportLossOperation(cereal::PortableBinaryInputArchive &ar);
 
+  virtual bool infer_shape(std::vector<TensorShape> const &in, TensorShape &out) override;
+  virtual double flops(std::vector<TensorShape> const &in, TensorShape const &out) override { return 3.0 * in[0].n_elements(); }
   virtual void forward(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) override;
   virtual bool forward_dry_run(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) override;
   virtual bool backward_dry_run(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out, std::vector<Tensor<F>*> &in_grad, std::vector<Tensor<F>*> &out_grad) override;
@@ -208,6 +278,26 @@ struct SupportLossOperation : public Operation<F> {
   Tensor<F> tmp; // temporary tensor for computation
 };
 
+// Copies its input into another memory layout, inserted by Network::convert_layout.
+// The backward converts the gradient back and adds it to the input gradient
+template <typename F>
+struct LayoutOperation : public Operation<F> {
+	LayoutOperation(cudnnTensorFormat_t format);
+	explicit LayoutOperation(cereal::PortableBinaryInputArchive &ar);
+
+	double flops(std::vector<TensorShape> const &in, TensorShape const &out) override { return 0; }
+	void forward(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) override;
+	bool forward_dry_run(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) override;
+	void backward(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out, std::vector<Tensor<F>*> &in_grad, std::vector<Tensor<F>*> &out_grad) override;
+	bool backward_dry_run(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out, std::vector<Tensor<F>*> &in_grad, std::vector<Tensor<F>*> &out_grad) override;
+	OperationCode opcode() override { return LAYOUT; }
+	void save(cereal::PortableBinaryOutputArchive &ar) override;
+
+	void describe(std::ostream &out) override { out << (format == CUDNN_TENSOR_NHWC ? "to_nhwc" : "to_nchw"); }
+
+	cudnnTensorFormat_t format = CUDNN_TENSOR_NCHW; // of the output
+};
+
 template <typename F>
 struct SquashOperation : public ConvolutionOperation<F> {
 	SquashOperation(TensorShape s, int c);
@@ -230,6 +320,7 @@ struct UnsquashOperation : public DefaultOperation<F> {
   void backward(Tensor<F> &in, Tensor<F> &out, Tensor<F> &in_grad, Tensor<F> &out_grad, F beta = 0.0) override;
   
   void describe(std::ostream &out) override { out << "unsquash"; }
+  bool any_layout() override { return false; }
   
   TensorShape s;
 };
@@ -243,6 +334,7 @@ struct MergeOperation : public DefaultOperation<F> {
   void backward(Tensor<F> &in, Tensor<F> &out, Tensor<F> &in_grad, Tensor<F> &out_grad, F beta = 0.0) override;
   
   void describe(std::ostream &out) override { out << "merge"; }
+  bool any_layout() override { return false; }
 };
 
 template <typename F>
@@ -254,6 +346,7 @@ struct SplitOperation : public DefaultOperation<F> {
   void backward(Tensor<F> &in, Tensor<F> &out, Tensor<F> &in_grad, Tensor<F> &out_grad, F beta = 0.0) override;
   
   void describe(std::ostream &out) override { out << "split"; }
+  bool any_layout() override { return false; }
 };
 
 
@@ -267,6 +360,7 @@ struct LocalNormalisationOperation : public DefaultOperation<F> {
   void backward(Tensor<F> &in, Tensor<F> &out, Tensor<F> &in_grad, Tensor<F> &out_grad, F beta = 0.0) override;
   
   void describe(std::ostream &out) override { out << "local_normalisation"; }
+  bool any_layout() override { return false; } // the LRN is only set up for NCHW
   virtual OperationCode opcode() override { return LOCAL_NORMALISATION; }
 	void save(cereal::PortableBinaryOutputArchive &ar) override;
 	cudnnLRNDescriptor_t lrn_desc = 0;
@@ -320,16 +414,17 @@ struct SigmoidOperation : public DefaultOperation<F> {
 	F scale;
 };
 
+// Sums any number of inputs of the same shape
 template <typename F>
 struct AdditionOperation : public Operation<F> {
   AdditionOperation();
 
-	void forward(Tensor<F> &in1, Tensor<F> &in2, Tensor<F> &out);
-	void backward(Tensor<F> &in_grad, Tensor<F> &out_grad1, Tensor<F> &in_grad2);
+	double flops(std::vector<TensorShape> const &in, TensorShape const &out) override { return (in.size() - 1.0) * out.n_elements(); }
 	void describe(std::ostream &out) override { out << "addition"; }
 	virtual OperationCode opcode() override { return ADDITION; }
 
 	void forward(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) override;
+	bool infer_shape(std::vector<TensorShape> const &in, TensorShape &out) override;
 	bool forward_dry_run(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) override;
 	void backward(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out, std::vector<Tensor<F>*> &in_grad, std::vector<Tensor<F>*> &out_grad) override;
     bool backward_dry_run(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out, std::vector<Tensor<F>*> &in_grad, std::vector<Tensor<F>*> &out_grad) override;
@@ -356,6 +451,17 @@ struct ReluOperation : public DefaultOperation<F> {
 };
 
 
+// Sum of the inputs followed by a relu, in one pass over the output
+template <typename F>
+struct AdditionReluOperation : public AdditionOperation<F> {
+	double flops(std::vector<TensorShape> const &in, TensorShape const &out) override { return double(in.size()) * out.n_elements(); }
+	void describe(std::ostream &out) override { out << "addition relu"; }
+	virtual OperationCode opcode() override { return ADDITION_RELU; }
+
+	void forward(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out) override;
+	void backward(std::vector<Tensor<F>*> &in, std::vector<Tensor<F>*> &out, std::vector<Tensor<F>*> &in_grad, std::vector<Tensor<F>*> &out_grad) override;
+};
+
 template <typename F>
 struct SoftmaxOperation : public DefaultOperation<F> {
 	SoftmaxOperation(bool matched = false);
@@ -13,6 +13,16 @@ struct DEXE_API Optimizer {
 
     virtual void register_network(Network<F> &network);
     virtual void update();
+    // Updates parameters [begin, end) only, disjoint ranges can be updated from different threads.
+    // Doesn't stamp the parameters as changed, update() does.
+    virtual void update(int begin, int end);
+
+    // Buffers carried from step to step (e.g. moments), for checkpoints. Valid once registered
+    virtual std::vector<CudaVec<F> *> state() { return {}; }
+
+    // Factor the gradients are taken with, folded into the update so it costs no extra pass.
+    // Set to 1 / k after accumulating the gradients of k micro-batches.
+    F grad_scale = 1;
 };
 
 template <typename F>
@@ -22,6 +32,7 @@ struct DEXE_API SGDOptimizer : public Optimizer<F> {
 
     virtual void register_network(Network<F> &network);
     virtual void update();
+    virtual void update(int begin, int end);
 
     void set_lr(F lr);
     
@@ -37,6 +48,8 @@ struct DEXE_API AdaOptimizer : public Optimizer<F> {
 
     virtual void register_network(Network<F> &network);
     virtual void update();
+    virtual void update(int begin, int end);
+    std::vector<CudaVec<F> *> state() override { return {&std}; }
 
     void set_lr(F lr);
     
@@ -56,6 +69,8 @@ struct DEXE_API AdamOptimizer : public Optimizer<F> {
 
     virtual void register_network(Network<F> &network);
     virtual void update();
+    virtual void update(int begin, int end);
+    std::vector<CudaVec<F> *> state() override { return {&momentum, &std}; }
 
     void set_lr(F lr);
     
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "network.h"
+#include "optimizer.h"
+
+namespace dexe {
+
+// Contiguous range of the plan steps of a network, run by one thread
+struct DEXE_API PipelineStage {
+    int begin = 0, end = 0; // positions in the plan, input steps in between are skipped
+    double cost = 0;        // forward + backward, flops or measured seconds
+    int n_slots = 1;        // micro-batches in flight, each has its own activations
+    std::vector<int> loads;    // network inputs we read
+    std::vector<int> receives; // nodes of earlier stages we read
+    std::vector<int> sends;    // our nodes read by later stages
+    std::vector<int> producers, consumers; // stages we receive from and send to
+};
+
+// Pipeline parallel training. The plan from the inputs to the loss is cut into contiguous stages
+// of about equal cost, each running on its own thread. A step feeds micro-batches through the
+// stages in a one-forward-one-backward (1F1B) schedule: after a warm-up of S - s - 1 forwards,
+// stage s alternates forward and backward passes, so it never holds the activations of more than
+// S - s micro-batches. A stage only allocates activations of its own nodes and the ones it reads.
+// Activations are copied to the consuming stages, their gradients are added back to the producer.
+// Parameter gradients accumulate over the micro-batches and are averaged before the optimizer
+// step, so with the mean losses of dexe a step matches a single network step on the whole batch.
+template <typename F>
+struct DEXE_API Pipeline {
+    // optimizer has to be registered with network
+    Pipeline(Network<F> &network, Optimizer<F> &optimizer, int loss, int n_stages);
+    ~Pipeline();
+
+    // micro_batches[m] holds the inputs of micro-batch m, one tensor per network input in the
+    // order of network.inputs. Returns the loss averaged over the micro-batches
+    F step(std::vector<std::vector<Tensor<F> *>> const &micro_batches);
+
+    // Balances the stages on the measured node times from now on, instead of the analytic flops
+    void balance(CostReport const &report);
+
+    void describe(std::ostream &out);
+    int size() { return n_stages; }
+
+    Pipeline(const Pipeline &) = delete;
+    Pipeline &operator=(const Pipeline &) = delete;
+
+    Network<F> &network;
+    Optimizer<F> &optimizer;
+    int loss = -1, n_stages = 1;
+
+    std::vector<PipelineStage> stages; // set by the first step
+    std::vector<double> node_costs;    // measured cost per node, empty to use Operation::cost
+
+  private:
+    struct Mailbox;
+
+    void work(int s);
+    void partition(std::vector<std::vector<Tensor<F> *>> const &micro_batches);
+    void prepare(int s);
+    void run_stage(int s, std::vector<std::vector<Tensor<F> *>> const &micro_batches,
+                   std::vector<F> &losses);
+    void forward(int s, int m, std::vector<Tensor<F> *> const &inputs, std::vector<F> &losses);
+    void backward(int s, int m);
+    void wait(int s, std::function<bool(Mailbox &)> ready);
+    void deliver(std::vector<int> const &targets, bool gradients, int m);
+    void fail();
+
+    bool partitioned = false;
+    std::vector<TensorShape> input_shapes; // of the micro-batches the stages were cut for
+    int n_micro = 0;
+    std::vector<int> owner;           // stage computing each node, -1 for inputs and unused nodes
+    std::vector<TensorShape> shapes;  // of every node in the plan
+
+    // slots[s][k] are weight and gradient sharing replicas holding micro-batch m at k = m % n_slots,
+    // steps[s][k] the stage's plan steps resolved to their tensors
+    std::vector<std::vector<std::unique_ptr<Network<F>>>> slots;
+    std::vector<std::vector<std::vector<ExecutionStep<F>>>> steps;
+    std::vector<char> ready; // slots of the stage are shaped and dry run
+    std::vector<std::unique_ptr<Mailbox>> mailboxes;
+
+    // one thread per stage, a step bumps generation and waits until every stage is done
+    std::vector<std::thread> threads;
+    std::mutex stage_mutex;
+    std::condition_variable stage_changed;
+    int generation = 0, n_done = 0;
+    bool stopping = false;
+    std::vector<std::vector<Tensor<F> *>> const *job_batches = nullptr;
+    std::vector<F> *job_losses = nullptr;
+
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+};
+
+} // namespace dexe
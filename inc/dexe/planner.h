@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+#include "config.h"
+
+namespace dexe {
+
+// A buffer that has to stay valid from step first up to and including step last
+struct BufferRequest {
+    size_t bytes = 0;
+    int first = 0;
+    int last = 0;
+};
+
+struct DEXE_API MemoryPlan {
+    std::vector<size_t> offsets; // offset in bytes of every request within the arena
+
+    size_t arena_bytes = 0;     // size of the arena, the planned peak
+    size_t naive_bytes = 0;     // every buffer allocated separately, as without planning
+    size_t live_peak_bytes = 0; // largest sum of simultaneously live buffers, a lower bound
+
+    void describe(std::ostream &out);
+};
+
+// Assigns every request an offset so that requests with overlapping live ranges never
+// overlap in memory. Greedy best-fit: largest buffers are placed first, each one in the
+// smallest gap between already placed (and simultaneously live) buffers that fits it.
+DEXE_API MemoryPlan plan_memory(std::vector<BufferRequest> const &requests,
+                                size_t alignment = 256);
+
+enum class ArenaLocation { DEVICE, HOST };
+
+// One pre-sized block of memory that planned tensors are views into.
+// Host arenas don't touch CUDA, so plans can be allocated and checked on machines without a GPU.
+struct DEXE_API Arena {
+    Arena(ArenaLocation location = ArenaLocation::DEVICE);
+    ~Arena();
+
+    void allocate(size_t bytes);
+    void free();
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    char *data = nullptr;
+    size_t size = 0;
+    ArenaLocation location = ArenaLocation::DEVICE;
+};
+
+} // namespace dexe
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "network.h"
+
+namespace dexe {
+
+// Ranks of a training job on one machine, exchanging data through POSIX shared memory.
+// Every rank owns a slot of the segment, collectives run as rings over the slots,
+// so each step only reads the slot of the previous rank. Rank 0 creates the segment,
+// the others attach to it; the constructor returns once all ranks joined.
+// Slots are touched first by their owner, so after pinning they live on its NUMA node.
+// Within launch the segment name gets the nonce of the run, outside of it the name has to be
+// unique to the run, or a rank may attach to a segment a crashed run left behind.
+struct DEXE_API ProcessGroup {
+    ProcessGroup(std::string name, int rank, int world_size, size_t slot_bytes);
+    ~ProcessGroup();
+
+    // Throws when another rank failed or nobody arrived for barrier_timeout seconds
+    void barrier();
+    double barrier_timeout = 600;
+
+    // In place sum over all ranks, n * sizeof(F) has to fit in a slot
+    template <typename F> void all_reduce(F *data, size_t n);
+    template <typename F> void broadcast(F *data, size_t n, int root = 0);
+
+    // Copies the parameters of root into network on every rank
+    template <typename F> void broadcast_parameters(Network<F> &network, int root = 0);
+    // Sums grad_vec over the ranks, divided by world_size when average is set
+    template <typename F> void all_reduce_gradients(Network<F> &network, bool average = true);
+
+    // Forks world_size worker processes running worker(rank), each pinned to NUMA node
+    // rank % n_numa_nodes(), and waits for them. Call before anything uses cuda,
+    // a forked process can't use the device context of its parent.
+    // When a worker fails the others are killed. Returns the number of workers that didn't
+    // return 0.
+    static int launch(int world_size, std::function<int(int rank)> worker);
+    static int n_numa_nodes();
+    static void pin_to_numa_node(int node); // the calling thread and threads it starts later
+
+    int rank = 0, world_size = 1;
+
+    ProcessGroup(const ProcessGroup &) = delete;
+    ProcessGroup &operator=(const ProcessGroup &) = delete;
+
+  private:
+    struct Header;
+
+    char *slot(int r);
+    bool aborted();
+
+    std::string name;
+    size_t slot_bytes = 0, segment_bytes = 0;
+    char *segment = nullptr;
+    Header *header = nullptr;
+    unsigned generation = 0; // barriers passed by this rank
+};
+
+} // namespace dexe
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "memory.h"
+
+namespace dexe {
+
+struct ProfileEvent {
+    std::string name;
+    char const *category = "";
+    double start = 0, duration = 0; // microseconds, start since the process started
+    int thread = 0;
+};
+
+// Process wide recorder of timed events, off by default.
+// While enabled, the network records the dry run, forward and backward of every step and
+// optimizers record their updates. With synchronise set the device stream is synced at the
+// end of every event, so events measure the kernels and not only their launch.
+struct DEXE_API Profiler {
+    using Clock = std::chrono::steady_clock;
+
+    static void enable(bool synchronise = true);
+    static void disable();
+    static bool enabled();
+    static void clear();
+
+    static void record(std::string name, char const *category, Clock::time_point start);
+    static double timestamp(Clock::time_point t); // microseconds since the process started
+    static std::vector<ProfileEvent> events();
+
+    // Chrome trace event format, open with chrome://tracing or ui.perfetto.dev.
+    // Includes the memory timeline as a counter when the MemoryTracker recorded one
+    static void write_trace(std::string path);
+    // Per name and category: count, total, mean and p95 in ms, sorted on total time
+    static void summary(std::ostream &out);
+};
+
+// Times its own lifetime, and tags allocations with the name and category as owner and phase
+// when the MemoryTracker is on. name() is only called while one of them is enabled,
+// so otherwise this costs two flag checks.
+struct ProfileScope {
+    template <typename Name>
+    ProfileScope(char const *category_, Name const &name_) : category(category_) {
+        bool tracking = MemoryTracker::enabled();
+        active = Profiler::enabled();
+        if (!active && !tracking)
+            return;
+        name = name_();
+        if (tracking)
+            memory.tag(category, name);
+        start = Profiler::Clock::now();
+    }
+
+    ~ProfileScope() {
+        if (active)
+            Profiler::record(std::move(name), category, start);
+    }
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+    bool active = false;
+    char const *category;
+    std::string name;
+    Profiler::Clock::time_point start;
+    MemoryTag memory;
+};
+
+} // namespace dexe
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <thread>
+
+namespace dexe {
+
+// Bounded lock free multi producer multi consumer queue (Vyukov). Every cell carries a sequence
+// number telling whether it's free for the producer or filled for the consumer of a given lap,
+// so producers and consumers only contend on their own counter. Capacity is rounded up to a
+// power of two. try_push fails when full, try_pop when empty; the blocking variants back off
+// by spinning, yielding and finally sleeping, and give up when abort returns true.
+template <typename T>
+struct BoundedQueue {
+    explicit BoundedQueue(size_t capacity) {
+        size_t size(2);
+        while (size < capacity)
+            size *= 2;
+        mask = size - 1;
+        cells.reset(new Cell[size]);
+        for (size_t i(0); i < size; ++i)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool try_push(T value) {
+        size_t position = tail.load(std::memory_order_relaxed);
+        while (true) {
+            auto &cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            auto difference = std::ptrdiff_t(sequence) - std::ptrdiff_t(position);
+            if (difference == 0) {
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0)
+                return false; // full
+            else
+                position = tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    bool try_pop(T &value) {
+        size_t position = head.load(std::memory_order_relaxed);
+        while (true) {
+            auto &cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            auto difference = std::ptrdiff_t(sequence) - std::ptrdiff_t(position + 1);
+            if (difference == 0) {
+                if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.sequence.store(position + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0)
+                return false; // empty
+            else
+                position = head.load(std::memory_order_relaxed);
+        }
+    }
+
+    template <typename Abort> bool push(T value, Abort abort) {
+        for (int attempt(0); !try_push(value); ++attempt) {
+            if (abort())
+                return false;
+            back_off(attempt);
+        }
+        return true;
+    }
+
+    template <typename Abort> bool pop(T &value, Abort abort) {
+        for (int attempt(0); !try_pop(value); ++attempt) {
+            if (abort())
+                return false;
+            back_off(attempt);
+        }
+        return true;
+    }
+
+    size_t capacity() { return mask + 1; }
+
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+  private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    static void back_off(int attempt) {
+        if (attempt < 64)
+            return;
+        if (attempt < 128)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+} // namespace dexe
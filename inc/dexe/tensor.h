@@ -26,11 +26,12 @@ namespace dexe {
   bool operator==(TensorShape const &other) const;
   bool operator!=(TensorShape const &other) const;
   int &operator[](int index);
+  int operator[](int index) const;
 
-  int offset(int n, int c, int y, int x);
-  int n_elements();
-  int n_dimensions();
-  int n_pixels();
+  int offset(int n, int c, int y, int x, cudnnTensorFormat_t format = DEFAULT_TENSOR_FORMAT);
+  int n_elements() const;
+  int n_dimensions() const;
+  int n_pixels() const;
 
   void set_c(int c);
 
@@ -41,13 +42,20 @@ namespace dexe {
  	}
 
 
-  int n();
-  int c();
-  int d();
-  int h(); 
-  int w();
+  int n() const;
+  int c() const;
+  int d() const;
+  int h() const;
+  int w() const;
 };
 
+// Element strides of a dense tensor of this shape and format. NHWC (channels last, NDHWC for
+// volumes) only applies to tensors of four or more dimensions, smaller ones are always NCHW
+std::vector<int> dense_strides(TensorShape const &shape, cudnnTensorFormat_t format = DEFAULT_TENSOR_FORMAT);
+
+template <typename F>
+struct TensorView;
+
 template <typename F>
 struct DEXE_API Tensor {
 	Tensor();
@@ -64,6 +72,15 @@ struct DEXE_API Tensor {
     void set_descriptor_typed();
     void set_descriptor();
 	void reshape(TensorShape shape);
+	// Changes how the memory is interpreted, the data is not converted; from_tensor converts
+	void set_format(cudnnTensorFormat_t format);
+	cudnnTensorFormat_t layout() const; // format in effect for the current shape
+
+	// Point the tensor at externally owned memory, e.g. a planned arena, releasing its own buffer
+	void bind(F *data);
+	void bind(F *data, TensorShape new_shape);
+	// Go back to owning a buffer of our own
+	void unbind();
 
 	//Remove copy and assignment operator to be safe
 	Tensor<F> & operator=(const Tensor<F>&) = delete;
@@ -78,6 +95,7 @@ struct DEXE_API Tensor {
 	void from_vector(std::vector<F> &in);
 	void from_ptr(F const *in);
 	void from_tensor(Tensor<F> &in, F alpha = 1.0);
+	void from_tensor(TensorView<F> const &in, F alpha = 1.0); // gathers a strided view
 	void fill(F val);
    
 
@@ -97,11 +115,17 @@ struct DEXE_API Tensor {
 
   	int size();
 
+  	// raw access: writes through these pointers don't bump version, call touch() after them,
+  	// or an incremental load_input may skip copying the changed data
   	F *&ptr() { return cudavec.data; }
-    F *ptr(int n_, int c_ = 0, int y_ = 0, int x_ = 0) {return cudavec.data + shape.offset(n_, c_, y_, x_); }
+    F *ptr(int n_, int c_ = 0, int y_ = 0, int x_ = 0) {return cudavec.data + shape.offset(n_, c_, y_, x_, layout()); }
    
    	void add(Tensor<F> &other, F alpha);
+   	void add(TensorView<F> const &other, F alpha);
    	void scale(F alpha);
+   	void touch(); // bumps version after writes through ptr()
+
+	TensorView<F> view(); // of the whole tensor
 
    	template<class Archive>
 	void save(Archive & archive)
@@ -124,10 +148,13 @@ struct DEXE_API Tensor {
 
  	void share(Tensor<F> &other) {
  		cudavec.share(other.cudavec);
+ 		touch();
  	}
 
     TensorShape shape;
 	bool owning = false;
+	bool bound = false; // data lives in memory bound from outside
+	uint64_t version = 0; // bumped by every write through the Tensor interface, raw ptr() writers call touch()
 	cudnnTensorDescriptor_t td = nullptr;
 
 	CudaVec<F> cudavec;
@@ -135,6 +162,53 @@ struct DEXE_API Tensor {
 	cudnnTensorFormat_t format = DEFAULT_TENSOR_FORMAT;
 };
 
+// Non-owning window into a tensor: a pointer to its first element and a stride per dimension,
+// in elements. Slicing, cropping and channel selection only change the pointer, shape and
+// strides, nothing is copied. cuDNN takes the strides directly, so views can be copied from,
+// added, scaled and filled as they are; contiguous() materialises one for kernels that need
+// dense memory, without a copy if the view already is dense.
+// The viewed memory must outlive the view. Writes through a view bump the version of the tensor
+// it was taken from, as writes through the tensor would.
+template <typename F>
+struct DEXE_API TensorView {
+	TensorView(F *data, TensorShape shape, std::vector<int> strides, Tensor<F> *tensor = nullptr);
+	TensorView(TensorView<F> const &other);
+	TensorView<F> &operator=(TensorView<F> const &other);
+	~TensorView();
+
+	// [begin, end) along one dimension, keeping the others
+	TensorView<F> slice(int dim, int begin, int end) const;
+	TensorView<F> batch(int begin, int end) const { return slice(0, begin, end); }
+	TensorView<F> sample(int n) const { return slice(0, n, n + 1); }
+	TensorView<F> channels(int begin, int end) const { return slice(1, begin, end); }
+	// Sub-volume of size at origin, both over the spatial dimensions (d, h, w or h, w)
+	TensorView<F> crop(std::vector<int> origin, std::vector<int> size) const;
+
+	bool is_contiguous() const;
+	int size() const { return shape.n_elements(); }
+
+	// Dense tensor with the contents of the view; bound to the viewed memory if the view is
+	// contiguous, a copy otherwise
+	std::unique_ptr<Tensor<F>> contiguous() const;
+	void to_tensor(Tensor<F> &out) const; // reshapes out and copies the view into it
+
+	void from_tensor(Tensor<F> &in, F alpha = 1.0); // scatters in into the viewed elements
+	void add(TensorView<F> const &in, F alpha);
+	void scale(F alpha);
+	void fill(F val);
+	void zero() { fill(0); }
+
+	F *data = nullptr;
+	TensorShape shape;
+	std::vector<int> strides;
+	Tensor<F> *tensor = nullptr; // the view was taken from, if any
+	cudnnTensorDescriptor_t td = nullptr;
+
+  private:
+	void set_descriptor();
+	void touch();
+};
+
 template <typename F>
 inline Tensor<F> &operator*=(Tensor<F> &in, F const other) {
   scale_cuda<F>(in.data, in.size(), other);
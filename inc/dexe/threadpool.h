@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+
+namespace dexe {
+
+// Work stealing thread pool. Every worker has its own queue, tasks submitted from a worker
+// go to its own queue (newest first, for locality), idle workers steal the oldest task of others.
+// Every worker thread gets its own Handler, so cudnn/cublas calls of different workers
+// don't share handles, workspaces or streams.
+struct DEXE_API ThreadPool {
+    ThreadPool(int n_threads);
+    ~ThreadPool();
+
+    void submit(std::function<void()> task);
+    int size() { return threads.size(); }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+  private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void work(int worker);
+    bool pop(int worker, std::function<void()> &task);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::atomic<int> n_queued{0};
+    std::atomic<unsigned> next_queue{0};
+    bool stop = false;
+};
+
+// Runs task(i) for every node of a DAG as soon as all its dependencies have run.
+// dependents[i] lists the nodes waiting for i, n_dependencies[i] how many nodes i waits for.
+// Blocks until everything ran, the first exception thrown by a task is rethrown.
+// Called from a worker of the same pool, the graph runs inline on that worker.
+DEXE_API void run_graph(ThreadPool &pool, std::vector<std::vector<int>> const &dependents,
+                        std::vector<int> const &n_dependencies,
+                        std::function<void(int)> const &task);
+
+} // namespace dexe
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "network.h"
+#include "optimizer.h"
+#include "queue.h"
+
+namespace dexe {
+
+// Where the time of a Trainer went, times in seconds
+struct DEXE_API TrainerStats {
+    size_t n_steps = 0; // optimizer updates
+    double step_time = 0;  // forward, backward and update
+    double stall_time = 0; // training loop waiting for a batch
+    double load_time = 0;  // copying batches into the network inputs
+    double fill_time = 0;  // summed over the workers
+    double backpressure_time = 0; // workers waiting for a free buffer, summed over the workers
+
+    // fraction of the loop spent waiting for data, near 1 means training is input bound
+    double input_bound() {
+        double total = step_time + stall_time + load_time;
+        return total > 0 ? stall_time / total : 0;
+    }
+    void describe(std::ostream &out);
+};
+
+// Training driver that prepares batches while the network trains on the previous one.
+// Worker threads take a free buffer, fill it with fill(batch, worker) and queue it as ready.
+// The buffers hold one device tensor per network input, in the order of network.inputs;
+// fill prepares the data on the host and uploads it, reshaping the tensors if needed.
+// With n_buffers > n_workers a worker can fill batch i + 1 while the network trains on batch i;
+// when all buffers are full the workers wait (backpressure), when none is ready the loop stalls.
+// Buffers move between workers and the loop through lock free bounded queues.
+template <typename F>
+struct DEXE_API Trainer {
+    using FillFunc = std::function<void(std::vector<std::unique_ptr<Tensor<F>>> &batch, int worker)>;
+
+    // Every step accumulates the gradients of n_accumulate batches before updating,
+    // scaled by 1 / n_accumulate inside the update. With more than one batch per step this
+    // turns on network.set_accumulate_grads
+    Trainer(Network<F> &network, Optimizer<F> &optimizer, int loss, FillFunc fill,
+            int n_workers = 2, int n_buffers = 3, int n_accumulate = 1);
+    ~Trainer(); // stops the workers
+
+    void start();
+    void stop();
+
+    // Trains on the next n_accumulate ready batches and returns their mean loss.
+    // Starts the workers if needed, rethrows the exception of a failed worker
+    F step();
+    F train(int n_steps); // mean loss
+
+    Network<F> &network;
+    Optimizer<F> &optimizer;
+    int loss = -1;
+    int n_accumulate = 1;
+    TrainerStats stats;
+
+    Trainer(const Trainer &) = delete;
+    Trainer &operator=(const Trainer &) = delete;
+
+  private:
+    void work(int worker);
+    void load_next();
+
+    FillFunc fill;
+    int n_workers = 2;
+
+    std::vector<std::vector<std::unique_ptr<Tensor<F>>>> buffers;
+    BoundedQueue<int> free_buffers, ready_buffers; // buffer indices
+
+    std::vector<std::thread> workers;
+    std::atomic<bool> stopping{false}, failed{false};
+    std::exception_ptr error;
+
+    std::mutex stats_mutex; // workers add their times
+};
+
+} // namespace dexe
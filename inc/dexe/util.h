@@ -35,7 +35,10 @@ enum OperationCode {
   LOCAL_NORMALISATION,
   SQUARED_LOSS,
   SUPPORT_LOSS,
-  INSTANCE_NORMALISATION
+  INSTANCE_NORMALISATION,
+  CONVOLUTION_RELU,
+  ADDITION_RELU,
+  LAYOUT
 };
 
 struct DexeException : public std::exception {
@@ -438,19 +441,23 @@ inline std::vector<T> byte_read_vec(std::istream &in) {
 }
 
 
+// Copies run on the stream of the calling thread, which doesn't synchronise with the default
+// stream. Copies involving the host wait for it to finish.
 template <typename T>
 void copy_cpu_to_gpu(T const *it_from, T *it_to, int n) {
-  	handle_error( cudaMemcpy(it_to, it_from, n * sizeof(T), cudaMemcpyHostToDevice));
+  	handle_error( cudaMemcpyAsync(it_to, it_from, n * sizeof(T), cudaMemcpyHostToDevice, Handler::stream()));
+	Handler::sync_stream();
 }
 
 template <typename T>
 void copy_gpu_to_cpu(T const *it_from, T *it_to, int n) {
-	handle_error( cudaMemcpy(it_to, it_from, n * sizeof(T), cudaMemcpyDeviceToHost));
+	handle_error( cudaMemcpyAsync(it_to, it_from, n * sizeof(T), cudaMemcpyDeviceToHost, Handler::stream()));
+	Handler::sync_stream();
 }
 
 template <typename T>
 void copy_gpu_to_gpu(T const *it_from, T *it_to, int n) {
-	handle_error( cudaMemcpy(it_to, it_from, n * sizeof(T), cudaMemcpyDeviceToDevice));
+	handle_error( cudaMemcpyAsync(it_to, it_from, n * sizeof(T), cudaMemcpyDeviceToDevice, Handler::stream()));
 }
 
 
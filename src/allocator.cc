@@ -0,0 +1,283 @@
+#include "dexe/allocator.h"
+#include "dexe/memory.h"
+#include "dexe/util.h"
+
+#include <cuda_runtime.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+
+namespace dexe {
+
+namespace {
+size_t const MIN_BLOCK = 512;
+atomic<uint64_t> next_id{1};
+
+// allocators that still exist by id, leaked so threads exiting late can still look them up
+auto live_mutex = new std::mutex();
+auto live = new map<uint64_t, CachingAllocator *>();
+} // namespace
+
+// Caches of the calling thread by allocator id. When the thread exits, their blocks go to the
+// shared lists, otherwise nobody could reuse them until a trim.
+struct CachingAllocator::ThreadCaches {
+    vector<pair<uint64_t, ThreadCache *>> entries;
+
+    ~ThreadCaches() {
+        lock_guard<std::mutex> lock(*live_mutex);
+        for (auto &entry : entries) {
+            auto it = live->find(entry.first);
+            if (it != live->end())
+                it->second->abandon(entry.second);
+        }
+    }
+};
+
+namespace {
+thread_local CachingAllocator::ThreadCaches thread_caches;
+} // namespace
+
+void AllocatorStats::describe(ostream &out) {
+    size_t requests = hits + shared_hits + misses;
+    out << "allocations: " << requests << " hits: " << hits << " shared hits: " << shared_hits
+        << " misses: " << misses << " (" << (requests ? 100.0 * misses / requests : 0)
+        << "%) releases: " << releases << " trimmed: " << trimmed
+        << " in use: " << bytes_in_use / (1 << 20) << " MiB cached: " << bytes_cached / (1 << 20)
+        << " MiB peak held: " << peak_bytes_held / (1 << 20) << " MiB" << endl;
+}
+
+CachingAllocator::CachingAllocator(AllocatorBackend backend_, size_t budget_, size_t thread_budget_)
+    : backend(backend_), id(next_id++), budget(budget_), thread_budget(thread_budget_) {
+    lock_guard<std::mutex> lock(*live_mutex);
+    (*live)[id] = this;
+}
+
+CachingAllocator::~CachingAllocator() {
+    {
+        lock_guard<std::mutex> lock(*live_mutex);
+        live->erase(id);
+    }
+    trim(0);
+}
+
+CachingAllocator &CachingAllocator::device() {
+    static auto allocator = new CachingAllocator(AllocatorBackend::DEVICE);
+    return *allocator;
+}
+
+// Four classes per power of two: 2^k, 1.25 2^k, 1.5 2^k and 1.75 2^k
+size_t CachingAllocator::size_class(size_t bytes) {
+    if (bytes <= MIN_BLOCK)
+        return MIN_BLOCK;
+    size_t power(MIN_BLOCK);
+    while (power * 2 <= bytes)
+        power *= 2;
+    size_t step = power / 4;
+    return (bytes + step - 1) / step * step;
+}
+
+CachingAllocator::ThreadCache &CachingAllocator::local() {
+    for (auto &entry : thread_caches.entries)
+        if (entry.first == id)
+            return *entry.second;
+    lock_guard<std::mutex> lock(mutex);
+    caches.emplace_back(make_unique<ThreadCache>());
+    thread_caches.entries.emplace_back(id, caches.back().get());
+    return *caches.back();
+}
+
+// Hands the blocks of an exiting thread to the shared lists and drops its cache
+void CachingAllocator::abandon(ThreadCache *cache) {
+    lock_guard<std::mutex> lock(mutex);
+    {
+        lock_guard<std::mutex> cache_lock(cache->mutex);
+        for (auto &list : cache->blocks) {
+            auto &blocks = shared[list.first];
+            blocks.insert(blocks.end(), list.second.begin(), list.second.end());
+        }
+        shared_bytes += cache->bytes;
+    }
+    caches.erase(remove_if(caches.begin(), caches.end(),
+                           [cache](unique_ptr<ThreadCache> &c) { return c.get() == cache; }),
+                 caches.end());
+}
+
+// Cached blocks belong to the "allocator cache" owner of the MemoryTracker, so the tracked
+// total is what the allocator holds from the system
+void CachingAllocator::track_cached(void *ptr, size_t size) {
+    if (backend != AllocatorBackend::DEVICE || !MemoryTracker::enabled())
+        return;
+    MemoryTag tag("allocator cache");
+    MemoryTracker::allocated(ptr, size);
+}
+
+void CachingAllocator::untrack_cached(void *ptr) {
+    if (backend == AllocatorBackend::DEVICE)
+        MemoryTracker::released(ptr);
+}
+
+void *CachingAllocator::system_allocate(size_t bytes) {
+    void *ptr = nullptr;
+    if (backend == AllocatorBackend::HOST)
+        return malloc(bytes);
+    if (cudaMalloc(&ptr, bytes) != cudaSuccess) {
+        cudaGetLastError(); // clear the error, we retry after trimming
+        return nullptr;
+    }
+    return ptr;
+}
+
+void CachingAllocator::system_release(void *ptr, size_t bytes) {
+    if (backend == AllocatorBackend::HOST)
+        free(ptr);
+    else
+        handle_error(cudaFree(ptr));
+    held -= bytes;
+}
+
+void *CachingAllocator::allocate(size_t bytes) {
+    if (!bytes)
+        return nullptr;
+    size_t size = size_class(bytes);
+
+    auto &cache = local();
+    {
+        lock_guard<std::mutex> lock(cache.mutex);
+        auto it = cache.blocks.find(size);
+        if (it != cache.blocks.end() && !it->second.empty()) {
+            void *ptr = it->second.back();
+            it->second.pop_back();
+            cache.bytes -= size;
+            cached -= size;
+            in_use += size;
+            ++n_hits;
+            untrack_cached(ptr);
+            return ptr;
+        }
+    }
+
+    void *ptr = nullptr;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        auto it = shared.find(size);
+        if (it != shared.end() && !it->second.empty()) {
+            ptr = it->second.back();
+            it->second.pop_back();
+            shared_bytes -= size;
+        }
+    }
+    if (ptr) {
+        // another thread freed it, its stream may still be using the block
+        if (backend == AllocatorBackend::DEVICE)
+            handle_error(cudaDeviceSynchronize());
+        cached -= size;
+        in_use += size;
+        ++n_shared_hits;
+        untrack_cached(ptr);
+        return ptr;
+    }
+
+    ++n_misses;
+    ptr = system_allocate(size);
+    if (!ptr) {
+        trim(0);
+        ptr = system_allocate(size);
+        if (!ptr)
+            throw DexeException("CachingAllocator: out of memory, bytes:", size);
+    }
+    in_use += size;
+    size_t now = held += size;
+    size_t peak = peak_held;
+    while (now > peak && !peak_held.compare_exchange_weak(peak, now))
+        ;
+    return ptr;
+}
+
+void CachingAllocator::release(void *ptr, size_t bytes) {
+    if (!ptr)
+        return;
+    size_t size = size_class(bytes);
+    ++n_releases;
+    in_use -= size;
+    if (!budget) {
+        system_release(ptr, size);
+        return;
+    }
+
+    // count it first, a hit on the shared list may take it right away
+    cached += size;
+    track_cached(ptr, size);
+    bool kept(false);
+    {
+        auto &cache = local();
+        lock_guard<std::mutex> lock(cache.mutex);
+        if (cache.bytes + size <= thread_budget) {
+            cache.blocks[size].push_back(ptr);
+            cache.bytes += size;
+            kept = true;
+        }
+    }
+    if (!kept) {
+        lock_guard<std::mutex> lock(mutex);
+        shared[size].push_back(ptr);
+        shared_bytes += size;
+    }
+    if (cached > budget)
+        trim(budget);
+}
+
+// Takes the largest cached blocks out of lists until total bytes are at most target
+size_t CachingAllocator::take_largest(FreeLists &lists, size_t &bytes, size_t target) {
+    size_t released(0);
+    for (auto it = lists.rbegin(); it != lists.rend() && cached > target; ++it) {
+        while (!it->second.empty() && cached > target) {
+            untrack_cached(it->second.back());
+            system_release(it->second.back(), it->first);
+            it->second.pop_back();
+            bytes -= it->first;
+            cached -= it->first;
+            ++released;
+        }
+    }
+    return released;
+}
+
+void CachingAllocator::trim(size_t target) {
+    lock_guard<std::mutex> lock(mutex);
+    size_t released = take_largest(shared, shared_bytes, target);
+    for (auto &cache : caches) {
+        if (cached <= target)
+            break;
+        lock_guard<std::mutex> cache_lock(cache->mutex);
+        released += take_largest(cache->blocks, cache->bytes, target);
+    }
+    n_trimmed += released;
+}
+
+void CachingAllocator::set_budget(size_t budget_, size_t thread_budget_) {
+    budget = budget_;
+    thread_budget = thread_budget_;
+    trim(budget_);
+}
+
+AllocatorStats CachingAllocator::stats() {
+    AllocatorStats s;
+    s.hits = n_hits;
+    s.shared_hits = n_shared_hits;
+    s.misses = n_misses;
+    s.releases = n_releases;
+    s.trimmed = n_trimmed;
+    s.bytes_in_use = in_use;
+    s.bytes_cached = cached;
+    s.peak_bytes_held = peak_held;
+    return s;
+}
+
+void CachingAllocator::reset_stats() {
+    n_hits = n_shared_hits = n_misses = n_releases = n_trimmed = 0;
+    peak_held = size_t(held);
+}
+
+} // namespace dexe
@@ -0,0 +1,171 @@
+#include "dexe/batcher.h"
+#include "dexe/handler.h"
+
+#include <algorithm>
+#include <exception>
+
+using namespace std;
+
+namespace dexe {
+
+template <typename F>
+Batcher<F>::Batcher(Network<F> *network_, int output_, int max_batch_, double max_delay_)
+    : network(network_), output(output_), max_batch(max(max_batch_, 1)),
+      max_delay(chrono::duration_cast<Clock::duration>(chrono::duration<double>(max_delay_))) {
+    worker = thread(&Batcher<F>::work, this);
+}
+
+template <typename F> Batcher<F>::~Batcher() {
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+template <typename F>
+future<InferenceResult<F>> Batcher<F>::submit(vector<vector<F>> inputs,
+                                              vector<TensorShape> shapes) {
+    if (inputs.size() != network->inputs.size() || shapes.size() != inputs.size())
+        throw DexeException("Batcher: expected one input per network input, got:", inputs.size());
+
+    auto request = make_unique<Request>();
+    request->n = shapes[0].n();
+    vector<vector<int>> key;
+    for (size_t i(0); i < shapes.size(); ++i) {
+        if (shapes[i].n() != request->n || shapes[i].n() < 1)
+            throw DexeException("Batcher: inputs need the same, nonzero N");
+        if (inputs[i].size() != shapes[i].n_elements())
+            throw DexeException("Batcher: input size doesn't match its shape:", inputs[i].size());
+        key.emplace_back(shapes[i].dimensions.begin() + 1, shapes[i].dimensions.end());
+    }
+    request->inputs = move(inputs);
+    request->shapes = move(shapes);
+    request->arrival = Clock::now();
+    auto result = request->result.get_future();
+
+    {
+        lock_guard<std::mutex> lock(mutex);
+        buckets[key].emplace_back(move(request));
+    }
+    wake.notify_one();
+    return result;
+}
+
+template <typename F>
+future<InferenceResult<F>> Batcher<F>::submit(vector<F> input, TensorShape shape) {
+    return submit(vector<vector<F>>{move(input)}, vector<TensorShape>{shape});
+}
+
+template <typename F> void Batcher<F>::work() {
+    unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        // a bucket is ready when it's full or its oldest request waited long enough
+        auto now = Clock::now();
+        auto ready = buckets.end();
+        auto deadline = Clock::time_point::max();
+        for (auto it = buckets.begin(); it != buckets.end(); ++it) {
+            auto &bucket = it->second;
+            int queued(0);
+            for (auto &r : bucket)
+                queued += r->n;
+            auto due = bucket.front()->arrival + max_delay;
+            if (queued >= max_batch || stop || now >= due) {
+                ready = it;
+                break;
+            }
+            deadline = min(deadline, due);
+        }
+
+        if (ready == buckets.end()) {
+            if (stop)
+                break;
+            if (deadline == Clock::time_point::max())
+                wake.wait(lock);
+            else
+                wake.wait_until(lock, deadline);
+            continue;
+        }
+
+        // oldest first, a single request larger than max_batch runs on its own
+        auto &bucket = ready->second;
+        Bucket batch;
+        int n(0);
+        auto it = bucket.begin();
+        for (; it != bucket.end(); ++it) {
+            if (!batch.empty() && n + (*it)->n > max_batch)
+                break;
+            n += (*it)->n;
+            batch.emplace_back(move(*it));
+        }
+        bucket.erase(bucket.begin(), it);
+        if (bucket.empty())
+            buckets.erase(ready);
+
+        lock.unlock();
+        run(batch);
+        lock.lock();
+    }
+    lock.unlock();
+
+    // handles are per thread, clean up the ones this worker created
+    Handler::deinit();
+}
+
+template <typename F> void Batcher<F>::run(Bucket &batch) {
+    int n(0);
+    for (auto &r : batch)
+        n += r->n;
+    // powers of two keep the number of planned batch shapes small, but never past max_batch:
+    // padding 9 samples to 16 with a max_batch of 10 would double the work
+    int padded(1);
+    while (padded < n)
+        padded <<= 1;
+    padded = min(padded, max(n, max_batch));
+
+    try {
+        auto &inputs = network->inputs;
+        for (size_t i(0); i < inputs.size(); ++i) {
+            auto shape = batch[0]->shapes[i];
+            shape[0] = padded;
+
+            vector<F> data;
+            data.reserve(shape.n_elements());
+            for (auto &r : batch)
+                data.insert(data.end(), r->inputs[i].begin(), r->inputs[i].end());
+            data.resize(shape.n_elements()); // padding samples are zero
+
+            auto &x = *network->tensors[inputs[i]].x;
+            x.reshape(shape);
+            x.from_vector(data);
+        }
+
+        network->infer(inputs, output);
+
+        auto &out = *network->tensors[output].x;
+        auto values = out.to_vector();
+        size_t sample_size = values.size() / padded;
+        auto begin = values.begin();
+        for (auto &r : batch) {
+            InferenceResult<F> result;
+            result.shape = out.shape;
+            result.shape[0] = r->n;
+            result.data.assign(begin, begin + r->n * sample_size);
+            begin += r->n * sample_size;
+            r->result.set_value(move(result));
+        }
+    } catch (...) {
+        for (auto &r : batch)
+            r->result.set_exception(current_exception());
+    }
+
+    ++n_batches;
+    n_requests += batch.size();
+    n_padded += padded - n;
+}
+
+template struct Batcher<float>;
+template struct Batcher<double>;
+
+} // namespace dexe
@@ -0,0 +1,225 @@
+#include "dexe/checkpoint.h"
+#include "dexe/handler.h"
+#include "dexe/profiler.h"
+#include "dexe/util.h"
+
+#include <cereal/archives/portable_binary.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace dexe {
+
+namespace {
+string const CHECKPOINT_MAGIC = "dexe-checkpoint";
+int const CHECKPOINT_VERSION = 1;
+
+// Makes the file contents durable before the rename makes them visible. On a directory it
+// makes the entries durable, the rename itself
+void sync_file(string const &path) {
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Checkpointer: couldn't open " + path + ": " + strerror(errno));
+    int result = fsync(fd);
+    close(fd);
+    if (result != 0)
+        throw std::runtime_error("Checkpointer: fsync of " + path + " failed: " + strerror(errno));
+#endif
+}
+
+string directory_of(string const &path) {
+    auto slash = path.find_last_of('/');
+    if (slash == string::npos)
+        return ".";
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+} // namespace
+
+void CheckpointStats::describe(ostream &out) {
+    out << "checkpoints: " << n_checkpoints << " of " << bytes / (1 << 20)
+        << " MiB, snapshot: " << snapshot_time << "s (last " << last_snapshot_time
+        << "s), write: " << write_time << "s (last " << last_write_time
+        << "s), waited for writes: " << wait_time << "s" << endl;
+}
+
+template <typename F>
+Checkpointer<F>::Checkpointer(Network<F> &network_, Optimizer<F> *optimizer_)
+    : network(network_), optimizer(optimizer_) {
+    network.finish();
+    writer = thread(&Checkpointer<F>::work, this);
+}
+
+template <typename F> Checkpointer<F>::~Checkpointer() {
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    changed.notify_all();
+    writer.join();
+    if (staging)
+        cudaFreeHost(staging);
+}
+
+template <typename F> void Checkpointer<F>::wait(unique_lock<std::mutex> &lock) {
+    changed.wait(lock, [this] { return !pending; });
+    if (error) {
+        auto e = error;
+        error = nullptr;
+        rethrow_exception(e);
+    }
+}
+
+template <typename F> void Checkpointer<F>::wait() {
+    unique_lock<std::mutex> lock(mutex);
+    wait(lock);
+}
+
+template <typename F> void Checkpointer<F>::save(string path_, uint64_t step_) {
+    ProfileScope scope("checkpoint", [] { return string("Checkpointer::save"); });
+    unique_lock<std::mutex> lock(mutex);
+    Timer timer;
+    wait(lock);
+    stats.wait_time += timer.since();
+
+    timer.start();
+    vector<CudaVec<F> *> buffers{&network.param_vec};
+    if (optimizer)
+        for (auto buffer : optimizer->state())
+            buffers.push_back(buffer);
+    sizes.clear();
+    size_t total(0);
+    for (auto buffer : buffers) {
+        sizes.push_back(buffer->N);
+        total += buffer->N;
+    }
+    if (total > staging_size) {
+        if (staging)
+            handle_error(cudaFreeHost(staging));
+        staging = nullptr;
+        handle_error(cudaMallocHost(reinterpret_cast<void **>(&staging), total * sizeof(F)));
+        staging_size = total;
+    }
+
+    // pinned memory lets the copies run at full bus speed
+    F *ptr = staging;
+    for (auto buffer : buffers) {
+        handle_error(cudaMemcpyAsync(ptr, buffer->data, buffer->N * sizeof(F),
+                                     cudaMemcpyDeviceToHost, Handler::stream()));
+        ptr += buffer->N;
+    }
+    Handler::sync_stream();
+    stats.last_snapshot_time = timer.since();
+    stats.snapshot_time += stats.last_snapshot_time;
+    stats.bytes = total * sizeof(F);
+
+    path = path_;
+    step = step_;
+    pending = true;
+    lock.unlock();
+    changed.notify_all();
+}
+
+template <typename F> void Checkpointer<F>::work() {
+    unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [this] { return pending || stop; });
+        if (!pending)
+            break;
+        // save waits for pending to clear, so the staging buffer is ours while unlocked
+        lock.unlock();
+        exception_ptr failure;
+        Timer timer;
+        try {
+            write();
+        } catch (...) {
+            failure = current_exception();
+        }
+        double elapsed = timer.since();
+        lock.lock();
+        stats.last_write_time = elapsed;
+        stats.write_time += elapsed;
+        if (failure)
+            error = failure;
+        else
+            ++stats.n_checkpoints;
+        pending = false;
+        changed.notify_all();
+    }
+}
+
+template <typename F> void Checkpointer<F>::write() {
+    string tmp = path + ".tmp";
+    {
+        ofstream out(tmp, ios::binary | ios::trunc);
+        if (!out)
+            throw std::runtime_error("Checkpointer: couldn't open " + tmp);
+        cereal::PortableBinaryOutputArchive ar(out);
+        ar(CHECKPOINT_MAGIC, CHECKPOINT_VERSION, uint32_t(sizeof(F)), step, sizes);
+        size_t total(0);
+        for (auto size : sizes)
+            total += size;
+        ar(cereal::binary_data(staging, total * sizeof(F)));
+        out.flush();
+        if (!out)
+            throw std::runtime_error("Checkpointer: writing " + tmp + " failed");
+    }
+    sync_file(tmp);
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+        throw std::runtime_error("Checkpointer: couldn't rename " + tmp + " to " + path + ": " +
+                                 strerror(errno));
+    sync_file(directory_of(path));
+}
+
+template <typename F>
+uint64_t Checkpointer<F>::load(string path, Network<F> &network, Optimizer<F> *optimizer) {
+    ifstream in(path, ios::binary);
+    if (!in)
+        throw std::runtime_error("Checkpointer: couldn't open " + path);
+    cereal::PortableBinaryInputArchive ar(in);
+    string magic;
+    int version(0);
+    uint32_t float_size(0);
+    uint64_t step(0);
+    vector<size_t> sizes;
+    ar(magic, version, float_size, step, sizes);
+    if (magic != CHECKPOINT_MAGIC || version != CHECKPOINT_VERSION)
+        throw std::runtime_error("Checkpointer: " + path + " is not a checkpoint");
+    if (float_size != sizeof(F))
+        throw DexeException("Checkpointer: checkpoint has another float size:", float_size);
+
+    network.finish();
+    vector<CudaVec<F> *> buffers{&network.param_vec};
+    if (optimizer)
+        for (auto buffer : optimizer->state())
+            buffers.push_back(buffer);
+    if (buffers.size() > sizes.size())
+        throw DexeException("Checkpointer: checkpoint holds no optimizer state, buffers:",
+                            sizes.size());
+    for (size_t i(0); i < buffers.size(); ++i)
+        if (size_t(buffers[i]->N) != sizes[i])
+            throw DexeException("Checkpointer: size of buffer doesn't match:", sizes[i]);
+
+    for (auto buffer : buffers) {
+        vector<F> data(buffer->N);
+        ar(cereal::binary_data(data.data(), data.size() * sizeof(F)));
+        buffer->from_vector(data);
+    }
+    network.touch_parameters();
+    return step;
+}
+
+template struct Checkpointer<float>;
+template struct Checkpointer<double>;
+
+} // namespace dexe
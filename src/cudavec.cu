@@ -15,7 +15,7 @@ CudaVec<float> &CudaVec<float>::sqrt() {
 	dim3 dimBlock( BLOCKSIZE );
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
-	sqrt_kernel<<<dimGrid, dimBlock>>>(data, N);
+	sqrt_kernel<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, N);
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
 	return *this;
@@ -29,7 +29,7 @@ CudaVec<float> &CudaVec<float>::clip(float limit) {
 	dim3 dimBlock( BLOCKSIZE );
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
-	clip_kernel<<<dimGrid, dimBlock>>>(data, N, limit);
+	clip_kernel<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, N, limit);
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
 	return *this;
@@ -43,7 +43,7 @@ CudaVec<float> &CudaVec<float>::abs() {
 	dim3 dimBlock( BLOCKSIZE );
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
-		abs_kernel<<<dimGrid, dimBlock>>>(data, N);
+		abs_kernel<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, N);
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
 	return *this;
@@ -57,7 +57,7 @@ CudaVec<float> &CudaVec<float>::pow(float e) {
 	dim3 dimBlock( BLOCKSIZE );
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
-	pow_kernel<<<dimGrid, dimBlock>>>(data, N, e);
+	pow_kernel<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, N, e);
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
 	return *this;
@@ -71,7 +71,7 @@ CudaVec<float> &CudaVec<float>::exp() {
 	dim3 dimBlock( BLOCKSIZE );
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
-	exp_kernel<<<dimGrid, dimBlock>>>(data, N);
+	exp_kernel<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, N);
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
 	return *this;
@@ -79,7 +79,7 @@ CudaVec<float> &CudaVec<float>::exp() {
 
 template <>
 CudaVec<float> &CudaVec<float>::add(int idx, float val) {
-	add_scalar<<<1, 1>>>(data+idx, val, 1);
+	add_scalar<<<1, 1, 0, Handler::stream()>>>(data+idx, val, 1);
 		
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
@@ -94,7 +94,7 @@ CudaVec<float> &CudaVec<float>::operator+=(float v) {
 	dim3 dimBlock( BLOCKSIZE );
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
-	add_scalar<<<dimGrid, dimBlock>>>(data, v, N);
+	add_scalar<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, v, N);
 	
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
@@ -109,7 +109,7 @@ CudaVec<float> &CudaVec<float>::operator*=(CudaVec<float> &other) {
 	dim3 dimBlock( BLOCKSIZE );
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
-	times_kernel<<<dimGrid, dimBlock>>>(data, other.data, N);
+	times_kernel<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, other.data, N);
 	
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
@@ -124,7 +124,7 @@ CudaVec<float> &CudaVec<float>::operator/=(CudaVec<float> &other) {
 	dim3 dimBlock( BLOCKSIZE );
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
-	divide_kernel<<<dimGrid, dimBlock>>>(data, other.data, N);
+	divide_kernel<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, other.data, N);
 
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
@@ -152,7 +152,7 @@ CudaVec<float> &CudaVec<float>::operator*=(float v) {
 	dim3 dimBlock( BLOCKSIZE );
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
-	times_scalar<<<dimGrid, dimBlock>>>(data, v, N);
+	times_scalar<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, v, N);
 
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
@@ -167,7 +167,7 @@ CudaVec<double> &CudaVec<double>::operator*=(double v) {
 	dim3 dimBlock( BLOCKSIZE );
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
-	times_scalard<<<dimGrid, dimBlock>>>(data, v, N);
+	times_scalard<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, v, N);
 
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
@@ -189,7 +189,7 @@ CudaVec<double> &CudaVec<double>::sqrt() {
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
 	
-		sqrt_kerneld<<<dimGrid, dimBlock>>>(data, N);
+		sqrt_kerneld<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, N);
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
 	return *this;
@@ -204,7 +204,7 @@ CudaVec<double> &CudaVec<double>::clip(double limit) {
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
 	
-	clip_kerneld<<<dimGrid, dimBlock>>>(data, N, limit);
+	clip_kerneld<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, N, limit);
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
 	return *this;
@@ -219,7 +219,7 @@ CudaVec<double> &CudaVec<double>::abs() {
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
 	
-		abs_kerneld<<<dimGrid, dimBlock>>>(data, N);
+		abs_kerneld<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, N);
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
 	return *this;
@@ -234,7 +234,7 @@ CudaVec<double> &CudaVec<double>::pow(double e) {
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
 	
-	pow_kerneld<<<dimGrid, dimBlock>>>(data, N, e);
+	pow_kerneld<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, N, e);
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
 	return *this;
@@ -249,7 +249,7 @@ CudaVec<double> &CudaVec<double>::exp() {
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
 	
-		exp_kerneld<<<dimGrid, dimBlock>>>(data, N);
+		exp_kerneld<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, N);
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
 	return *this;
@@ -257,7 +257,7 @@ CudaVec<double> &CudaVec<double>::exp() {
 
 template <>
 CudaVec<double> &CudaVec<double>::add(int idx, double val) {
-	add_scalard<<<1, 1>>>(data+idx, val, 1);
+	add_scalard<<<1, 1, 0, Handler::stream()>>>(data+idx, val, 1);
 		
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
@@ -274,7 +274,7 @@ CudaVec<double> &CudaVec<double>::operator*=(CudaVec<double> &other) {
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
 	
-		times_kerneld<<<dimGrid, dimBlock>>>(data, other.data, N);
+		times_kerneld<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, other.data, N);
 	
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
@@ -290,7 +290,7 @@ CudaVec<double> &CudaVec<double>::operator/=(CudaVec<double> &other) {
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
 	
-		divide_kerneld<<<dimGrid, dimBlock>>>(data, other.data, N);
+		divide_kerneld<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, other.data, N);
 
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
@@ -307,7 +307,7 @@ CudaVec<double> &CudaVec<double>::operator+=(double v) {
 	dim3 dimBlock( BLOCKSIZE );
 	dim3 dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
-	add_scalard<<<dimGrid, dimBlock>>>(data, v, N);
+	add_scalard<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, v, N);
 	
 	handle_error( cudaGetLastError() );
 	handle_error( cudaDeviceSynchronize());
@@ -326,13 +326,15 @@ void CudaVec<F>::allocate(int newN) {
         if (N) {
             memory_counter -= N;
 
-            handle_error(cudaFree(data));
+            MemoryTracker::released(data);
+            CachingAllocator::device().release(data, sizeof(F) * N);
             data = 0;
         }
         if (newN) {
             memory_counter += newN;
 
-            handle_error(cudaMalloc((void **)&data, sizeof(F) * newN));
+            data = reinterpret_cast<F *>(CachingAllocator::device().allocate(sizeof(F) * newN));
+            MemoryTracker::allocated(data, CachingAllocator::size_class(sizeof(F) * newN));
         }
         N = newN;
     }
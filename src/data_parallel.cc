@@ -0,0 +1,112 @@
+#include "dexe/data_parallel.h"
+#include "dexe/handler.h"
+
+#include <algorithm>
+#include <exception>
+#include <future>
+
+using namespace std;
+
+namespace dexe {
+
+namespace {
+// shard boundaries are multiples of this, so no two threads touch the same cache lines
+int const SHARD_ALIGNMENT = 256;
+} // namespace
+
+template <typename F>
+DataParallel<F>::DataParallel(Network<F> &network_, Optimizer<F> &optimizer_, int loss_,
+                              int n_replicas)
+    : network(network_), optimizer(optimizer_), loss(loss_) {
+    if (n_replicas < 1)
+        throw DexeException("DataParallel needs at least one replica, got:", n_replicas);
+    network.finish();
+    copies = network.replicate(n_replicas - 1, true); // every replica sums its own gradients
+    replicas.push_back(&network);
+    for (auto &copy : copies)
+        replicas.push_back(copy.get());
+
+    int N = network.param_vec.N;
+    int chunk = (N + n_replicas - 1) / n_replicas;
+    chunk = (chunk + SHARD_ALIGNMENT - 1) / SHARD_ALIGNMENT * SHARD_ALIGNMENT;
+    for (int r(0); r < n_replicas; ++r)
+        shards.emplace_back(min(N, r * chunk), min(N, (r + 1) * chunk));
+
+    pool = make_unique<ThreadPool>(n_replicas);
+}
+
+template <typename F> DataParallel<F>::~DataParallel() {}
+
+// Runs task(r) for every replica on the pool and waits for all of them
+template <typename F> void DataParallel<F>::run(function<void(int)> task) {
+    // the replicas run on other streams, earlier work of this thread has to be done
+    Handler::sync_stream();
+    vector<future<void>> done;
+    for (int r(0); r < size(); ++r) {
+        auto job = make_shared<packaged_task<void()>>([&task, r] {
+            task(r);
+            Handler::sync_stream();
+        });
+        done.push_back(job->get_future());
+        pool->submit([job] { (*job)(); });
+    }
+    // every replica has to finish before rethrowing, the tasks reference the caller's locals
+    exception_ptr error;
+    for (auto &d : done)
+        try {
+            d.get();
+        } catch (...) {
+            if (!error)
+                error = current_exception();
+        }
+    if (error)
+        rethrow_exception(error);
+}
+
+template <typename F> F DataParallel<F>::step(vector<vector<Tensor<F> *>> const &batches) {
+    if (batches.size() != replicas.size())
+        throw DexeException("DataParallel::step: expected one batch per replica, got:",
+                            batches.size());
+
+    vector<F> losses(size());
+    run([&](int r) {
+        auto &replica = *replicas[r];
+        auto &inputs = batches[r];
+        if (inputs.size() != replica.inputs.size())
+            throw DexeException("DataParallel::step: expected one tensor per input, got:",
+                                inputs.size());
+        for (size_t i(0); i < inputs.size(); ++i)
+            replica.load_input(replica.inputs[i], *inputs[i]);
+        replica.forward(replica.inputs, loss);
+        replica.zero_grad();
+        replica.backward();
+        losses[r] = replica.tensors[loss].x->to_vector()[0];
+    });
+
+    // every thread owns a shard: sums it over the replicas and updates it, averaging in the update
+    F grad_scale = optimizer.grad_scale;
+    optimizer.grad_scale = grad_scale / size();
+    run([&](int r) {
+        int begin = shards[r].first, end = shards[r].second;
+        if (begin == end)
+            return;
+        F *sum = network.grad_vec.data + begin;
+        for (size_t other(1); other < replicas.size(); ++other)
+            add_cuda<F>(replicas[other]->grad_vec.data + begin, sum, end - begin, 1);
+        optimizer.update(begin, end);
+    });
+    optimizer.grad_scale = grad_scale;
+
+    for (auto replica : replicas)
+        replica->touch_parameters();
+
+    F total(0);
+    for (auto l : losses)
+        total += l;
+    return total / size();
+}
+
+template struct DataParallel<float>;
+template struct DataParallel<double>;
+
+} // namespace dexe
@@ -1,11 +1,14 @@
 #include "dexe/handler.h"
+#include "dexe/memory.h"
 #include "dexe/util.h"
 
 using namespace std;
 
 namespace dexe {
 
-Handler *Handler::s_handler = 0;
+thread_local Handler *Handler::s_handler = 0;
+atomic<size_t> Handler::s_workspace_size(WORKSPACE_SIZE);
+atomic<unsigned long long> Handler::s_n_handlers(0);
 
 Handler::Handler() : h_cudnn(0), h_cublas(0), h_curand(0), s_workspace(0) {}
 
@@ -18,8 +21,15 @@ void Handler::init() {
     handle_error(cudnnCreate(&h_cudnn));
 
     handle_error(curandCreateGenerator(&h_curand, CURAND_RNG_PSEUDO_DEFAULT));
-    handle_error(curandSetPseudoRandomGeneratorSeed(h_curand, 13131ULL));
+    // every thread draws its own numbers, the first handler keeps the old seed
+    handle_error(curandSetPseudoRandomGeneratorSeed(h_curand, 13131ULL + s_n_handlers++));
     handle_error(cublasCreate(&h_cublas));
+
+    // non-blocking, so threads don't serialise on the default stream
+    handle_error(cudaStreamCreateWithFlags(&h_stream, cudaStreamNonBlocking));
+    handle_error(cudnnSetStream(h_cudnn, h_stream));
+    handle_error(cublasSetStream(h_cublas, h_stream));
+    handle_error(curandSetStream(h_curand, h_stream));
 }
 
 void Handler::deinit() {
@@ -29,7 +39,6 @@ void Handler::deinit() {
     clear_workspace();
     
     if (s_handler->h_cudnn) {
-        cerr << "Destroying Cudnn" << endl;
         handle_error(cudnnDestroy(s_handler->h_cudnn));
         s_handler->h_cudnn = 0;
     }
@@ -41,6 +50,10 @@ void Handler::deinit() {
         cublasDestroy(s_handler->h_cublas);
         s_handler->h_cublas = 0;
     }
+    if (s_handler->h_stream) {
+        handle_error(cudaStreamDestroy(s_handler->h_stream));
+        s_handler->h_stream = 0;
+    }
 
     if (s_handler->one_float_) {
         handle_error( cudaFree(s_handler->one_float_) );
@@ -90,13 +103,17 @@ cublasHandle_t &Handler::cublas() {
     return get_handler().h_cublas;
 }
 
+cudaStream_t Handler::stream() {
+    return get_handler().h_stream;
+}
+
 float *Handler::one_float() {
     auto &h = get_handler();
     if (!h.one_float_)
         cudaMalloc((void **)&h.one_float_, sizeof(float));
 
     float one(1);
-    handle_error( cudaMemcpy(h.one_float_, &one, sizeof(float), cudaMemcpyHostToDevice) );
+    copy_cpu_to_gpu(&one, h.one_float_, 1);
     return h.one_float_;
 }
 
@@ -106,36 +123,45 @@ double *Handler::one_double() {
         cudaMalloc((void **)&h.one_double_, sizeof(double));
 
     double one(1);
-    handle_error( cudaMemcpy(h.one_double_, &one, sizeof(double), cudaMemcpyHostToDevice) );
+    copy_cpu_to_gpu(&one, h.one_double_, 1);
     return h.one_double_;
 }
 
 
 
-char *Handler::workspace() {
+char *Handler::workspace(size_t size) {
     auto &h = get_handler();
-    if (!h.s_workspace) {
-        handle_error(cudaMalloc((void **)&h.s_workspace, h.workspace_size_));
+    // grows to the largest workspace the algorithms of this thread chose,
+    // and drops it when another thread lowered the limit below it
+    if (h.workspace_size_ < size || h.workspace_size_ > max(size, s_workspace_size.load()))
+        clear_workspace();
+    if (!h.s_workspace && size) {
+        MemoryTag tag("workspace");
+        handle_error(cudaMalloc((void **)&h.s_workspace, size));
+        MemoryTracker::allocated(h.s_workspace, size);
+        h.workspace_size_ = size;
     }
 
     return h.s_workspace;
 }
 
 size_t Handler::workspace_size() {
-    return get_handler().workspace_size_;
+    return s_workspace_size;
 }
 
 void Handler::set_workspace_size(size_t workspace_size) {
+    s_workspace_size = workspace_size;
     clear_workspace();
-    get_handler().workspace_size_ = workspace_size;
 }
 
 void Handler::clear_workspace() {
     auto &h = get_handler();
-    if (h.workspace) {
+    if (h.s_workspace) {
+        MemoryTracker::released(h.s_workspace);
         handle_error(cudaFree(h.s_workspace));
         h.s_workspace = nullptr;
     }
+    h.workspace_size_ = 0;
 }
 
 void Handler::print_mem_info() {
@@ -149,4 +175,8 @@ void Handler::sync() {
     handle_error( cudaDeviceSynchronize() );
 }
 
+void Handler::sync_stream() {
+    handle_error( cudaStreamSynchronize(stream()) );
+}
+
 } // namespace dexe
@@ -40,7 +40,8 @@ void split(Tensor<float> &a, Tensor<float> &out) {
 	size_t dimGrid( (s + BLOCKSIZE - 1) / BLOCKSIZE );
 
     auto shape = a.shape;
-    split_kernelf<<<dimGrid, dimBlock>>>(s, shape.c(), shape.w(), shape.h(), a.ptr(), out.ptr());
+    split_kernelf<<<dimGrid, dimBlock, 0, Handler::stream()>>>(s, shape.c(), shape.w(), shape.h(), a.ptr(), out.ptr());
+    out.touch();
 }
 
 void split(Tensor<double> &a, Tensor<double> &out) {
@@ -51,7 +52,8 @@ void split(Tensor<double> &a, Tensor<double> &out) {
 	size_t dimGrid( (s + BLOCKSIZE - 1) / BLOCKSIZE );
 
     auto shape = a.shape;
-    split_kerneld<<<dimGrid, dimBlock>>>(s, shape.c(), shape.w(), shape.h(), a.ptr(), out.ptr());
+    split_kerneld<<<dimGrid, dimBlock, 0, Handler::stream()>>>(s, shape.c(), shape.w(), shape.h(), a.ptr(), out.ptr());
+    out.touch();
 }
 
 __global__ void merge_kernelf(size_t const N, size_t const C, size_t const X, size_t const Y, float const *input, float *out) {
@@ -90,7 +92,8 @@ void merge(Tensor<float> &a, Tensor<float> &out) {
 	size_t dimGrid( (s + BLOCKSIZE - 1) / BLOCKSIZE );
 
     auto shape = a.shape;
-    merge_kernelf<<<dimGrid, dimBlock>>>(s, shape.c(), shape.w(), shape.h(), a.ptr(), out.ptr());
+    merge_kernelf<<<dimGrid, dimBlock, 0, Handler::stream()>>>(s, shape.c(), shape.w(), shape.h(), a.ptr(), out.ptr());
+    out.touch();
 }
 
 
@@ -102,7 +105,8 @@ void merge(Tensor<double> &a, Tensor<double> &out) {
 	size_t dimGrid( (s + BLOCKSIZE - 1) / BLOCKSIZE );
 
     auto shape = a.shape;
-    merge_kerneld<<<dimGrid, dimBlock>>>(s, shape.c(), shape.w(), shape.h(), a.ptr(), out.ptr());
+    merge_kerneld<<<dimGrid, dimBlock, 0, Handler::stream()>>>(s, shape.c(), shape.w(), shape.h(), a.ptr(), out.ptr());
+    out.touch();
 }
 
 __global__ void gate_kerneld(size_t N, double const *a, double const *b, double *out) {
@@ -128,7 +132,8 @@ void gate<double>(Tensor<double> &a, Tensor<double> &b, Tensor<double> &out) {
 	size_t dimBlock( BLOCKSIZE );
 	size_t dimGrid( (s + BLOCKSIZE - 1) / BLOCKSIZE );
 
-	gate_kerneld<<<dimGrid, dimBlock>>>(s, a.ptr(), b.ptr(), out.ptr());
+	gate_kerneld<<<dimGrid, dimBlock, 0, Handler::stream()>>>(s, a.ptr(), b.ptr(), out.ptr());
+	out.touch();
 }
 
 template <>
@@ -139,7 +144,8 @@ void gate<float>(Tensor<float> &a, Tensor<float> &b, Tensor<float> &out) {
 	size_t dimBlock( BLOCKSIZE );
 	size_t dimGrid( (s  + BLOCKSIZE - 1) / BLOCKSIZE);
 
-	gate_kernelf<<<dimGrid, dimBlock>>>(s, a.ptr(), b.ptr(), out.ptr());
+	gate_kernelf<<<dimGrid, dimBlock, 0, Handler::stream()>>>(s, a.ptr(), b.ptr(), out.ptr());
+	out.touch();
 }
 
 
@@ -166,7 +172,8 @@ void gateinv<double>(Tensor<double> &a, Tensor<double> &b, Tensor<double> &out)
 	size_t dimBlock( BLOCKSIZE );
 	size_t dimGrid( (s + BLOCKSIZE - 1) / BLOCKSIZE );
 
-	gate_kerneld<<<dimGrid, dimBlock>>>(s, a.ptr(), b.ptr(), out.ptr());
+	gate_kerneld<<<dimGrid, dimBlock, 0, Handler::stream()>>>(s, a.ptr(), b.ptr(), out.ptr());
+	out.touch();
 }
 
 template <>
@@ -177,7 +184,8 @@ void gateinv<float>(Tensor<float> &a, Tensor<float> &b, Tensor<float> &out) {
 	size_t dimBlock( BLOCKSIZE );
 	size_t dimGrid( (s  + BLOCKSIZE - 1) / BLOCKSIZE);
 
-	gate_kernelf<<<dimGrid, dimBlock>>>(s, a.ptr(), b.ptr(), out.ptr());
+	gate_kernelf<<<dimGrid, dimBlock, 0, Handler::stream()>>>(s, a.ptr(), b.ptr(), out.ptr());
+	out.touch();
 }
 
 
@@ -205,7 +213,7 @@ void range<float>(float *a, size_t N, float const min, float const max) {
 	size_t dimBlock( BLOCKSIZE );
 	size_t dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
-	range_kernelf<<<dimGrid, dimBlock>>>(a, N, min, max);
+	range_kernelf<<<dimGrid, dimBlock, 0, Handler::stream()>>>(a, N, min, max);
 }
 
 template <>
@@ -215,7 +223,7 @@ void range<double>(double *a, size_t N, double const min, double const max) {
 	size_t dimBlock( BLOCKSIZE );
 	size_t dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE );
 
-	range_kerneld<<<dimGrid, dimBlock>>>(a, N, min, max);
+	range_kerneld<<<dimGrid, dimBlock, 0, Handler::stream()>>>(a, N, min, max);
 }
 
 
@@ -247,7 +255,7 @@ void tanh_forward<float>(float *in, float *out, size_t n, float beta, float scal
 	size_t dimBlock( BLOCKSIZE );
 	size_t dimGrid( (n  + BLOCKSIZE - 1) / BLOCKSIZE);
 
-	tanh_forward_kernelf<<<dimGrid, dimBlock>>>(in, out, n, beta, scale);
+	tanh_forward_kernelf<<<dimGrid, dimBlock, 0, Handler::stream()>>>(in, out, n, beta, scale);
 }
 
 template <>
@@ -257,7 +265,7 @@ void tanh_forward<double>(double *in, double *out, size_t n, double beta, double
 	size_t dimBlock( BLOCKSIZE );
 	size_t dimGrid( (n  + BLOCKSIZE - 1) / BLOCKSIZE);
 
-	tanh_forward_kerneld<<<dimGrid, dimBlock>>>(in, out, n, beta, scale);
+	tanh_forward_kerneld<<<dimGrid, dimBlock, 0, Handler::stream()>>>(in, out, n, beta, scale);
 }
 
 ///TANH DERIV
@@ -285,7 +293,7 @@ void tanh_deriv<float>(float *out_err, float *act, float *in_err, size_t n, floa
 	size_t dimBlock( BLOCKSIZE );
 	size_t dimGrid( (n  + BLOCKSIZE - 1) / BLOCKSIZE);
 
-	tanh_deriv_kernelf<<<dimGrid, dimBlock>>>(out_err, act, in_err, n, beta, scale);
+	tanh_deriv_kernelf<<<dimGrid, dimBlock, 0, Handler::stream()>>>(out_err, act, in_err, n, beta, scale);
 }
 
 template <>
@@ -295,7 +303,7 @@ void tanh_deriv<double>(double *out_err, double *act, double *in_err, size_t n,
 	size_t dimBlock( BLOCKSIZE );
 	size_t dimGrid( (n  + BLOCKSIZE - 1) / BLOCKSIZE);
 
-	tanh_deriv_kerneld<<<dimGrid, dimBlock>>>(out_err, act, in_err, n, beta, scale);
+	tanh_deriv_kerneld<<<dimGrid, dimBlock, 0, Handler::stream()>>>(out_err, act, in_err, n, beta, scale);
 }
 
 //SIGMOID FORWARD
@@ -324,7 +332,7 @@ void sigm_forward<float>(float *in, float *out, size_t n, float beta, float scal
 	size_t dimBlock( BLOCKSIZE );
 	size_t dimGrid( (n  + BLOCKSIZE - 1) / BLOCKSIZE);
 
-	sigm_forward_kernelf<<<dimGrid, dimBlock>>>(in, out, n, beta, scale);
+	sigm_forward_kernelf<<<dimGrid, dimBlock, 0, Handler::stream()>>>(in, out, n, beta, scale);
 }
 
 template <>
@@ -334,7 +342,7 @@ void sigm_forward<double>(double *in, double *out, size_t n, double beta, double
 	size_t dimBlock( BLOCKSIZE );
 	size_t dimGrid( (n  + BLOCKSIZE - 1) / BLOCKSIZE);
 
-	sigm_forward_kerneld<<<dimGrid, dimBlock>>>(in, out, n, beta, scale);
+	sigm_forward_kerneld<<<dimGrid, dimBlock, 0, Handler::stream()>>>(in, out, n, beta, scale);
 }
 
 
@@ -363,7 +371,7 @@ void sigm_deriv<float>(float *out_err, float *act, float *in_err, size_t n, floa
 	size_t dimBlock( BLOCKSIZE );
 	size_t dimGrid( (n  + BLOCKSIZE - 1) / BLOCKSIZE);
 
-	sigm_deriv_kernelf<<<dimGrid, dimBlock>>>(out_err, act, in_err, n, beta, scale);
+	sigm_deriv_kernelf<<<dimGrid, dimBlock, 0, Handler::stream()>>>(out_err, act, in_err, n, beta, scale);
 }
 
 template <>
@@ -373,7 +381,7 @@ void sigm_deriv<double>(double *out_err, double *act, double *in_err, size_t n,
 	size_t dimBlock( BLOCKSIZE );
 	size_t dimGrid( (n  + BLOCKSIZE - 1) / BLOCKSIZE);
 
-	sigm_deriv_kerneld<<<dimGrid, dimBlock>>>(out_err, act, in_err, n, beta, scale);
+	sigm_deriv_kerneld<<<dimGrid, dimBlock, 0, Handler::stream()>>>(out_err, act, in_err, n, beta, scale);
 }
 
 template <typename F>
@@ -404,7 +412,7 @@ void support_loss(F *input, F *target, F *loss, size_t N, F support) {
 	size_t dimBlock( BLOCKSIZE );
 	size_t dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE);
 
-	support_kernel<<<dimGrid, dimBlock>>>(input, target, loss, N, support);
+	support_kernel<<<dimGrid, dimBlock, 0, Handler::stream()>>>(input, target, loss, N, support);
 }
 
 /// In-place threshold kernel
@@ -428,10 +436,78 @@ void threshold_cuda(F *input, size_t N, F threshold) {
 	size_t dimBlock( BLOCKSIZE );
 	size_t dimGrid( (N  + BLOCKSIZE - 1) / BLOCKSIZE);
 
-	threshold_kernel<<<dimGrid, dimBlock>>>(input, N, threshold);
+	threshold_kernel<<<dimGrid, dimBlock, 0, Handler::stream()>>>(input, N, threshold);
 }
 
+template <typename F>
+__global__ void add_relu_kernel(F const *in, F *out, size_t N) {
+	size_t i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i >= N)
+		return;
+
+	out[i] = device_max(F(0.0), out[i] + in[i]);
+}
+
+template <typename F>
+void add_relu_cuda(F const *in, F *out, size_t N) {
+	size_t const BLOCKSIZE(1024);
+
+	size_t dimBlock( BLOCKSIZE );
+	size_t dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE);
+
+	add_relu_kernel<<<dimGrid, dimBlock, 0, Handler::stream()>>>(in, out, N);
+}
 
+template <typename F>
+__global__ void relu_mask_kernel(F const *act, F *grad, size_t N) {
+	size_t i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i >= N)
+		return;
+
+	if (act[i] <= 0)
+		grad[i] = 0.0;
+}
+
+template <typename F>
+void relu_mask_cuda(F const *act, F *grad, size_t N) {
+	size_t const BLOCKSIZE(1024);
+
+	size_t dimBlock( BLOCKSIZE );
+	size_t dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE);
+
+	relu_mask_kernel<<<dimGrid, dimBlock, 0, Handler::stream()>>>(act, grad, N);
+}
+
+
+
+
+
+template <typename F>
+__global__ void blend_window_kernel(F const *window, F const *weights, F *volume, Window3D w) {
+	size_t voxels = size_t(w.size[0]) * w.size[1] * w.size[2];
+	size_t i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i >= voxels)
+		return;
+
+	size_t x = i % w.size[2], y = (i / w.size[2]) % w.size[1], z = i / w.size[2] / w.size[1];
+	size_t period = size_t(w.dims[0]) * w.dims[1] * w.dims[2];
+	size_t v = ((z + w.origin[0]) * w.dims[1] + y + w.origin[1]) * w.dims[2] + x + w.origin[2];
+
+	F weight = weights[w.rows[0] + z] * weights[w.rows[1] + y] * weights[w.rows[2] + x];
+	for (size_t c(0); c < w.c; ++c)
+		volume[c * period + v] += weight * window[c * voxels + i];
+}
+
+template <typename F>
+void blend_window_cuda(F const *window, F const *weights, F *volume, Window3D w) {
+	size_t N = size_t(w.size[0]) * w.size[1] * w.size[2];
+	size_t const BLOCKSIZE(1024);
+
+	size_t dimBlock( BLOCKSIZE );
+	size_t dimGrid( (N + BLOCKSIZE - 1) / BLOCKSIZE);
+
+	blend_window_kernel<<<dimGrid, dimBlock, 0, Handler::stream()>>>(window, weights, volume, w);
+}
 
 
 template void support_loss<float>(float *input, float *target, float *loss, size_t N, float support);
@@ -441,4 +517,14 @@ template void support_loss<double>(double *input, double *target, double *loss,
 template void threshold_cuda<float>(float *input, size_t N, float threshold);
 template void threshold_cuda<double>(double *input, size_t N, double threshold);
 
+
+template void add_relu_cuda<float>(float const *in, float *out, size_t N);
+template void add_relu_cuda<double>(double const *in, double *out, size_t N);
+
+template void relu_mask_cuda<float>(float const *act, float *grad, size_t N);
+template void relu_mask_cuda<double>(double const *act, double *grad, size_t N);
+
+template void blend_window_cuda<float>(float const *window, float const *weights, float *volume, Window3D w);
+template void blend_window_cuda<double>(double const *window, double const *weights, double *volume, Window3D w);
+
 }
\ No newline at end of file
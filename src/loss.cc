@@ -15,6 +15,12 @@ void Loss<F>::calculate_loss(Tensor<F> &in, int answer, Tensor<F> &err) {
     calculate_loss(in, answers, err);
 }
 
+template <typename F>
+void Loss<F>::calculate_loss(Tensor<F> &in, TensorView<F> const &target, Tensor<F> &err) {
+    auto dense = target.contiguous();
+    calculate_loss(in, *dense, err);
+}
+
 template <typename F> F Loss<F>::loss() { return this->last_loss; }
 
 template <typename F> int Loss<F>::n_correct() { return last_correct; }
@@ -75,6 +81,13 @@ void SoftmaxLoss<F>::calculate_average_loss(Tensor<F> &in, Tensor<F> &err) {
 template <typename F>
 void SoftmaxLoss<F>::calculate_loss(Tensor<F> &in, Tensor<F> &target,
                                     Tensor<F> &err) {
+    calculate_loss(in, target.view(), err);
+}
+
+// The strided copy into err is the only read of target
+template <typename F>
+void SoftmaxLoss<F>::calculate_loss(Tensor<F> &in, TensorView<F> const &target,
+                                    Tensor<F> &err) {
     assert(in.size() == target.size());
     this->last_loss = 0;
     // Loss<F>::last_loss = 0;
@@ -0,0 +1,180 @@
+#include "dexe/memory.h"
+#include "dexe/profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace std;
+
+namespace dexe {
+
+namespace {
+struct Live {
+    string owner;
+    char const *phase;
+    size_t bytes;
+};
+
+atomic<bool> active(false);
+atomic<size_t> n_live(0); // lets released skip the lock when nothing is tracked
+mutex tracker_mutex;
+unordered_map<void const *, Live> live;
+map<string, MemoryUsage> by_owner;
+map<string, MemoryUsage> by_phase;
+vector<MemoryEvent> events;
+size_t total(0), high_water(0);
+
+thread_local string current_owner = "user";
+thread_local char const *current_phase = "other";
+
+MemoryUsage &usage(map<string, MemoryUsage> &usages, string const &name) {
+    auto &u = usages[name];
+    u.name = name;
+    return u;
+}
+
+vector<MemoryUsage> sorted(map<string, MemoryUsage> const &usages) {
+    vector<MemoryUsage> result;
+    for (auto &u : usages)
+        result.push_back(u.second);
+    sort(result.begin(), result.end(),
+         [](MemoryUsage const &a, MemoryUsage const &b) { return a.peak > b.peak; });
+    return result;
+}
+} // namespace
+
+void MemoryTracker::enable() { active = true; }
+
+void MemoryTracker::disable() { active = false; }
+
+bool MemoryTracker::enabled() { return active.load(memory_order_relaxed); }
+
+void MemoryTracker::reset() {
+    lock_guard<mutex> lock(tracker_mutex);
+    live.clear();
+    n_live = 0;
+    by_owner.clear();
+    by_phase.clear();
+    events.clear();
+    total = high_water = 0;
+}
+
+void MemoryTracker::allocated(void const *ptr, size_t bytes) {
+    if (!enabled() || !ptr)
+        return;
+    auto time = Profiler::timestamp(Profiler::Clock::now());
+
+    lock_guard<mutex> lock(tracker_mutex);
+    live[ptr] = Live{current_owner, current_phase, bytes};
+    n_live = live.size();
+    total += bytes;
+    high_water = max(high_water, total);
+
+    auto &owner = usage(by_owner, current_owner);
+    owner.current += bytes;
+    owner.peak = max(owner.peak, owner.current);
+    ++owner.allocations;
+    auto &phase = usage(by_phase, current_phase);
+    phase.current += bytes;
+    phase.peak = max(phase.peak, total);
+    ++phase.allocations;
+
+    events.push_back(MemoryEvent{time, current_owner, current_phase,
+                                 static_cast<long long>(bytes), total});
+}
+
+void MemoryTracker::released(void const *ptr) {
+    if (!ptr || !n_live)
+        return;
+    auto time = Profiler::timestamp(Profiler::Clock::now());
+
+    lock_guard<mutex> lock(tracker_mutex);
+    // allocations from before enable or after reset aren't known
+    auto it = live.find(ptr);
+    if (it == live.end())
+        return;
+    auto bytes = it->second.bytes;
+    total -= bytes;
+    usage(by_owner, it->second.owner).current -= bytes;
+    usage(by_phase, it->second.phase).current -= bytes;
+    events.push_back(MemoryEvent{time, it->second.owner, current_phase,
+                                 -static_cast<long long>(bytes), total});
+    live.erase(it);
+    n_live = live.size();
+}
+
+string MemoryTracker::set_owner(string owner) {
+    swap(owner, current_owner);
+    return owner;
+}
+
+char const *MemoryTracker::set_phase(char const *phase) {
+    swap(phase, current_phase);
+    return phase;
+}
+
+size_t MemoryTracker::current() {
+    lock_guard<mutex> lock(tracker_mutex);
+    return total;
+}
+
+size_t MemoryTracker::peak() {
+    lock_guard<mutex> lock(tracker_mutex);
+    return high_water;
+}
+
+vector<MemoryUsage> MemoryTracker::owners() {
+    lock_guard<mutex> lock(tracker_mutex);
+    return sorted(by_owner);
+}
+
+vector<MemoryUsage> MemoryTracker::phases() {
+    lock_guard<mutex> lock(tracker_mutex);
+    return sorted(by_phase);
+}
+
+vector<MemoryEvent> MemoryTracker::timeline() {
+    lock_guard<mutex> lock(tracker_mutex);
+    return events;
+}
+
+void MemoryTracker::summary(ostream &out) {
+    auto flags = out.flags();
+    out << fixed << setprecision(2);
+    out << "tracked device memory current: " << current() / 1e6 << " MB peak: " << peak() / 1e6
+        << " MB" << endl;
+
+    auto table = [&out](char const *title, vector<MemoryUsage> const &usages) {
+        out << left << setw(48) << title << right << setw(14) << "current MB" << setw(12)
+            << "peak MB" << setw(10) << "allocs" << endl;
+        for (auto &u : usages)
+            out << left << setw(48) << u.name.substr(0, 47) << right << setw(14)
+                << u.current / 1e6 << setw(12) << u.peak / 1e6 << setw(10) << u.allocations
+                << endl;
+    };
+    table("owner", owners());
+    table("phase", phases());
+    out.flags(flags);
+}
+
+void MemoryTracker::write_timeline(string path) {
+    ofstream out(path);
+    if (!out)
+        throw std::runtime_error("Couldn't open timeline file " + path);
+    out << "time_us,phase,owner,delta_bytes,total_bytes" << endl;
+    out << fixed << setprecision(3);
+    for (auto &e : timeline()) {
+        string owner = e.owner;
+        replace(owner.begin(), owner.end(), ',', ' ');
+        out << e.time << "," << e.phase << "," << owner << "," << e.delta << "," << e.total
+            << endl;
+    }
+}
+
+} // namespace dexe
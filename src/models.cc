@@ -24,8 +24,9 @@ function<Node<F>(Node<F>)> basic_layer(int c, int c_out, int k) {
 }
 
 template <typename F>
-Node<F> make_unet(Network<F> *network, int in_channels, int out_channels, bool local_normalization) {
-    int c = 2;
+Node<F> make_unet(Network<F> *network, int in_channels, int out_channels, bool local_normalization,
+                  int base_channels) {
+    int c = base_channels;
     int k = 3;
     int norm_k = 5;
 
@@ -64,8 +65,8 @@ Node<F> make_unet(Network<F> *network, int in_channels, int out_channels, bool l
 }
 
 template Node<float> make_unet(Network<float> *network, int in_channels,
-                               int out_channels, bool local_normalization);
+                               int out_channels, bool local_normalization, int base_channels);
 template Node<double> make_unet(Network<double> *network, int in_channels,
-                                int out_channels, bool local_normalization);
+                                int out_channels, bool local_normalization, int base_channels);
 
 } // namespace dexe
@@ -1,5 +1,8 @@
 #include "dexe/network.h"
+#include "dexe/handler.h"
+#include "dexe/kernels.h"
 #include "dexe/operations.h"
+#include "dexe/profiler.h"
 #include "dexe/util.h"
 
 #include "cereal/archives/portable_binary.hpp"
@@ -8,11 +11,18 @@
 #include "cereal/types/vector.hpp"
 
 #include <algorithm>
+#include <cmath>
 #include <fstream>
+#include <future>
+#include <iomanip>
 #include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <sstream>
 #include <stack>
+#include <tuple>
 #include <vector>
 
 using namespace std;
@@ -29,6 +39,19 @@ template <typename F> TensorSet<F> &Node<F>::tensor_set() {
 
 template <typename F>
 void Node<F>::operator()(
+    std::initializer_list<std::reference_wrapper<Tensor<F>>> input_tensors) {
+    load_inputs(input_tensors);
+    network->forward(network->inputs, index);
+}
+
+template <typename F>
+void Node<F>::infer(std::initializer_list<std::reference_wrapper<Tensor<F>>> input_tensors) {
+    load_inputs(input_tensors);
+    network->infer(network->inputs, index);
+}
+
+template <typename F>
+void Node<F>::load_inputs(
     std::initializer_list<std::reference_wrapper<Tensor<F>>> input_tensors) {
     if (input_tensors.size() != network->inputs.size()) {
         cerr << "Warning: Number of inputs doesn't correspond";
@@ -36,21 +59,25 @@ void Node<F>::operator()(
 
     auto input_it = network->inputs.begin();
 
-    for (auto &input_tensor : input_tensors) {
-        auto idx = *input_it;
-        network->tensors[idx].x->reshape(input_tensor.get().shape);
-        network->tensors[idx].x->from_tensor(input_tensor);
-        ++input_it;
-    }
+    for (auto &input_tensor : input_tensors)
+        network->load_input(*input_it++, input_tensor);
+}
 
-    network->forward(network->inputs, {index});
+template <typename F>
+TileReport Node<F>::infer_tiled(Tensor<F> &volume, Tensor<F> &result, TileOptions const &options) {
+    return network->infer_tiled(volume, result, index, options);
 }
 
+template <typename F> void Node<F>::checkpoint() { network->checkpoints.insert(index); }
+
 template <typename F> void Node<F>::set_x(Tensor<F> &x) {
     network->tensors[index].x->reshape(x.shape);
     network->tensors[index].x->from_tensor(x);
+    touch();
 }
 
+template <typename F> void Node<F>::touch() { network->touch(index); }
+
 template <typename F> 
 Tensor<F> &Node<F>::x() {
     return *network->tensors[index].x;
@@ -61,9 +88,25 @@ Tensor<F> &Node<F>::grad() {
     return *network->tensors[index].grad;
 }
 
+template <typename F>
+bool ExecutionPlan<F>::matches(std::vector<int> const &inputs_, int const *outputs_,
+                               size_t n_outputs, bool inference_,
+                               std::vector<TensorSet<F>> &tensors) {
+    if (inference_ != inference || inputs_ != inputs || n_outputs != outputs.size())
+        return false;
+    for (size_t i(0); i < n_outputs; ++i)
+        if (outputs_[i] != outputs[i])
+            return false;
+    for (size_t i(0); i < inputs.size(); ++i)
+        if (!tensors[inputs[i]].x || tensors[inputs[i]].x->shape != input_shapes[i])
+            return false;
+    return true;
+}
+
 template <typename F> Network<F>::Network() {}
 
 template <typename F> void Network<F>::reset() {
+    clear_plans();
     sequence.clear();
     names.clear();
     operations.clear();
@@ -102,44 +145,69 @@ template <typename F> void Network<F>::zero_x() {
     for (auto &tensor : tensors)
         if (tensor.x)
             tensor.x->zero();
+    invalidate();
 }
 
 template <typename F> void Network<F>::zero_grad() {
+    zero_activation_grads();
+    for (auto &param : parameters)
+        param->zero_grad();
+}
+
+template <typename F> void Network<F>::zero_activation_grads() {
+    // gradients in an arena share memory with activations, backward zeros them when they come alive
     for (auto &tensor : tensors)
-        if (tensor.grad)
+        if (tensor.grad && !tensor.grad->bound)
             tensor.grad->zero();
+}
 
+template <typename F> void Network<F>::set_accumulate_grads(bool accumulate) {
+    accumulate_grads = accumulate;
     for (auto &param : parameters)
-        param->zero_grad();
+        param->accumulate_grads = accumulate;
 }
 
 template <typename F> void Network<F>::update(F lr) {
     assert_finished();
+    ProfileScope scope("update", [] { return string("Network::update"); });
     for (size_t i(0); i < parameters.size(); ++i)
         parameters[i]->update(lr);
+    touch_parameters();
 }
 
 template <typename F> void Network<F>::l2(F l) {
     assert_finished();
     for (size_t i(0); i < parameters.size(); ++i)
         parameters[i]->l2(l);
+    touch_parameters();
 }
 
 template <typename F> void Network<F>::init_normal(F mean, F std) {
     finish();
     for (size_t i(0); i < parameters.size(); ++i)
         parameters[i]->init_normal(mean, std);
+    touch_parameters();
 }
 
 template <typename F> void Network<F>::init_uniform(F var) {
     finish();
     for (size_t i(0); i < parameters.size(); ++i)
         parameters[i]->init_uniform(var);
+    touch_parameters();
 }
 
 template <typename F> void Network<F>::save(std::string path) {
     ofstream of(path, ios::binary);
-    cereal::PortableBinaryOutputArchive ar(of);
+    save(of);
+}
+
+template <typename F> void Network<F>::save(std::ostream &out) { write(out, true); }
+
+// The graph without parameter values, for replicas that point into our parameters
+template <typename F> void Network<F>::save_graph(std::ostream &out) { write(out, false); }
+
+template <typename F> void Network<F>::write(std::ostream &out, bool with_params) {
+    cereal::PortableBinaryOutputArchive ar(out);
 
     ar(sequence);
     ar(names);
@@ -157,14 +225,25 @@ template <typename F> void Network<F>::save(std::string path) {
     ar(opcodes);
 
     for (auto &op : operations) {
-        op->save(ar);
+        if (with_params)
+            op->save(ar);
+        else
+            op->save_graph(ar);
     }
 }
 
-template <typename F>
-
-void Network<F>::load(std::string path) {
+template <typename F> void Network<F>::load(std::string path) {
     ifstream in(path, ios::binary);
+    load(in);
+}
+
+template <typename F> void Network<F>::load(std::istream &in) {
+    load_graph(in);
+    finish();
+}
+
+// Reads the operations without aligning their parameters
+template <typename F> void Network<F>::load_graph(std::istream &in) {
     cereal::PortableBinaryInputArchive ar(in);
 
     // reset current state
@@ -211,6 +290,12 @@ void Network<F>::load(std::string path) {
             op = new ReluOperation<F>();
         } else if (opcode == SOFTMAX) {
             op = new SoftmaxOperation<F>();
+        } else if (opcode == CONVOLUTION_RELU) {
+            op = new ConvolutionReluOperation<F>(ar);
+        } else if (opcode == ADDITION_RELU) {
+            op = new AdditionReluOperation<F>();
+        } else if (opcode == LAYOUT) {
+            op = new LayoutOperation<F>(ar);
         } else {
             throw std::runtime_error("Opcode not implemented");
         }
@@ -220,7 +305,104 @@ void Network<F>::load(std::string path) {
         if (auto param = dynamic_cast<Parametrised<F> *>(op))
             parameters.emplace_back(param);
     }
+}
+
+// Copies of the graph with their own operations and activations, whose parameters point
+// into our param_vec. Each replica can run on its own thread, as handles and workspaces
+// are per thread. Replicas are invalid once our parameters are re-aligned.
+// The weights are never copied. With own_grads every replica gets its own grad_vec, otherwise
+// its parameter gradients accumulate into ours, as after share_grads.
+template <typename F>
+vector<unique_ptr<Network<F>>> Network<F>::replicate(int n, bool own_grads) {
+    finish();
+    stringstream graph(ios::in | ios::out | ios::binary);
+    save_graph(graph);
+
+    vector<unique_ptr<Network<F>>> replicas;
+    for (int i(0); i < n; ++i) {
+        graph.clear();
+        graph.seekg(0);
+        auto replica = make_unique<Network<F>>();
+        replica->load_graph(graph);
+        replica->attach_params(*this, own_grads);
+        replica->cache_plans = cache_plans;
+        replica->max_plans = max_plans;
+        replicas.emplace_back(std::move(replica));
+    }
+    return replicas;
+}
+
+// Finishes a freshly loaded graph with its parameters pointing into those of other, instead of
+// aligning them into a param_vec of our own. The per operation buffers are released.
+template <typename F> void Network<F>::attach_params(Network<F> &other, bool own_grads) {
+    other.finish();
+    register_params();
+    if (n_params != other.n_params)
+        throw DexeException("attach_params: number of parameters differs:", other.n_params);
+
+    // points the buffers at consecutive parts of data, releasing what they held
+    auto point = [](vector<CudaVec<F> *> &ptrs, F *data) {
+        for (auto &p : ptrs) {
+            auto N = p->N;
+            p->free();
+            p->data = data;
+            p->N = N;
+            p->own = false;
+            data += N;
+        }
+    };
+    auto share = [this](CudaVec<F> &vec, CudaVec<F> &source) {
+        vec.free();
+        vec.data = source.data;
+        vec.N = n_params;
+        vec.own = false;
+    };
+
+    share(param_vec, other.param_vec);
+    point(param_ptrs, param_vec.data);
+    if (own_grads) {
+        MemoryTag tag("gradients");
+        grad_vec.allocate(n_params);
+    } else {
+        share(grad_vec, other.grad_vec);
+        set_accumulate_grads(true);
+    }
+    point(grad_ptrs, grad_vec.data);
+
+    finished = true;
+    touch_parameters();
+}
+
+// Drops our own parameters and uses those of other, which has the same graph
+template <typename F> void Network<F>::share_params(Network<F> &other) {
+    finish();
+    other.finish();
+    if (n_params != other.n_params)
+        throw DexeException("share_params: number of parameters differs:", other.n_params);
+
+    param_vec.share(other.param_vec);
+    F *ptr = param_vec.data;
+    for (auto &p : param_ptrs) {
+        p->data = ptr;
+        ptr += p->N;
+    }
+    touch_parameters();
+}
+
+// Drops our own parameter gradients and accumulates into those of other, which has the same graph
+template <typename F> void Network<F>::share_grads(Network<F> &other) {
     finish();
+    other.finish();
+    if (n_params != other.n_params)
+        throw DexeException("share_grads: number of parameters differs:", other.n_params);
+
+    grad_vec.share(other.grad_vec);
+    F *ptr = grad_vec.data;
+    for (auto &g : grad_ptrs) {
+        g->data = ptr;
+        ptr += g->N;
+    }
+    set_accumulate_grads(true);
 }
 
 template <typename F> vector<F> Network<F>::to_vector() {
@@ -239,6 +421,7 @@ template <typename F> void Network<F>::from_vector(vector<F> &vec) {
         parameters[i]->from_vector(v);
         it += parameters[i]->size();
     }
+    touch_parameters();
 }
 
 template <typename F> vector<F> Network<F>::fd_gradient(F e) {
@@ -253,12 +436,14 @@ template <typename F> vector<F> Network<F>::fd_gradient(F e) {
         for (size_t n(0); n < vec.size(); ++n) {
             delta_vec[n] = vec[n] + e;
             parameters[i]->from_vector(delta_vec);
+            touch_parameters();
 
             forward(inputs, outputs);
             F plus_loss = tensors.back().x->to_vector()[0];
 
             delta_vec[n] = vec[n] - e;
             parameters[i]->from_vector(delta_vec);
+            touch_parameters();
 
             forward(inputs, outputs);
 
@@ -268,6 +453,7 @@ template <typename F> vector<F> Network<F>::fd_gradient(F e) {
             delta_vec[n] = vec[n];
         }
         parameters[i]->from_vector(vec);
+        touch_parameters();
     }
     return full_grad;
 }
@@ -289,15 +475,27 @@ template <typename F> void Network<F>::describe(ostream &out) {
     out.flush();
 }
 
+template <typename F> string Network<F>::label(int index) {
+    ostringstream oss;
+    oss << names[index] << " ";
+    operations[index]->describe(oss);
+    return oss.str();
+}
+
 template <typename F> void Network<F>::align_params() {
     register_params();
-    param_vec.allocate(n_params);
-    grad_vec.allocate(n_params);
+    {
+        MemoryTag tag("parameters");
+        param_vec.allocate(n_params);
+    }
+    {
+        MemoryTag tag("gradients");
+        grad_vec.allocate(n_params);
+    }
 
     F *ptr = param_vec.data;
     for (auto &p : param_ptrs) {
-        handle_error(cudaMemcpy(ptr, p->data, p->N * sizeof(F),
-                                cudaMemcpyDeviceToDevice));
+        copy_gpu_to_gpu(p->data, ptr, p->N);
         auto N = p->N;
         p->free();
         p->data = ptr;
@@ -309,8 +507,7 @@ template <typename F> void Network<F>::align_params() {
 
     ptr = grad_vec.data;
     for (auto &g : grad_ptrs) {
-        handle_error(cudaMemcpy(ptr, g->data, g->N * sizeof(F),
-                                cudaMemcpyDeviceToDevice));
+        copy_gpu_to_gpu(g->data, ptr, g->N);
         auto N = g->N;
         g->free();
         g->data = ptr;
@@ -329,15 +526,634 @@ template <typename F> void Network<F>::register_params() {
     fast_param_ptrs.clear();
     fast_grad_ptrs.clear();
 
-    for (auto &p : parameters)
+    for (auto &p : parameters) {
         p->register_params(param_ptrs, fast_param_ptrs, grad_ptrs,
                            fast_grad_ptrs);
+        p->accumulate_grads = accumulate_grads; // operations added by a rewrite follow the network
+    }
 
     n_params = 0;
     for (auto &p : param_ptrs)
         n_params += p->N;
 }
 
+
+// Gives the parameters their own memory again, so the set of parameters can change
+template <typename F> void Network<F>::unalign_params() {
+    if (!finished)
+        return;
+    for (auto ptrs : {&param_ptrs, &grad_ptrs})
+        for (auto p : *ptrs) {
+            if (p->own || !p->N)
+                continue;
+            F *shared = p->data;
+            int N = p->N;
+            p->data = nullptr;
+            p->N = 0;
+            p->own = true;
+            p->allocate(N);
+            copy_gpu_to_gpu(shared, p->data, N);
+        }
+    param_vec.free();
+    grad_vec.free();
+    finished = false;
+}
+
+void OptimizeReport::describe(ostream &out) {
+    out << "nodes: " << nodes_before << " -> " << nodes_after << " flops: " << flops_before
+        << " -> " << flops_after << " bytes: " << bytes_before << " -> " << bytes_after;
+}
+
+template <typename F> OptimizeReport Network<F>::optimize(vector<int> outputs) {
+    return rewrite(outputs, true, true);
+}
+
+template <typename F> OptimizeReport Network<F>::fuse(vector<int> outputs) {
+    return rewrite(outputs, false, true);
+}
+
+template <typename F>
+OptimizeReport Network<F>::rewrite(vector<int> outputs, bool simplify, bool fuse) {
+    OptimizeReport report;
+    report.nodes_before = operations.size();
+    graph_cost(outputs, report.flops_before, report.bytes_before);
+
+    clear_plans();
+    unalign_params();
+
+    set<int> keep(outputs.begin(), outputs.end());
+    keep.insert(inputs.begin(), inputs.end());
+
+    vector<vector<int>> consumers;
+    auto find_consumers = [this, &consumers]() {
+        consumers.assign(operations.size(), vector<int>());
+        for (int i(0); i < operations.size(); ++i)
+            for (auto idx : input_indices[i])
+                consumers[idx].push_back(i);
+    };
+
+    // every rewrite shrinks the live graph, so this terminates
+    bool changed = simplify;
+    while (changed) {
+        changed = false;
+        find_consumers();
+        for (int i(0); i < operations.size(); ++i) {
+            if (consumers[i].empty() && !keep.count(i))
+                continue;
+            if (fold_convolution(i, consumers, keep) || merge_addition(i, consumers, keep) ||
+                drop_identity(i, consumers, keep)) {
+                changed = true;
+                find_consumers();
+            }
+        }
+    }
+
+    // fusing last, a fused convolution doesn't fold anymore
+    if (fuse) {
+        find_consumers();
+        for (int i(0); i < operations.size(); ++i)
+            if (fuse_activation(i, consumers, keep))
+                find_consumers();
+    }
+
+    report.remap = remove_dead_nodes(outputs);
+    for (auto &o : outputs)
+        o = report.remap[o];
+    finish();
+
+    report.nodes_after = operations.size();
+    graph_cost(outputs, report.flops_after, report.bytes_after);
+    return report;
+}
+
+namespace {
+// a convolution without extras, squash is a convolution that has its own shape logic
+template <typename F> ConvolutionOperation<F> *plain_convolution(Operation<F> *op) {
+    if (op->opcode() != CONVOLUTION || dynamic_cast<SquashOperation<F> *>(op))
+        return nullptr;
+    return dynamic_cast<ConvolutionOperation<F> *>(op);
+}
+
+template <typename F> bool pointwise(ConvolutionOperation<F> *conv) {
+    for (int n(2); n < conv->dimensions.size(); ++n)
+        if (conv->dimensions[n] != 1)
+            return false;
+    for (auto s : conv->strides)
+        if (s != 1)
+            return false;
+    return true;
+}
+
+template <typename F> vector<F> bias_vector(ConvolutionOperation<F> *conv) {
+    if (conv->has_bias)
+        return conv->bias.to_vector();
+    return vector<F>(conv->filter_bank.out_c(), 0);
+}
+} // namespace
+
+// Two convolutions in a row without a nonlinearity in between are one convolution,
+// as long as one of them is pointwise. Replaces node index by the combination.
+template <typename F>
+bool Network<F>::fold_convolution(int index, vector<vector<int>> &consumers, set<int> &keep) {
+    auto b = plain_convolution(operations[index].get());
+    if (!b || input_indices[index].size() != 1)
+        return false;
+    int a_index = input_indices[index][0];
+    if (keep.count(a_index) || consumers[a_index].size() != 1)
+        return false;
+    auto a = plain_convolution(operations[a_index].get());
+    if (!a || a->dimensions.size() != b->dimensions.size())
+        return false;
+
+    int M = a->filter_bank.out_c(), C = a->filter_bank.in_c(), O = b->filter_bank.out_c();
+    auto wa = a->filter_bank.to_vector(), wb = b->filter_bank.to_vector();
+    auto ba = bias_vector(a), bb = bias_vector(b);
+
+    vector<int> dimensions, strides;
+    bool keep_size;
+    vector<F> w, bias(bb);
+    if (pointwise(b)) {
+        // W[o,c,s] = sum_m Wb[o,m] Wa[m,c,s], b = Wb ba + bb
+        int S = wa.size() / (M * C);
+        w.assign(O * C * S, 0);
+        for (int o(0); o < O; ++o)
+            for (int m(0); m < M; ++m) {
+                F scale = wb[o * M + m];
+                for (int cs(0); cs < C * S; ++cs)
+                    w[o * C * S + cs] += scale * wa[m * C * S + cs];
+                bias[o] += scale * ba[m];
+            }
+        dimensions = a->dimensions;
+        dimensions[0] = O;
+        strides = a->strides;
+        keep_size = a->keep;
+    } else if (pointwise(a)) {
+        // W[o,c,s] = sum_m Wb[o,m,s] Wa[m,c]. Padding of b pads the output of a with zeros,
+        // not with its bias, so a bias of a can only be folded when b doesn't pad
+        bool a_bias = any_of(ba.begin(), ba.end(), [](F v) { return v != 0; });
+        bool padded = any_of(b->paddings.begin(), b->paddings.end(), [](int p) { return p; });
+        if (a_bias && padded)
+            return false;
+
+        int S = wb.size() / (O * M);
+        w.assign(O * C * S, 0);
+        for (int o(0); o < O; ++o)
+            for (int m(0); m < M; ++m)
+                for (int s(0); s < S; ++s) {
+                    F scale = wb[(o * M + m) * S + s];
+                    for (int c(0); c < C; ++c)
+                        w[(o * C + c) * S + s] += scale * wa[m * C + c];
+                    bias[o] += scale * ba[m];
+                }
+        dimensions = b->dimensions;
+        dimensions[1] = C;
+        strides = b->strides;
+        keep_size = b->keep;
+    } else
+        return false;
+
+    bool has_bias = a->has_bias || b->has_bias;
+    auto folded = new ConvolutionOperation<F>(dimensions, strides, keep_size, has_bias);
+    if (has_bias)
+        w.insert(w.end(), bias.begin(), bias.end());
+    folded->from_vector(w);
+
+    operations[index].reset(folded);
+    input_indices[index] = input_indices[a_index];
+    return true;
+}
+
+// Nested additions become one addition over all their inputs
+template <typename F>
+bool Network<F>::merge_addition(int index, vector<vector<int>> &consumers, set<int> &keep) {
+    if (operations[index]->opcode() != ADDITION)
+        return false;
+
+    bool merged = false;
+    vector<int> summands;
+    for (auto idx : input_indices[index]) {
+        if (operations[idx]->opcode() == ADDITION && !keep.count(idx) &&
+            consumers[idx].size() == 1) {
+            summands.insert(summands.end(), input_indices[idx].begin(), input_indices[idx].end());
+            merged = true;
+        } else
+            summands.push_back(idx);
+    }
+    if (merged)
+        input_indices[index] = summands;
+    return merged;
+}
+
+// Lets the consumers of a node that doesn't change its input read that input directly
+template <typename F>
+bool Network<F>::drop_identity(int index, vector<vector<int>> &consumers, set<int> &keep) {
+    if (keep.count(index) || consumers[index].empty() || input_indices[index].size() != 1)
+        return false;
+    int input = input_indices[index][0];
+    auto code = operations[index]->opcode();
+
+    auto input_code = operations[input]->opcode();
+    bool rectified = input_code == RELU || input_code == CONVOLUTION_RELU ||
+                     input_code == ADDITION_RELU;
+    bool identity = code == ADDITION || (code == RELU && rectified);
+    auto conv = plain_convolution(operations[index].get());
+    if (conv && pointwise(conv) && conv->filter_bank.in_c() == conv->filter_bank.out_c()) {
+        int C = conv->filter_bank.in_c();
+        auto w = conv->to_vector();
+        identity = true;
+        for (int i(0); i < w.size(); ++i) {
+            F expected = (i < C * C && i / C == i % C) ? 1 : 0;
+            if (w[i] != expected)
+                identity = false;
+        }
+    }
+    if (!identity)
+        return false;
+
+    for (auto c : consumers[index])
+        for (auto &idx : input_indices[c])
+            if (idx == index)
+                idx = input;
+    return true;
+}
+
+// Merges a relu into the convolution or addition in front of it, so the
+// pre-activation is never written. Node index keeps its place and takes the fused operation.
+template <typename F>
+bool Network<F>::fuse_activation(int index, vector<vector<int>> &consumers, set<int> &keep) {
+    if (operations[index]->opcode() != RELU || input_indices[index].size() != 1)
+        return false;
+    int input = input_indices[index][0];
+    if (keep.count(input) || consumers[input].size() != 1)
+        return false;
+
+    Operation<F> *fused = nullptr;
+    if (auto conv = plain_convolution(operations[input].get())) {
+        auto fused_conv = new ConvolutionReluOperation<F>(conv->dimensions, conv->strides,
+                                                          conv->keep, conv->has_bias);
+        auto params = conv->to_vector();
+        fused_conv->from_vector(params);
+        fused = fused_conv;
+    } else if (operations[input]->opcode() == ADDITION)
+        fused = new AdditionReluOperation<F>();
+    else
+        return false;
+
+    operations[index].reset(fused);
+    input_indices[index] = input_indices[input];
+    return true;
+}
+
+// Removes every node the outputs don't depend on, except the inputs of the network.
+// Returns the new index of every old node, -1 for removed nodes.
+template <typename F> vector<int> Network<F>::remove_dead_nodes(vector<int> const &outputs) {
+    clear_plans();
+
+    vector<bool> live(operations.size());
+    stack<int> todo;
+    for (auto o : outputs)
+        todo.push(o);
+    for (auto i : inputs)
+        todo.push(i);
+    while (!todo.empty()) {
+        int i = todo.top();
+        todo.pop();
+        if (live[i])
+            continue;
+        live[i] = true;
+        for (auto idx : input_indices[i])
+            todo.push(idx);
+    }
+
+    // compacting keeps the order, so the graph stays topologically sorted
+    vector<int> remap(operations.size(), -1);
+    int n(0);
+    for (int i(0); i < operations.size(); ++i)
+        if (live[i])
+            remap[i] = n++;
+
+    vector<string> new_names;
+    vector<unique_ptr<Operation<F>>> new_operations;
+    vector<TensorSet<F>> new_tensors;
+    vector<vector<int>> new_input_indices;
+    for (int i(0); i < operations.size(); ++i) {
+        if (!live[i])
+            continue;
+        new_names.push_back(names[i]);
+        new_operations.emplace_back(std::move(operations[i]));
+        new_tensors.emplace_back(std::move(tensors[i]));
+        vector<int> in;
+        for (auto idx : input_indices[i])
+            in.push_back(remap[idx]);
+        new_input_indices.emplace_back(in);
+    }
+    names.swap(new_names);
+    operations.swap(new_operations);
+    tensors.swap(new_tensors);
+    input_indices.swap(new_input_indices);
+
+    names_set = set<string>(names.begin(), names.end());
+    for (auto &i : inputs)
+        i = remap[i];
+
+    parameters.clear();
+    for (auto &op : operations)
+        if (auto param = dynamic_cast<Parametrised<F> *>(op.get()))
+            parameters.emplace_back(param);
+
+    set<int> new_checkpoints;
+    for (auto c : checkpoints)
+        if (remap[c] >= 0)
+            new_checkpoints.insert(remap[c]);
+    checkpoints.swap(new_checkpoints);
+
+    sequence.clear();
+    finished = false;
+    return remap;
+}
+
+namespace {
+template <typename F> bool is_loss(Operation<F> *op) {
+    return dynamic_cast<SquaredLossOperation<F> *>(op) || dynamic_cast<SupportLossOperation<F> *>(op);
+}
+} // namespace
+
+template <typename F>
+OptimizeReport Network<F>::convert_layout(vector<int> outputs, cudnnTensorFormat_t format) {
+    OptimizeReport report;
+    report.nodes_before = operations.size();
+    graph_cost(outputs, report.flops_before, report.bytes_before);
+
+    clear_plans();
+    unalign_params();
+
+    int N = operations.size();
+    set<int> input_set(inputs.begin(), inputs.end());
+
+    // transforms of an earlier conversion are dropped, their consumers read the source again
+    vector<int> source(N);
+    vector<bool> dropped(N);
+    for (int i(0); i < N; ++i) {
+        source[i] = i;
+        if (dynamic_cast<LayoutOperation<F> *>(operations[i].get())) {
+            source[i] = source[input_indices[i][0]];
+            dropped[i] = true;
+        }
+    }
+    set<int> output_set;
+    for (auto o : outputs)
+        output_set.insert(source[o]);
+
+    // every node reads its inputs in the layout it produces
+    vector<cudnnTensorFormat_t> layout(N, CUDNN_TENSOR_NCHW);
+    for (int i(0); i < N; ++i)
+        if (!dropped[i] && !input_set.count(i) && operations[i]->any_layout())
+            layout[i] = format;
+
+    vector<bool> transform(N);
+    for (int i(0); i < N; ++i) {
+        if (dropped[i])
+            continue;
+        for (auto idx : input_indices[i])
+            if (layout[source[idx]] != layout[i])
+                transform[source[idx]] = true;
+    }
+    for (auto o : output_set)
+        if (layout[o] != CUDNN_TENSOR_NCHW && !is_loss(operations[o].get()))
+            transform[o] = true;
+
+    // transforms follow their source, so the graph stays topologically sorted
+    vector<int> remap(N, -1), transformed(N, -1);
+    vector<string> new_names;
+    vector<unique_ptr<Operation<F>>> new_operations;
+    vector<TensorSet<F>> new_tensors;
+    vector<vector<int>> new_input_indices;
+    for (int i(0); i < N; ++i) {
+        if (dropped[i])
+            continue;
+        vector<int> in;
+        for (auto idx : input_indices[i]) {
+            int s = source[idx];
+            in.push_back(layout[s] == layout[i] ? remap[s] : transformed[s]);
+        }
+        remap[i] = new_names.size();
+        new_names.push_back(names[i]);
+        new_operations.emplace_back(std::move(operations[i]));
+        new_tensors.emplace_back(std::move(tensors[i]));
+        new_input_indices.emplace_back(in);
+
+        if (transform[i]) {
+            auto target = layout[i] == CUDNN_TENSOR_NCHW ? format : CUDNN_TENSOR_NCHW;
+            auto name = get_unique_name(names[i] + (target == CUDNN_TENSOR_NCHW ? "_nchw" : "_nhwc"));
+            names_set.insert(name);
+            transformed[i] = new_names.size();
+            new_names.push_back(name);
+            new_operations.emplace_back(new LayoutOperation<F>(target));
+            new_tensors.emplace_back();
+            new_input_indices.push_back({remap[i]});
+        }
+    }
+    names.swap(new_names);
+    operations.swap(new_operations);
+    tensors.swap(new_tensors);
+    input_indices.swap(new_input_indices);
+    names_set = set<string>(names.begin(), names.end());
+
+    for (int i(0); i < N; ++i)
+        if (dropped[i])
+            remap[i] = remap[source[i]];
+    for (auto o : output_set)
+        if (transformed[o] >= 0)
+            remap[o] = transformed[o];
+    for (auto &i : inputs)
+        i = remap[i];
+    set<int> new_checkpoints;
+    for (auto c : checkpoints)
+        if (remap[c] >= 0)
+            new_checkpoints.insert(remap[c]);
+    checkpoints.swap(new_checkpoints);
+
+    sequence.clear();
+    finished = false;
+    finish();
+
+    report.remap = remap;
+    for (auto &o : outputs)
+        o = remap[o];
+    report.nodes_after = operations.size();
+    graph_cost(outputs, report.flops_after, report.bytes_after);
+    return report;
+}
+
+template <typename F> void Network<F>::apply_layouts() {
+    vector<cudnnTensorFormat_t> layout(operations.size(), CUDNN_TENSOR_NCHW);
+    set<int> input_set(inputs.begin(), inputs.end());
+    for (int i(0); i < operations.size(); ++i) {
+        auto op = operations[i].get();
+        if (auto transform = dynamic_cast<LayoutOperation<F> *>(op))
+            layout[i] = transform->format;
+        else if (!input_set.count(i) && op->any_layout() && !input_indices[i].empty()) {
+            layout[i] = layout[input_indices[i][0]];
+            for (auto idx : input_indices[i])
+                if (layout[idx] != layout[i])
+                    throw DexeException("apply_layouts: inputs in different layouts at node", names[i]);
+        }
+        if (tensors[i].x)
+            tensors[i].x->set_format(layout[i]);
+        if (tensors[i].grad)
+            tensors[i].grad->set_format(layout[i]);
+    }
+}
+
+// Estimated cost of a forward pass from all inputs to the outputs. Stays at the parameter
+// bytes if the input shapes aren't known yet.
+template <typename F>
+void Network<F>::graph_cost(vector<int> const &outputs, double &flops, size_t &bytes) {
+    flops = 0;
+    bytes = 0;
+    for (auto p : parameters)
+        bytes += p->size() * sizeof(F);
+
+    try {
+        auto &plan = compile(inputs, outputs);
+        vector<TensorShape> node_shapes(operations.size());
+        for (int p(0); p < plan.steps.size(); ++p) {
+            int index = plan.steps[p].index;
+            vector<TensorShape> in_shapes;
+            for (auto idx : input_indices[index])
+                in_shapes.push_back(node_shapes[idx]);
+            node_shapes[index] = plan.shapes[p];
+
+            flops += operations[index]->flops(in_shapes, plan.shapes[p]);
+            bytes += plan.shapes[p].n_elements() * sizeof(F);
+        }
+    } catch (DexeException &) {
+        // no input shapes yet, the estimate stays at the parameter bytes
+    }
+}
+namespace {
+// Rough peak throughput of the current device from its properties. Cuda cores per SM and
+// the double precision rate depend on the architecture and aren't exposed by the runtime.
+void device_peaks(bool double_precision, double &gflops, double &gbs) {
+    int device(0), sms(0), clock(0), memory_clock(0), bus_width(0), major(0), minor(0);
+    handle_error(cudaGetDevice(&device));
+    handle_error(cudaDeviceGetAttribute(&sms, cudaDevAttrMultiProcessorCount, device));
+    handle_error(cudaDeviceGetAttribute(&clock, cudaDevAttrClockRate, device));
+    handle_error(cudaDeviceGetAttribute(&memory_clock, cudaDevAttrMemoryClockRate, device));
+    handle_error(cudaDeviceGetAttribute(&bus_width, cudaDevAttrGlobalMemoryBusWidth, device));
+    handle_error(cudaDeviceGetAttribute(&major, cudaDevAttrComputeCapabilityMajor, device));
+    handle_error(cudaDeviceGetAttribute(&minor, cudaDevAttrComputeCapabilityMinor, device));
+
+    bool datacenter = minor == 0 && major >= 6; // P100, V100, A100, H100 have fast doubles
+    int cores = (major == 6 && minor > 0) || (major >= 8 && !datacenter) || major >= 9 ? 128 : 64;
+    gflops = 2e-6 * sms * cores * clock; // fused multiply-add per core per cycle, clock in kHz
+    if (double_precision)
+        gflops /= datacenter ? 2 : 32;
+    gbs = 2e-6 * memory_clock * bus_width / 8; // double data rate
+}
+} // namespace
+
+void CostReport::describe(ostream &out) {
+    auto flags = out.flags();
+    out << "peak " << peak_gflops << " GFLOP/s " << peak_gbs << " GB/s, ridge at "
+        << peak_gflops / peak_gbs << " flop/byte, " << n_runs << " runs" << endl;
+    out << left << setw(32) << "node" << setw(5) << "pass" << right << setw(10) << "GFLOP"
+        << setw(10) << "MB" << setw(10) << "flop/B" << setw(10) << "ms" << setw(10) << "GFLOP/s"
+        << setw(10) << "GB/s" << setw(10) << "roof %" << "  bound" << endl;
+    out << fixed << setprecision(3);
+
+    auto row = [&](NodeCost const &node, char const *pass, double flops, double bytes,
+                   double time) {
+        double intensity = bytes > 0 ? flops / bytes : 0;
+        double roof = min(peak_gflops, intensity * peak_gbs); // attainable GFLOP/s
+        double achieved = time > 0 ? flops / time * 1e-9 : 0;
+        bool compute = compute_bound(flops, bytes);
+        out << left << setw(32) << node.name.substr(0, 31) << setw(5) << pass << right << setw(10)
+            << flops * 1e-9 << setw(10) << bytes * 1e-6 << setw(10) << intensity << setw(10)
+            << time * 1e3 << setw(10) << achieved << setw(10)
+            << (time > 0 ? bytes / time * 1e-9 : 0) << setw(10)
+            << (roof > 0 ? 100 * achieved / roof : 0) << "  " << (compute ? "compute" : "memory")
+            << endl;
+    };
+    for (auto &node : nodes) {
+        row(node, "fwd", node.forward_flops, node.forward_bytes, node.forward_time);
+        if (node.backward_time > 0)
+            row(node, "bwd", node.backward_flops, node.backward_bytes, node.backward_time);
+    }
+    out.flags(flags);
+}
+
+template <typename F>
+CostReport Network<F>::cost_report(vector<int> outputs, int n_runs, bool backward,
+                                   double peak_gflops, double peak_gbs) {
+    CostReport report;
+    report.n_runs = n_runs = max(n_runs, 1);
+    if (peak_gflops <= 0 || peak_gbs <= 0)
+        device_peaks(sizeof(F) == sizeof(double), report.peak_gflops, report.peak_gbs);
+    if (peak_gflops > 0)
+        report.peak_gflops = peak_gflops;
+    if (peak_gbs > 0)
+        report.peak_gbs = peak_gbs;
+
+    auto &plan = compile(inputs, outputs);
+    auto run = [&] {
+        forward(plan);
+        if (backward) {
+            zero_grad();
+            this->backward();
+        }
+    };
+
+    // every step has to run, so skipping unchanged steps is off while measuring
+    bool was_incremental = incremental;
+    incremental = false;
+    run(); // dry runs and algorithm selection stay out of the timings
+
+    bool was_enabled = Profiler::enabled();
+    auto first = Profiler::events().size();
+    Profiler::enable();
+    for (int n(0); n < n_runs; ++n)
+        run();
+    if (!was_enabled)
+        Profiler::disable();
+    incremental = was_incremental;
+
+    map<string, double> forward_time, backward_time;
+    auto events = Profiler::events();
+    for (size_t i(first); i < events.size(); ++i) {
+        string category = events[i].category;
+        // recomputed activations of a checkpointed backward count as forward work
+        if (category == "forward" || category == "recompute")
+            forward_time[events[i].name] += events[i].duration * 1e-6 / n_runs;
+        else if (category == "backward")
+            backward_time[events[i].name] += events[i].duration * 1e-6 / n_runs;
+    }
+
+    vector<TensorShape> node_shapes(operations.size());
+    for (int p(0); p < plan.steps.size(); ++p) {
+        int index = plan.steps[p].index;
+        vector<TensorShape> in_shapes;
+        for (auto idx : input_indices[index])
+            in_shapes.push_back(node_shapes[idx]);
+        node_shapes[index] = plan.shapes[p];
+        if (plan.steps[p].is_input)
+            continue;
+
+        auto cost = operations[index]->cost(in_shapes, plan.shapes[p]);
+        NodeCost node;
+        node.index = index;
+        node.name = label(index);
+        node.forward_flops = cost.forward_flops;
+        node.backward_flops = cost.backward_flops;
+        node.forward_bytes = cost.forward_bytes;
+        node.backward_bytes = cost.backward_bytes;
+        node.forward_time = forward_time[node.name];
+        node.backward_time = backward_time[node.name];
+        report.nodes.push_back(node);
+    }
+    return report;
+}
+
 template <typename F> Network<F>::~Network() { }
 
 template <typename F> string Network<F>::get_unique_name(string name) {
@@ -359,6 +1175,7 @@ template <typename F>
 int Network<F>::add_operation(Operation<F> *op, vector<int> inputs,
                               TensorShape shape, string name) {
     finished = false;
+    clear_plans();
 
     int index = names.size();
 
@@ -611,29 +1428,42 @@ std::function<Node<F>(Node<F>, Node<F>)> Network<F>::addition(string name) {
     };
 }
 
+template <typename F> void Network<F>::prepare_backward(ExecutionPlan<F> &plan) {
+    // Backward Dryrun, only needed when the tensors were prepared for another plan
+    if (backward_ready == &plan)
+        return;
+    for (auto it = plan.steps.rbegin(); it != plan.steps.rend(); ++it) {
+        ProfileScope scope("dry_run", [&] { return label(it->index); });
+        operations[it->index]->backward_dry_run(it->inputs, it->outputs, it->input_grads,
+                                                it->output_grads);
+    }
+    backward_ready = &plan;
+}
+
 template <typename F> void Network<F>::backward() {
-    if (sequence.empty()) {
+    if (!active_plan) {
         cerr << "No sequence available, did you run forward?" << endl;
         return;
     }
-
-    for (auto it = sequence.rbegin(); it != sequence.rend(); ++it) {
-        int s = *it;
-
-        vector<Tensor<F> *> tmp_inputs, tmp_outputs, tmp_input_grads,
-            tmp_output_grads;
-        for (auto idx : input_indices[s]) {
-            tmp_inputs.push_back(tensors[idx].x.get());
-            tmp_input_grads.push_back(tensors[idx].grad.get());
-        }
-
-        tmp_outputs.push_back(tensors[s].x.get());
-        tmp_output_grads.push_back(tensors[s].grad.get());
-
-        operations[s]->backward_dry_run(tmp_inputs, tmp_outputs,
-                                        tmp_input_grads, tmp_output_grads);
-        operations[s]->backward(tmp_inputs, tmp_outputs, tmp_input_grads,
-                                tmp_output_grads);
+    if (active_plan->forward_only)
+        throw DexeException("backward on a plan whose memory was planned for forward only");
+    prepare_backward(*active_plan);
+    if (checkpointing && !active_plan->arena)
+        return checkpointed_backward(*active_plan);
+    if (pool && !active_plan->arena)
+        return parallel_backward(*active_plan);
+
+    auto &steps = active_plan->steps;
+    for (auto it = steps.rbegin(); it != steps.rend(); ++it) {
+        ProfileScope scope("backward", [&] { return label(it->index); });
+        for (auto grad : it->zero_grads)
+            grad->zero();
+        // an earlier checkpointed backward may have released gradients
+        for (auto grad : it->input_grads)
+            if (grad->size() && !grad->allocated())
+                grad->allocate();
+        operations[it->index]->backward(it->inputs, it->outputs, it->input_grads,
+                                        it->output_grads);
     }
 }
 
@@ -700,43 +1530,663 @@ vector<int> Network<F>::find_sequence(std::vector<int> inputs,
     return sequence;
 }
 
+// Drops the least recently used plan, and with it the arena of an inference plan
+template <typename F> void Network<F>::evict_plan() {
+    auto plan = plans.front().get();
+    if (arena_plan == plan || active_plan == plan || forward_ready == plan ||
+        backward_ready == plan) {
+        invalidate();
+        unbind_arena();
+        active_plan = forward_ready = backward_ready = nullptr;
+    }
+    plans.erase(plans.begin());
+}
+
+template <typename F> void Network<F>::clear_plans() {
+    invalidate();
+    unbind_arena();
+    plans.clear();
+    active_plan = forward_ready = backward_ready = nullptr;
+}
+
 template <typename F>
-void Network<F>::forward(std::vector<int> inputs, std::vector<int> outputs) {
-    sequence = find_sequence(inputs, outputs);
+ExecutionPlan<F> &Network<F>::compile(std::vector<int> const &inputs, int const *outputs,
+                                      size_t n_outputs, bool inference) {
+    if (cache_plans) {
+        // the most recently used plan is at the back
+        for (auto it = plans.begin(); it != plans.end(); ++it)
+            if ((*it)->matches(inputs, outputs, n_outputs, inference, tensors)) {
+                rotate(it, it + 1, plans.end());
+                return *plans.back();
+            }
+        while (!plans.empty() && plans.size() >= max_plans)
+            evict_plan();
+    } else
+        clear_plans();
+
+    auto plan = make_unique<ExecutionPlan<F>>();
+    plan->inputs = inputs;
+    plan->outputs.assign(outputs, outputs + n_outputs);
+    plan->inference = inference;
+    for (auto i : inputs)
+        plan->input_shapes.emplace_back(tensors[i].shape());
 
-    set<int> input_set(inputs.begin(), inputs.end());
+    plan->sequence = find_sequence(plan->inputs, plan->outputs);
+    apply_layouts();
 
-    // Forward Dryrun
-    for (auto s : sequence) {
-        vector<Tensor<F> *> tmp_inputs, tmp_outputs;
+    set<int> input_set(inputs.begin(), inputs.end());
+    for (auto s : plan->sequence) {
+        ExecutionStep<F> step;
+        step.index = s;
+        step.is_input = input_set.count(s);
+        step.parametrised = dynamic_cast<Parametrised<F> *>(operations[s].get());
         for (auto idx : input_indices[s]) {
-            tmp_inputs.push_back(tensors[idx].x.get());
+            step.inputs.push_back(tensors[idx].x.get());
+            step.input_grads.push_back(tensors[idx].grad.get());
+        }
+        step.outputs.push_back(tensors[s].x.get());
+        step.output_grads.push_back(tensors[s].grad.get());
+        plan->steps.emplace_back(std::move(step));
+    }
+
+    vector<int> position(operations.size(), -1);
+    for (int p(0); p < plan->steps.size(); ++p) {
+        auto &step = plan->steps[p];
+        position[step.index] = p;
+        if (step.is_input)
+            continue;
+        for (auto idx : input_indices[step.index]) {
+            if (position[idx] < 0)
+                continue;
+            step.input_steps.push_back(position[idx]);
+            plan->steps[position[idx]].last_consumer = p;
         }
-        tmp_outputs.push_back(tensors[s].x.get());
+    }
+
+    int S = plan->steps.size();
+    plan->consumer_steps.resize(S);
+    for (int p(0); p < S; ++p) {
+        auto &step = plan->steps[p];
+        plan->input_steps.push_back(step.input_steps);
+        plan->n_inputs.push_back(step.input_steps.size());
+        for (auto q : step.input_steps)
+            plan->consumer_steps[q].push_back(p);
+    }
+    for (auto &consumers : plan->consumer_steps)
+        plan->n_consumers.push_back(consumers.size());
+    plan->grad_locks.reset(new std::mutex[S]);
+    infer_shapes(*plan);
+
+    plans.emplace_back(std::move(plan));
+    return *plans.back();
+}
 
-        bool success = operations[s]->forward_dry_run(tmp_inputs, tmp_outputs);
-        if (!success) {
+// Propagates the input shapes through the plan, so shape errors surface before anything
+// is allocated and every buffer can be sized once
+template <typename F> void Network<F>::infer_shapes(ExecutionPlan<F> &plan) {
+    vector<TensorShape> node_shapes(operations.size());
+    for (int i(0); i < operations.size(); ++i)
+        node_shapes[i] = tensors[i].shape();
+
+    plan.shapes.resize(plan.steps.size());
+    for (int p(0); p < plan.steps.size(); ++p) {
+        auto &step = plan.steps[p];
+        vector<TensorShape> in_shapes;
+        for (auto idx : input_indices[step.index])
+            in_shapes.push_back(node_shapes[idx]);
+
+        TensorShape out = step.is_input ? node_shapes[step.index] : TensorShape();
+        if (!operations[step.index]->infer_shape(in_shapes, out)) {
             ostringstream oss;
-            oss << "Failure when preparing step [" << s << "]: " << names[s] << endl;
-            throw std::runtime_error(oss.str());
+            oss << "Shapes don't fit at step [" << step.index << "]: " << names[step.index]
+                << ", inputs:";
+            for (auto &shape : in_shapes)
+                oss << " " << shape;
+            throw DexeException(oss.str());
+        }
+        node_shapes[step.index] = out;
+        plan.shapes[p] = out;
+    }
+}
+
+template <typename F>
+ExecutionPlan<F> &Network<F>::compile(std::vector<int> const &inputs,
+                                      std::vector<int> const &outputs) {
+    return compile(inputs, outputs.data(), outputs.size());
+}
+
+template <typename F>
+void Network<F>::forward(std::vector<int> const &inputs, std::vector<int> const &outputs) {
+    forward(compile(inputs, outputs));
+}
+
+template <typename F> void Network<F>::forward(std::vector<int> const &inputs, int output) {
+    forward(compile(inputs, &output, 1));
+}
+
+template <typename F> void Network<F>::forward(ExecutionPlan<F> &plan) {
+    // Forward Dryrun, only needed when the tensors were prepared for another plan
+    if (forward_ready != &plan) {
+        forward_ready = backward_ready = nullptr;
+
+        // size every buffer up front, the dry runs then only prepare algorithms and workspaces
+        if (plan.arena)
+            bind_arena(plan);
+        else
+            unbind_arena();
+        for (int p(0); p < plan.steps.size(); ++p) {
+            if (plan.steps[p].is_input)
+                continue;
+            MemoryTag tag("dry_run", [&] { return label(plan.steps[p].index); });
+            plan.steps[p].outputs[0]->reshape(plan.shapes[p]);
         }
 
-        // make sure x is zero
-        if (!input_set.count(s))
-            tensors[s].x->zero();
+        for (auto &step : plan.steps) {
+            ProfileScope scope("dry_run", [&] { return label(step.index); });
+            bool success = operations[step.index]->forward_dry_run(step.inputs, step.outputs);
+            if (!success) {
+                ostringstream oss;
+                oss << "Failure when preparing step [" << step.index << "]: " << names[step.index]
+                    << endl;
+                throw std::runtime_error(oss.str());
+            }
+        }
+        forward_ready = &plan;
+        sequence = plan.sequence;
+        invalidate(); // outputs may have moved in or out of an arena
     }
+    active_plan = &plan;
+    // planned plans (e.g. inference) already recycle their memory
+    bool release = checkpointing && !plan.arena;
+    bool track = incremental && !release && !plan.arena;
+    if (!track)
+        invalidate();
+    if (release)
+        mark_checkpoints(plan);
+    else if (pool && !plan.arena)
+        return parallel_forward(plan);
 
     // Run Forward
-    for (auto s : sequence) {
-        vector<Tensor<F> *> tmp_inputs, tmp_outputs;
-        for (auto idx : input_indices[s])
-            tmp_inputs.push_back(tensors[idx].x.get());
-        tmp_outputs.push_back(tensors[s].x.get());
+    for (int p(0); p < plan.steps.size(); ++p) {
+        auto &step = plan.steps[p];
+        if (!step.is_input && track && up_to_date(step)) {
+            ++n_skipped;
+            continue;
+        }
+
+        {
+            ProfileScope scope("forward", [&] { return label(step.index); });
+            // make sure x is zero, some operations accumulate into their output
+            // a checkpointed run may have released it, allocation zeros as well
+            if (!step.is_input) {
+                if (step.outputs[0]->allocated())
+                    step.outputs[0]->zero();
+                else
+                    step.outputs[0]->allocate();
+            }
+            operations[step.index]->forward(step.inputs, step.outputs);
+        }
+        if (!step.is_input) {
+            ++n_executed;
+            if (track)
+                mark_evaluated(step);
+        }
+
+        if (!release)
+            continue;
+        for (auto q : step.input_steps)
+            if (plan.steps[q].last_consumer == p && !plan.steps[q].keep)
+                plan.steps[q].outputs[0]->cudavec.free();
+    }
+}
+
+template <typename F> void Network<F>::set_incremental(bool on) {
+    incremental = on;
+    invalidate();
+}
+
+// Copies source into input node index. In incremental mode the copy is skipped when the same
+// tensor, unchanged, was loaded last time and the input still holds it
+template <typename F> void Network<F>::load_input(int index, Tensor<F> &source) {
+    auto &x = *tensors[index].x;
+    if (loaded.size() < operations.size())
+        loaded.resize(operations.size());
+    auto current = make_tuple(&source, source.version, x.version);
+    if (incremental && loaded[index] == current)
+        return;
+
+    x.reshape(source.shape);
+    x.from_tensor(source);
+    touch(index);
+    loaded[index] = make_tuple(&source, source.version, x.version);
+}
+
+// Views aren't tracked for incremental mode, every load copies
+template <typename F> void Network<F>::load_input(int index, TensorView<F> const &source) {
+    auto &x = *tensors[index].x;
+    x.reshape(source.shape);
+    x.from_tensor(source);
+    touch(index);
+}
+
+template <typename F> void Network<F>::touch(int index) {
+    if (versions.size() < operations.size())
+        versions.resize(operations.size());
+    versions[index] = ++clock;
+}
+
+template <typename F> void Network<F>::touch_parameters() { params_version = ++clock; }
+
+// Forgets which outputs are valid, the next forward computes every node
+template <typename F> void Network<F>::invalidate() {
+    evaluated.assign(operations.size(), 0);
+    seen.resize(operations.size());
+    seen_params.resize(operations.size());
+    versions.resize(operations.size());
+}
+
+template <typename F> bool Network<F>::up_to_date(ExecutionStep<F> &step) {
+    int i = step.index;
+    if (!evaluated[i] || (step.parametrised && seen_params[i] != params_version))
+        return false;
+    for (size_t k(0); k < input_indices[i].size(); ++k)
+        if (versions[input_indices[i][k]] != seen[i][k])
+            return false;
+    return true;
+}
+
+template <typename F> void Network<F>::mark_evaluated(ExecutionStep<F> &step) {
+    int i = step.index;
+    seen[i].clear();
+    for (auto idx : input_indices[i])
+        seen[i].push_back(versions[idx]);
+    seen_params[i] = params_version;
+    versions[i] = ++clock;
+    evaluated[i] = 1;
+}
+
+template <typename F> void Network<F>::set_threads(int n_threads) {
+    if (n_threads > 0)
+        pool = make_unique<ThreadPool>(n_threads);
+    else
+        pool.reset();
+}
+
+// Every step runs as soon as its inputs are computed. Steps are synced on their own stream
+// before their consumers are released, as those run on other threads and streams.
+template <typename F> void Network<F>::parallel_forward(ExecutionPlan<F> &plan) {
+    Handler::sync_stream(); // inputs loaded on this thread's stream
+    run_graph(*pool, plan.consumer_steps, plan.n_inputs, [this, &plan](int p) {
+        auto &step = plan.steps[p];
+        if (step.is_input)
+            return;
+        if (incremental && up_to_date(step)) {
+            ++n_skipped;
+            return;
+        }
+        {
+            ProfileScope scope("forward", [&] { return label(step.index); });
+            if (step.outputs[0]->allocated())
+                step.outputs[0]->zero();
+            else
+                step.outputs[0]->allocate();
+            operations[step.index]->forward(step.inputs, step.outputs);
+        }
+        Handler::sync_stream();
+        ++n_executed;
+        if (incremental)
+            mark_evaluated(step);
+    });
+}
+
+// Mirror of the forward, a step runs once all its consumers ran their backward.
+// Consumers of the same node accumulate into its gradient, they hold its lock while doing so.
+template <typename F> void Network<F>::parallel_backward(ExecutionPlan<F> &plan) {
+    Handler::sync_stream(); // the loss gradient and zero_grad ran on this thread's stream
+    run_graph(*pool, plan.input_steps, plan.n_consumers, [this, &plan](int p) {
+        auto &step = plan.steps[p];
+        for (auto grad : step.input_grads)
+            if (grad->size() && !grad->allocated())
+                grad->allocate();
+
+        vector<int> locked(step.input_steps);
+        sort(locked.begin(), locked.end());
+        locked.erase(unique(locked.begin(), locked.end()), locked.end());
+        vector<unique_lock<mutex>> locks;
+        for (auto q : locked)
+            locks.emplace_back(plan.grad_locks[q]);
+
+        ProfileScope scope("backward", [&] { return label(step.index); });
+        operations[step.index]->backward(step.inputs, step.outputs, step.input_grads,
+                                         step.output_grads);
+        Handler::sync_stream();
+    });
+}
+
+template <typename F> void Network<F>::mark_checkpoints(ExecutionPlan<F> &plan) {
+    int S = plan.steps.size();
+    int stride = max<int>(1, ceil(sqrt(S)));
+    set<int> output_set(plan.outputs.begin(), plan.outputs.end());
+    for (int p(0); p < S; ++p) {
+        auto &step = plan.steps[p];
+        bool marked = checkpoints.empty() ? (p % stride == 0) : checkpoints.count(step.index);
+        step.keep = step.is_input || output_set.count(step.index) || marked;
+    }
+}
+
+// Makes sure the activation of step p is available, recomputing it from the nearest
+// stored activations if it was released
+template <typename F> void Network<F>::recompute(ExecutionPlan<F> &plan, int p) {
+    auto &step = plan.steps[p];
+    auto out = step.outputs[0];
+    if (step.is_input || !out->size() || out->allocated())
+        return;
+    for (auto q : step.input_steps)
+        recompute(plan, q);
+    out->allocate();
+    ProfileScope scope("recompute", [&] { return label(step.index); });
+    operations[step.index]->forward(step.inputs, step.outputs);
+}
+
+template <typename F> void Network<F>::checkpointed_backward(ExecutionPlan<F> &plan) {
+    auto &steps = plan.steps;
+    for (int p = steps.size() - 1; p >= 0; --p) {
+        auto &step = steps[p];
+        recompute(plan, p);
+        for (auto q : step.input_steps)
+            recompute(plan, q);
+
+        // gradients released in an earlier backward come back zeroed
+        for (auto grad : step.input_grads)
+            if (grad->size() && !grad->allocated())
+                grad->allocate();
+
+        {
+            ProfileScope scope("backward", [&] { return label(step.index); });
+            operations[step.index]->backward(step.inputs, step.outputs, step.input_grads,
+                                             step.output_grads);
+        }
+
+        // nothing earlier in the backward reads this step's activation or gradient again
+        if (step.is_input || count(plan.outputs.begin(), plan.outputs.end(), step.index))
+            continue;
+        step.outputs[0]->cudavec.free();
+        step.output_grads[0]->cudavec.free();
+    }
+}
+
+template <typename F>
+void Network<F>::infer(std::vector<int> const &inputs, std::vector<int> const &outputs) {
+    auto &plan = compile(inputs, outputs.data(), outputs.size(), true);
+
+    // First call, the arena is planned from the inferred shapes on forward liveness,
+    // activations are never allocated outside of it
+    if (!plan.arena) {
+        active_plan = &plan;
+        plan_memory(false);
+    }
+    forward(plan);
+}
+
+template <typename F> void Network<F>::infer(std::vector<int> const &inputs, int output) {
+    infer(inputs, vector<int>{output});
+}
 
-        operations[s]->forward(tmp_inputs, tmp_outputs);
+template <typename F> vector<int> Network<F>::downscale_factors() {
+    vector<int> factors(3, 1);
+    for (auto &op : operations) {
+        auto conv = dynamic_cast<ConvolutionOperation<F> *>(op.get());
+        if (!conv || op->opcode() == CONVOLUTION_TRANSPOSE || conv->strides.size() != factors.size())
+            continue;
+        for (int n(0); n < factors.size(); ++n)
+            factors[n] *= conv->strides[n];
+    }
+    return factors;
+}
+
+namespace {
+// Start of every tile along one dimension, the last one is moved back to end at the border
+vector<int> tile_starts(int dim, int size, int step) {
+    vector<int> starts;
+    for (int p(0);; p += step) {
+        if (p + size >= dim) {
+            starts.push_back(dim - size);
+            break;
+        }
+        starts.push_back(p);
+    }
+    return starts;
+}
+} // namespace
+
+void TileReport::describe(ostream &out) {
+    out << "tiles: " << n_tiles << " network: " << network_bytes << " staging: " << staging_bytes
+        << " weights: " << weight_bytes << " input: " << input_bytes
+        << " result: " << result_bytes << " total: " << total_bytes() << " bytes";
+}
+
+template <typename F>
+TileReport Network<F>::infer_tiled(Tensor<F> &volume, Tensor<F> &result, int output,
+                                   TileOptions const &options) {
+    if (inputs.size() != 1)
+        throw DexeException("infer_tiled needs a network with one input, inputs:", inputs.size());
+    auto shape = volume.shape;
+    if (shape.n_dimensions() != 5 || shape.n() != 1)
+        throw DexeException("infer_tiled needs a single 3D volume");
+
+    // tiles are multiples of the downscale factors, so every tile fits through the network
+    auto factors = downscale_factors();
+    Window3D window;
+    vector<int> size(3);
+    vector<vector<int>> starts(3);
+    for (int n(0); n < 3; ++n) {
+        int dim = shape[n + 2];
+        size[n] = min(options.tile[n], dim);
+        size[n] -= size[n] % factors[n];
+        if (size[n] <= 0)
+            throw DexeException("infer_tiled: volume is smaller than the downscale factor", factors[n]);
+        int overlap = max(0, min(options.overlap[n], size[n] - 1));
+        starts[n] = tile_starts(dim, size[n], size[n] - overlap);
+        window.dims[n] = dim;
+        window.size[n] = size[n];
+    }
+
+    // The weights are a product of per dimension weights and the tiles form a grid, so the
+    // sum of the weights at a voxel is the product of the per dimension sums. Normalising each
+    // dimension by its own sum blends without a per voxel weight sum. Every dimension gets a
+    // row of normalised weights per tile start.
+    vector<F> weight_values;
+    vector<vector<int>> rows(3);
+    for (int n(0); n < 3; ++n) {
+        vector<double> weight(size[n], 1), sum(shape[n + 2], 0);
+        if (options.blending == TileBlending::GAUSSIAN)
+            for (int i(0); i < size[n]; ++i) {
+                double sigma = options.sigma * size[n], d = i - (size[n] - 1) / 2.0;
+                // floored, so voxels at the volume border that only one tile edge covers stay defined
+                weight[i] = max(exp(-d * d / (2 * sigma * sigma)), 1e-4);
+            }
+        for (auto start : starts[n])
+            for (int i(0); i < size[n]; ++i)
+                sum[start + i] += weight[i];
+        for (auto start : starts[n]) {
+            rows[n].push_back(weight_values.size());
+            for (int i(0); i < size[n]; ++i)
+                weight_values.push_back(weight[i] / sum[start + i]);
+        }
+    }
+    CudaVec<F> weights;
+    weights.from_vector(weight_values);
+
+    TensorShape tile_shape{1, shape.c(), size[0], size[1], size[2]};
+    auto &x = *tensors[inputs[0]].x;
+    x.reshape(tile_shape);
+
+    TensorShape out_shape;
+    auto &plan = compile(inputs, &output, 1, true);
+    for (int p(0); p < plan.steps.size(); ++p)
+        if (plan.steps[p].index == output)
+            out_shape = plan.shapes[p];
+    for (int n(0); n < 3; ++n)
+        if (out_shape[n + 2] != size[n])
+            throw DexeException("infer_tiled needs an output at input resolution");
+
+    TensorShape result_shape{1, out_shape.c(), shape[2], shape[3], shape[4]};
+    if (result.shape != result_shape)
+        result.reshape(result_shape);
+    result.zero();
+
+    vector<vector<int>> origins, tile_rows;
+    for (size_t z(0); z < starts[0].size(); ++z)
+        for (size_t y(0); y < starts[1].size(); ++y)
+            for (size_t x(0); x < starts[2].size(); ++x) {
+                origins.push_back({starts[0][z], starts[1][y], starts[2][x]});
+                tile_rows.push_back({rows[0][z], rows[1][y], rows[2][x]});
+            }
+
+    // tiles are cut out on a worker with its own stream, overlapping with the network
+    Tensor<F> staging(tile_shape);
+    auto whole = volume.view();
+    ThreadPool prefetcher(1);
+    auto extract = [&](int t) {
+        auto task = make_shared<packaged_task<void()>>([&, t] {
+            staging.from_tensor(whole.crop(origins[t], size));
+            Handler::sync_stream();
+        });
+        auto done = task->get_future();
+        prefetcher.submit([task] { (*task)(); });
+        return done;
+    };
+
+    auto next = extract(0);
+    for (int t(0); t < origins.size(); ++t) {
+        next.get();
+        x.reshape(tile_shape);
+        x.from_tensor(staging);
+        Handler::sync_stream(); // staging can take the next tile
+        if (t + 1 < origins.size())
+            next = extract(t + 1);
+
+        infer(inputs, output);
+
+        auto w = window;
+        w.c = out_shape.c();
+        copy(origins[t].begin(), origins[t].end(), w.origin);
+        copy(tile_rows[t].begin(), tile_rows[t].end(), w.rows);
+        blend_window_cuda<F>(tensors[output].x->ptr(), weights.data, result.ptr(), w);
+    }
+    result.touch();
+    Handler::sync_stream();
+
+    TileReport report;
+    report.n_tiles = origins.size();
+    report.network_bytes = resident_bytes();
+    report.staging_bytes = staging.size() * sizeof(F);
+    report.weight_bytes = weights.N * sizeof(F);
+    report.input_bytes = volume.size() * sizeof(F);
+    report.result_bytes = result.size() * sizeof(F);
+    return report;
+}
+
+template <typename F> size_t Network<F>::resident_bytes() {
+    size_t bytes(0);
+    for (auto &t : tensors) {
+        if (!t.x->bound)
+            bytes += t.x->cudavec.N * sizeof(F);
+        if (!t.grad->bound)
+            bytes += t.grad->cudavec.N * sizeof(F);
+    }
+    if (arena_plan)
+        bytes += arena_plan->arena->size;
+    return bytes;
+}
+
+template <typename F> MemoryPlan &Network<F>::plan_memory(bool training) {
+    if (!active_plan)
+        throw DexeException("compile or run forward before planning memory");
+    if (training && checkpointing)
+        throw DexeException("checkpointing can't be combined with a planned training arena");
+    auto &plan = *active_plan;
+    if (training)
+        prepare_backward(plan);
+
+    unbind_arena();
+    for (auto &step : plan.steps)
+        step.zero_grads.clear();
+    plan.arena_tensors.clear();
+    plan.arena_shapes.clear();
+
+    // Timeline: forward of step p happens at time p, its backward at time 2S - 1 - p
+    int S = plan.steps.size();
+    int end = training ? 2 * S - 1 : S - 1;
+
+    set<int> output_set(plan.outputs.begin(), plan.outputs.end());
+
+    // Inputs are set from outside and stay owning
+    vector<BufferRequest> requests;
+    for (int p(0); p < S; ++p) {
+        auto &step = plan.steps[p];
+        int s = step.index;
+        int last_consumer = step.last_consumer;
+        if (step.is_input)
+            continue;
+
+        BufferRequest x_request;
+        x_request.bytes = plan.shapes[p].n_elements() * sizeof(F);
+        x_request.first = p;
+        x_request.last = training ? 2 * S - 1 - p : max(p, last_consumer);
+        if (output_set.count(s))
+            x_request.last = end;
+        if (x_request.bytes) {
+            requests.push_back(x_request);
+            plan.arena_tensors.push_back(tensors[s].x.get());
+            plan.arena_shapes.push_back(plan.shapes[p]);
+        }
+
+        if (!training || !tensors[s].grad->size())
+            continue;
+
+        // The gradient comes alive in the backward of the last consumer, and is used up by our own backward
+        BufferRequest grad_request;
+        grad_request.bytes = tensors[s].grad->size() * sizeof(F);
+        grad_request.first = last_consumer >= 0 ? 2 * S - 1 - last_consumer : S;
+        grad_request.last = 2 * S - 1 - p;
+        requests.push_back(grad_request);
+        plan.arena_tensors.push_back(tensors[s].grad.get());
+        plan.arena_shapes.push_back(tensors[s].grad->shape);
+        plan.steps[last_consumer >= 0 ? last_consumer : S - 1].zero_grads.push_back(
+            tensors[s].grad.get());
     }
+
+    plan.memory = dexe::plan_memory(requests);
+    plan.forward_only = !training;
+    if (!plan.arena)
+        plan.arena = make_unique<Arena>(ArenaLocation::DEVICE);
+    plan.arena->allocate(plan.memory.arena_bytes);
+    bind_arena(plan);
+    return plan.memory;
+}
+
+template <typename F> void Network<F>::bind_arena(ExecutionPlan<F> &plan) {
+    if (arena_plan && arena_plan != &plan)
+        unbind_arena();
+    for (size_t i(0); i < plan.arena_tensors.size(); ++i)
+        plan.arena_tensors[i]->bind(
+            reinterpret_cast<F *>(plan.arena->data + plan.memory.offsets[i]),
+            plan.arena_shapes[i]);
+    arena_plan = &plan;
 }
 
+template <typename F> void Network<F>::unbind_arena() {
+    if (!arena_plan)
+        return;
+    for (auto t : arena_plan->arena_tensors)
+        t->unbind();
+    arena_plan = nullptr;
+}
+
+template struct ExecutionPlan<float>;
+template struct ExecutionPlan<double>;
+
 template struct Node<float>;
 template struct Node<double>;
 
@@ -1,9 +1,11 @@
 #include "dexe/normalise.h"
+#include "dexe/handler.h"
 
 #include <thrust/functional.h>
 #include <thrust/host_vector.h>
 #include <thrust/device_vector.h>
 #include <thrust/generate.h>
+#include <thrust/execution_policy.h>
 
 struct square
 {
@@ -23,9 +25,11 @@ void normalise_fast(float *ptr, int n)
   //    const thrust::device_vector<float>& x)
   // with fusion
 
+  // on the handler stream, the default stream doesn't wait for non-blocking streams
+  auto policy = thrust::cuda::par.on(dexe::Handler::stream());
   thrust::device_ptr<float> dev_ptr = thrust::device_pointer_cast(ptr);
-  float mean = thrust::reduce(dev_ptr, dev_ptr + n, 0, thrust::plus<float>()) / n;    
-  float std = sqrt( transform_reduce(dev_ptr, dev_ptr + n, square(mean), 0.0f, thrust::plus<float>())) / n;
-  thrust::for_each(dev_ptr, dev_ptr + n, thrust::placeholders::_1 /= std);
+  float mean = thrust::reduce(policy, dev_ptr, dev_ptr + n, 0, thrust::plus<float>()) / n;    
+  float std = sqrt( thrust::transform_reduce(policy, dev_ptr, dev_ptr + n, square(mean), 0.0f, thrust::plus<float>())) / n;
+  thrust::for_each(policy, dev_ptr, dev_ptr + n, thrust::placeholders::_1 /= std);
   
 }
@@ -13,15 +13,24 @@ using namespace std;
 namespace dexe {
 
 template <typename F>
-bool InputOperation<F>::forward_dry_run(std::vector<Tensor<F> *> &in,
-                                        std::vector<Tensor<F> *> &out) {
+bool InputOperation<F>::infer_shape(std::vector<TensorShape> const &in, TensorShape &out) {
     if (!reference)
         return true;
     if (reference->shape.c() != n_channels) {
         cerr << "input channels don't correspond data" << endl;
         return false;
     }
-    out[0]->reshape(reference->shape);
+    out = reference->shape;
+    return true;
+}
+
+template <typename F>
+bool InputOperation<F>::forward_dry_run(std::vector<Tensor<F> *> &in,
+                                        std::vector<Tensor<F> *> &out) {
+    auto shape = out[0]->shape;
+    if (!infer_shape({}, shape))
+        return false;
+    out[0]->reshape(shape);
     return true;
 }
 
@@ -58,7 +67,7 @@ ConvolutionOperation<F>::ConvolutionOperation(vector<int> dimensions_, vector<in
                                               bool keep_, bool has_bias_,
                                               size_t workspace_limit_)
     : algo(CUDNN_CONVOLUTION_FWD_ALGO_IMPLICIT_GEMM), // default algorithm
-      workspace(0), workspace_size(workspace_limit_), workspace_size_bwd(workspace_limit_),
+      workspace_size(workspace_limit_), workspace_size_bwd(workspace_limit_),
       workspace_size_bwd_filter(workspace_limit_), keep(keep_), dimensions(dimensions_),
       strides(strides_), has_bias(has_bias_) {
     init();
@@ -130,32 +139,33 @@ void ConvolutionOperation<F>::backward(vector<Tensor<F> *> &in, vector<Tensor<F>
         throw DexeException("Error in ConvolutionOperation backward, output "
                             "gradient not allocated");
     }
+    // accumulate, the input can have more consumers that add to the same gradient
     if (in_grad.size()) // allows us to prevent backward pass to inputs if unneeded
-        backward(*in[0], *out[0], *in_grad[0], *out_grad[0]);
-    backward_weights(*in[0], *out_grad[0]);
+        backward(*in[0], *out[0], *in_grad[0], *out_grad[0], 1.0);
+    // parameter gradients are overwritten, unless micro-batches are being accumulated
+    backward_weights(*in[0], *out_grad[0], this->accumulate_grads ? 1.0 : 0.0);
 }
 
-template <typename F>
-bool ConvolutionOperation<F>::check_fit(Tensor<F> &in_tensor, Tensor<F> &out_tensor) {
+template <typename F> bool ConvolutionOperation<F>::check_fit(TensorShape const &in_shape) {
     // Check if input makes sense
-    if (in_tensor.size() == 0) {
+    if (in_shape.n_elements() == 0) {
         cerr << "ConvolutionOperation: dry run failed, input size is zero" << endl;
         return false;
     }
-    if (in_tensor.shape.c() != filter_bank.in_c()) {
+    if (in_shape.c() != filter_bank.in_c()) {
         cerr << "ConvolutionOperation: input channels don't match filters" << endl;
         return false;
     }
-    if (in_tensor.shape.n_dimensions() != out_tensor.shape.n_dimensions()) {
+    if (in_shape.n_dimensions() != paddings.size() + 2) {
         cerr << "ConvolutionOperation: number of input dimensions don't match "
-                "output dimensions"
+                "filter dimensions"
              << endl;
         return false;
     }
 
     // check if strides divide
     for (int n(0); n < paddings.size(); ++n) {
-        if ((in_tensor.shape[n + 2] + 2 * paddings[n] - dimensions[n + 2]) % strides[n] != 0) {
+        if ((in_shape[n + 2] + 2 * paddings[n] - dimensions[n + 2]) % strides[n] != 0) {
             cerr << "Stride does not divide dimension" << endl;
             return false;
         }
@@ -163,11 +173,19 @@ bool ConvolutionOperation<F>::check_fit(Tensor<F> &in_tensor, Tensor<F> &out_ten
     return true;
 }
 
+template <typename F>
+bool ConvolutionOperation<F>::infer_shape(vector<TensorShape> const &in, TensorShape &out) {
+    if (!check_fit(in[0]))
+        return false;
+    out = output_shape(in[0]);
+    return true;
+}
+
 template <typename F>
 bool ConvolutionOperation<F>::forward_dry_run(vector<Tensor<F> *> &in, vector<Tensor<F> *> &out) {
     auto &in_tensor = *in[0];
     auto &out_tensor = *out[0];
-    if (!check_fit(in_tensor, out_tensor))
+    if (!check_fit(in_tensor.shape))
         return false;
 
     // prepare the workspaces
@@ -181,13 +199,7 @@ void ConvolutionOperation<F>::prepare_forward(Tensor<F> &in,
 
     // reshape output tensor, calculated from paddings, strides and dimensions
     // of filters
-    auto target_shape = in.shape;
-    target_shape.set_c(filter_bank.out_c());
-    for (int n(0); n < paddings.size(); ++n) {
-        target_shape[n + 2] =
-            (in.shape[n + 2] + 2 * paddings[n] - dimensions[n + 2]) / strides[n] + 1;
-    }
-    out.reshape(target_shape);
+    out.reshape(output_shape(in.shape));
     // algo = CUDNN_CONVOLUTION_FWD_ALGO_GEMM;
     // algo = CUDNN_CONVOLUTION_FWD_ALGO_IMPLICIT_GEMM;
     // algo = CUDNN_CONVOLUTION_FWD_ALGO_IMPLICIT_PRECOMP_GEMM;
@@ -201,7 +213,6 @@ void ConvolutionOperation<F>::prepare_forward(Tensor<F> &in,
                                                          conv, out.td, algo, &new_workspace_size));
 
     workspace_size = new_workspace_size;
-    workspace = Handler::workspace();
     /*
     if (workspace_size != new_workspace_size) {
         workspace_size = new_workspace_size;
@@ -227,7 +238,6 @@ void ConvolutionOperation<F>::prepare_backward_weights(Tensor<F> &in,
         &new_workspace_size));
 
     workspace_size_bwd_filter = new_workspace_size;
-    workspace_bwd_filter = Handler::workspace();
     /*
     if (workspace_size_bwd_filter != new_workspace_size) {
     workspace_size_bwd_filter = new_workspace_size;
@@ -253,7 +263,6 @@ void ConvolutionOperation<F>::prepare_backward(Tensor<F> &in,
         Handler::cudnn(), filter_bank.fd, out.td, conv, in.td, algo_bwd, &new_workspace_size));
 
     workspace_size_bwd = new_workspace_size;
-    workspace_bwd = Handler::workspace();
     /*
     if (workspace_size_bwd != new_workspace_size) {
     workspace_size_bwd = new_workspace_size;
@@ -335,7 +344,7 @@ void ConvolutionOperation<F>::forward(Tensor<F> &input, Tensor<F> &output, F bet
     // endl;
     // cout << workspace << " " << workspace_size << endl;
     handle_error(cudnnConvolutionForward(Handler::cudnn(), &alpha, input.td, input.ptr(),
-                                         filter_bank.fd, filter_bank.weights.ptr(), conv, algo, workspace,
+                                         filter_bank.fd, filter_bank.weights.ptr(), conv, algo, Handler::workspace(workspace_size),
                                          workspace_size, &beta, output.td, output.ptr()));
     // handle_error( cudnnAddTensor(Handler::cudnn(), CUDNN_ADD_FEATURE_MAP,
     // &alpha_bias, bias.td, bias.data, &beta_bias, output.td, output.data));
@@ -355,14 +364,14 @@ void ConvolutionOperation<F>::backward(Tensor<F> &in, Tensor<F> &out, Tensor<F>
     // CUDNN_CONVOLUTION_BWD_DATA_ALGO_0;
     handle_error( cudnnConvolutionBackwardData(Handler::cudnn(), &alpha, filter_bank.fd,
                                               filter_bank.ptr(), output_grad.td, output_grad.ptr(),
-                                              conv, algo_bwd, workspace_bwd, workspace_size_bwd,
+                                              conv, algo_bwd, Handler::workspace(workspace_size_bwd), workspace_size_bwd,
                                               &beta, input_grad.td, input_grad.ptr()) );
 }
 
 template <typename F>
 void ConvolutionOperation<F>::backward_weights(Tensor<F> &input, Tensor<F> &output_grad, F beta) {
     if (has_bias) {
-        F alpha_bias(1.0), beta_bias(beta / input.size());
+        F alpha_bias(1.0), beta_bias(beta);
         handle_error( cudnnConvolutionBackwardBias(Handler::cudnn(), &alpha_bias, output_grad.td,
                                                   output_grad.ptr(), &beta_bias, bias_grad.td,
                                                   bias_grad.ptr()) );
@@ -371,7 +380,7 @@ void ConvolutionOperation<F>::backward_weights(Tensor<F> &input, Tensor<F> &outp
     F alpha(1.0);
     handle_error(cudnnConvolutionBackwardFilter(
         Handler::cudnn(), &alpha, input.td, input.ptr(), output_grad.td, output_grad.ptr(), conv,
-        algo_bwd_filter, workspace_bwd_filter, workspace_size_bwd_filter, &beta,
+        algo_bwd_filter, Handler::workspace(workspace_size_bwd_filter), workspace_size_bwd_filter, &beta,
         filter_bank_grad.fd, filter_bank_grad.ptr()));
 }
 
@@ -381,9 +390,36 @@ template <typename F> void ConvolutionOperation<F>::zero_grad() {
         bias_grad.zero();
 }
 
+template <typename F>
+double ConvolutionOperation<F>::flops(vector<TensorShape> const &in, TensorShape const &out) {
+    // multiply-add per filter tap for every output element
+    double kernel = filter_bank.in_c();
+    for (int n(2); n < dimensions.size(); ++n)
+        kernel *= dimensions[n];
+    return 2.0 * out.n_elements() * kernel;
+}
+
+template <typename F>
+OperationCost ConvolutionOperation<F>::cost(vector<TensorShape> const &in, TensorShape const &out) {
+    double params = filter_bank.n_weights() + (has_bias ? bias.size() : 0);
+    double in_elements = in.size() ? in[0].n_elements() : 0;
+
+    // backward computes the data and the filter gradient, each as much work as the forward.
+    // Both read the output gradient, they write the input and parameter gradients.
+    OperationCost c;
+    c.forward_flops = this->flops(in, out);
+    c.backward_flops = 2 * c.forward_flops;
+    c.forward_bytes = (in_elements + out.n_elements() + params) * sizeof(F);
+    c.backward_bytes = 2 * (in_elements + out.n_elements() + params) * sizeof(F);
+    return c;
+}
+
 template <typename F> TensorShape ConvolutionOperation<F>::output_shape(TensorShape in) {
-    in.set_c(filter_bank.out_c());
-    return in;
+    auto out = in;
+    out.set_c(filter_bank.out_c());
+    for (int n(0); n < paddings.size(); ++n)
+        out[n + 2] = (in[n + 2] + 2 * paddings[n] - dimensions[n + 2]) / strides[n] + 1;
+    return out;
 }
 
 template <typename F> void ConvolutionOperation<F>::scale_grad(F val) {
@@ -433,6 +469,21 @@ template <typename F> void ConvolutionOperation<F>::save(cereal::PortableBinaryO
         ar(bias.to_vector());
 }
 
+template <typename F>
+void ConvolutionOperation<F>::save_graph(cereal::PortableBinaryOutputArchive &ar) {
+    ar(dimensions);
+    ar(strides);
+    ar(paddings);
+    ar(dilations);
+    ar(has_bias);
+    ar(keep);
+
+    // empty parameter vectors, the loader leaves the parameters as they are
+    ar(vector<F>());
+    if (has_bias)
+        ar(vector<F>());
+}
+
 template <typename F>
 ConvolutionOperation<F>::ConvolutionOperation(cereal::PortableBinaryInputArchive &ar) {
     ar(dimensions);
@@ -446,12 +497,14 @@ ConvolutionOperation<F>::ConvolutionOperation(cereal::PortableBinaryInputArchive
 
     vector<F> filter_bank_vec;
     ar(filter_bank_vec);
-    filter_bank.from_vector(filter_bank_vec);
+    if (filter_bank_vec.size()) // empty when saved by save_graph
+        filter_bank.from_vector(filter_bank_vec);
 
     if (has_bias) {
         vector<F> bias_vec;
         ar(bias_vec);
-        bias.from_vector(bias_vec);
+        if (bias_vec.size())
+            bias.from_vector(bias_vec);
     }
 }
 
@@ -472,9 +525,19 @@ void ConvolutionTransposeOperation<F>::forward(std::vector<Tensor<F> *> &in,
 }
 
 template <typename F>
-bool ConvolutionTransposeOperation<F>::forward_dry_run(std::vector<Tensor<F> *> &in,
-                                                       std::vector<Tensor<F> *> &out) {
-    auto in_shape = in[0]->shape;
+double ConvolutionTransposeOperation<F>::flops(vector<TensorShape> const &in,
+                                               TensorShape const &out) {
+    // every input element is spread over out channels times the kernel
+    double kernel = this->filter_bank.in_c();
+    for (int n(2); n < this->dimensions.size(); ++n)
+        kernel *= this->dimensions[n];
+    return 2.0 * in[0].n_elements() * kernel;
+}
+
+template <typename F>
+bool ConvolutionTransposeOperation<F>::infer_shape(std::vector<TensorShape> const &in,
+                                                   TensorShape &out) {
+    auto in_shape = in[0];
     // In the transpose we use cudnnConvolutions in reverse, so the output
     // dimension is not the 1st dimension, input the 0th.
     if (in_shape.c() != this->dimensions[0]) {
@@ -495,6 +558,16 @@ bool ConvolutionTransposeOperation<F>::forward_dry_run(std::vector<Tensor<F> *>
         }
         output_shape[n + 2] = intermediate - 2 * this->paddings[n];
     }
+    out = output_shape;
+    return true;
+}
+
+template <typename F>
+bool ConvolutionTransposeOperation<F>::forward_dry_run(std::vector<Tensor<F> *> &in,
+                                                       std::vector<Tensor<F> *> &out) {
+    TensorShape output_shape;
+    if (!infer_shape({in[0]->shape}, output_shape))
+        return false;
     out[0]->reshape(output_shape);
 
     Tensor<F> dummy;
@@ -507,13 +580,14 @@ void ConvolutionTransposeOperation<F>::backward(std::vector<Tensor<F> *> &in,
                                                 std::vector<Tensor<F> *> &out,
                                                 std::vector<Tensor<F> *> &in_grad,
                                                 std::vector<Tensor<F> *> &out_grad) {
+    // same gradient contract as the regular convolution, the transpose has no bias
     if (in_grad.size())
-        ConvolutionOperation<F>::forward(*out_grad[0],
-                                         *in_grad[0]); // we use ConvolutionOperation in
-                                                       // reverse to get the transpose
+        ConvolutionOperation<F>::forward(*out_grad[0], *in_grad[0],
+                                         1.0); // we use ConvolutionOperation in
+                                               // reverse to get the transpose
     ConvolutionOperation<F>::backward_weights(
-        *out_grad[0],
-        *in[0]); // we use ConvolutionOperation in reverse to get the transpose
+        *out_grad[0], *in[0],
+        this->accumulate_grads ? 1.0 : 0.0); // we use ConvolutionOperation in reverse to get the transpose
 }
 
 template <typename F>
@@ -537,6 +611,88 @@ void ConvolutionTransposeOperation<F>::save(cereal::PortableBinaryOutputArchive
     ConvolutionOperation<F>::save(ar);
 }
 
+template <typename F>
+ConvolutionReluOperation<F>::ConvolutionReluOperation(vector<int> dimensions_,
+                                                      vector<int> strides_, bool keep_,
+                                                      bool has_bias_, size_t workspace_limit_)
+    : ConvolutionOperation<F>(dimensions_, strides_, keep_, has_bias_, workspace_limit_) {
+    init_activation();
+}
+
+template <typename F>
+ConvolutionReluOperation<F>::ConvolutionReluOperation(cereal::PortableBinaryInputArchive &ar)
+    : ConvolutionOperation<F>(ar) {
+    init_activation();
+}
+
+template <typename F> ConvolutionReluOperation<F>::~ConvolutionReluOperation() {
+    if (desc)
+        cudnnDestroyActivationDescriptor(desc);
+}
+
+template <typename F> void ConvolutionReluOperation<F>::init_activation() {
+    handle_error(cudnnCreateActivationDescriptor(&desc));
+    handle_error(
+        cudnnSetActivationDescriptor(desc, CUDNN_ACTIVATION_RELU, CUDNN_NOT_PROPAGATE_NAN, 0.));
+}
+
+template <typename F>
+double ConvolutionReluOperation<F>::flops(vector<TensorShape> const &in, TensorShape const &out) {
+    return ConvolutionOperation<F>::flops(in, out) + out.n_elements();
+}
+
+template <typename F>
+bool ConvolutionReluOperation<F>::forward_dry_run(vector<Tensor<F> *> &in,
+                                                  vector<Tensor<F> *> &out) {
+    if (!ConvolutionOperation<F>::forward_dry_run(in, out))
+        return false;
+
+    // cudnn only fuses relu into the implicit precomputed gemm, use it if its workspace fits
+    fused = false;
+    if (this->has_bias) {
+        size_t size(0);
+        auto status = cudnnGetConvolutionForwardWorkspaceSize(
+            Handler::cudnn(), in[0]->td, this->filter_bank.fd, this->conv, out[0]->td,
+            CUDNN_CONVOLUTION_FWD_ALGO_IMPLICIT_PRECOMP_GEMM, &size);
+        if (status == CUDNN_STATUS_SUCCESS && size <= Handler::workspace_size()) {
+            this->algo = CUDNN_CONVOLUTION_FWD_ALGO_IMPLICIT_PRECOMP_GEMM;
+            this->workspace_size = size;
+            fused = true;
+        }
+    }
+    return true;
+}
+
+template <typename F>
+void ConvolutionReluOperation<F>::forward(vector<Tensor<F> *> &in, vector<Tensor<F> *> &out) {
+    auto &input = *in[0];
+    auto &output = *out[0];
+    F alpha(1), beta(0);
+
+    if (fused) {
+        // z is the output itself, with a zero alpha2 it only contributes the bias and relu
+        handle_error(cudnnConvolutionBiasActivationForward(
+            Handler::cudnn(), &alpha, input.td, input.ptr(), this->filter_bank.fd,
+            this->filter_bank.weights.ptr(), this->conv, this->algo, Handler::workspace(this->workspace_size),
+            this->workspace_size, &beta, output.td, output.ptr(), this->bias.td,
+            this->bias.ptr(), desc, output.td, output.ptr()));
+        return;
+    }
+
+    ConvolutionOperation<F>::forward(input, output);
+    handle_error(cudnnActivationForward(Handler::cudnn(), desc, &alpha, output.td, output.ptr(),
+                                        &beta, output.td, output.ptr()));
+}
+
+template <typename F>
+void ConvolutionReluOperation<F>::backward(vector<Tensor<F> *> &in, vector<Tensor<F> *> &out,
+                                           vector<Tensor<F> *> &in_grad,
+                                           vector<Tensor<F> *> &out_grad) {
+    // only this node reads its output gradient, so it can become the pre-activation gradient
+    relu_mask_cuda<F>(out[0]->ptr(), out_grad[0]->ptr(), out[0]->size());
+    ConvolutionOperation<F>::backward(in, out, in_grad, out_grad);
+}
+
 /////////////////////
 template <typename F> SquaredLossOperation<F>::SquaredLossOperation() {}
 
@@ -549,15 +705,25 @@ void SquaredLossOperation<F>::forward(std::vector<Tensor<F> *> &in, std::vector<
     out[0]->from_ptr(&loss);
 }
 
+template <typename F>
+bool SquaredLossOperation<F>::infer_shape(std::vector<TensorShape> const &in, TensorShape &out) {
+    if (in[0] != in[1]) {
+        cerr << "input shapes don't match, " << in[0] << " != " << in[1] << endl;
+        return false;
+    }
+    out = TensorShape{1, 1, 1};
+    return true;
+}
+
 template <typename F>
 bool SquaredLossOperation<F>::forward_dry_run(std::vector<Tensor<F> *> &in,
                                               std::vector<Tensor<F> *> &out) {
-    if (in[0]->shape != in[1]->shape) {
-        cerr << "input shapes don't match, " << in[0]->shape << " != " << in[1]->shape << endl;
+    TensorShape shape;
+    if (!infer_shape({in[0]->shape, in[1]->shape}, shape))
         return false;
-    }
 
-    out[0]->reshape({1, 1, 1});
+    out[0]->reshape(shape);
+    tmp.set_format(in[0]->format); // read raw next to the inputs
     tmp.reshape(in[0]->shape);
     return true;
 }
@@ -593,24 +759,36 @@ template <typename F>
 void SupportLossOperation<F>::forward(std::vector<Tensor<F> *> &in, std::vector<Tensor<F> *> &out) {
     support_loss(in[0]->ptr(), in[1]->ptr(), tmp.ptr(), in[0]->shape.n_elements(), support);
     F avg = tmp.norm2() / in[0]->shape.n_elements();
-    vector<F> data = {avg};
-    out[0]->from_vector(data);
+    out[0]->from_ptr(&avg);
 }
 
 template <typename F>
-bool SupportLossOperation<F>::forward_dry_run(std::vector<Tensor<F> *> &in,
-                                              std::vector<Tensor<F> *> &out) {
+bool SupportLossOperation<F>::infer_shape(std::vector<TensorShape> const &in, TensorShape &out) {
     if (in.size() != 2) {
         cerr << "SupportLossOperation needs two inputs" << endl;
         return false;
     }
 
-    if (in[0]->shape != in[1]->shape) {
+    if (in[0] != in[1]) {
         cerr << "SupportLossOperation: input shapes don't match" << endl;
         return false;
     }
+    out = TensorShape{1, 1, 1};
+    return true;
+}
 
-    out[0]->reshape({1, 1, 1});
+template <typename F>
+bool SupportLossOperation<F>::forward_dry_run(std::vector<Tensor<F> *> &in,
+                                              std::vector<Tensor<F> *> &out) {
+    vector<TensorShape> in_shapes;
+    for (auto t : in)
+        in_shapes.push_back(t->shape);
+    TensorShape shape;
+    if (!infer_shape(in_shapes, shape))
+        return false;
+
+    out[0]->reshape(shape);
+    tmp.set_format(in[0]->format); // read raw next to the inputs
     tmp.reshape(in[0]->shape);
     return true;
 }
@@ -676,6 +854,49 @@ void UnsquashOperation<F>::backward(Tensor<F> &in, Tensor<F> &out, Tensor<F> &in
     in_grad.from_tensor(out_grad);
 }
 
+////////////////// Layout
+
+template <typename F> LayoutOperation<F>::LayoutOperation(cudnnTensorFormat_t format_) : format(format_) {}
+
+template <typename F> LayoutOperation<F>::LayoutOperation(cereal::PortableBinaryInputArchive &ar) {
+    int f(0);
+    ar(f);
+    format = cudnnTensorFormat_t(f);
+}
+
+template <typename F>
+void LayoutOperation<F>::forward(std::vector<Tensor<F> *> &in, std::vector<Tensor<F> *> &out) {
+    out[0]->from_tensor(*in[0]);
+}
+
+template <typename F>
+bool LayoutOperation<F>::forward_dry_run(std::vector<Tensor<F> *> &in,
+                                         std::vector<Tensor<F> *> &out) {
+    out[0]->set_format(format);
+    out[0]->reshape(in[0]->shape);
+    return true;
+}
+
+template <typename F>
+void LayoutOperation<F>::backward(std::vector<Tensor<F> *> &in, std::vector<Tensor<F> *> &out,
+                                  std::vector<Tensor<F> *> &in_grad,
+                                  std::vector<Tensor<F> *> &out_grad) {
+    in_grad[0]->add(*out_grad[0], 1.0);
+}
+
+template <typename F>
+bool LayoutOperation<F>::backward_dry_run(std::vector<Tensor<F> *> &in,
+                                          std::vector<Tensor<F> *> &out,
+                                          std::vector<Tensor<F> *> &in_grad,
+                                          std::vector<Tensor<F> *> &out_grad) {
+    in_grad[0]->reshape(in[0]->shape);
+    return true;
+}
+
+template <typename F> void LayoutOperation<F>::save(cereal::PortableBinaryOutputArchive &ar) {
+    ar(int(format));
+}
+
 ////////////////// Merge
 
 template <typename F> MergeOperation<F>::MergeOperation() {}
@@ -811,26 +1032,40 @@ template <typename F> AdditionOperation<F>::AdditionOperation() {}
 
 template <typename F>
 void AdditionOperation<F>::forward(vector<Tensor<F> *> &in, vector<Tensor<F> *> &out) {
-    forward(*in[0], *in[1], *out[0]);
+    for (auto t : in)
+        add_cuda<F>(t->ptr(), out[0]->ptr(), t->size(), 1.0);
 }
 
 template <typename F>
-bool AdditionOperation<F>::forward_dry_run(vector<Tensor<F> *> &in, vector<Tensor<F> *> &out) {
-    auto &in_tensor0 = *in[0];
-    auto &in_tensor1 = *in[1];
-    auto &out_tensor = *out[0];
-
-    if (in_tensor0.shape.n_elements() == 0 || in_tensor1.shape.n_elements() == 0) {
-        cerr << "AdditionOperation: Input shape is empty" << endl;
+bool AdditionOperation<F>::infer_shape(vector<TensorShape> const &in, TensorShape &out) {
+    if (in.empty()) {
+        cerr << "AdditionOperation: no inputs" << endl;
         return false;
     }
-    if (in_tensor0.shape != in_tensor1.shape) {
-        cerr << "AdditionOperation: inputs don't match" << endl;
-        return false;
+    for (auto &shape : in) {
+        if (shape.n_elements() == 0) {
+            cerr << "AdditionOperation: Input shape is empty" << endl;
+            return false;
+        }
+        if (shape != in[0]) {
+            cerr << "AdditionOperation: inputs don't match" << endl;
+            return false;
+        }
     }
+    out = in[0];
+    return true;
+}
 
-    out_tensor.reshape(in_tensor0.shape);
+template <typename F>
+bool AdditionOperation<F>::forward_dry_run(vector<Tensor<F> *> &in, vector<Tensor<F> *> &out) {
+    vector<TensorShape> in_shapes;
+    for (auto t : in)
+        in_shapes.push_back(t->shape);
+    TensorShape shape;
+    if (!infer_shape(in_shapes, shape))
+        return false;
 
+    out[0]->reshape(shape);
     return true;
 }
 
@@ -838,7 +1073,8 @@ template <typename F>
 void AdditionOperation<F>::backward(std::vector<Tensor<F> *> &in, std::vector<Tensor<F> *> &out,
                                     std::vector<Tensor<F> *> &in_grad,
                                     std::vector<Tensor<F> *> &out_grad) {
-    backward(*out_grad[0], *in_grad[0], *in_grad[1]);
+    for (auto g : in_grad)
+        add_cuda<F>(out_grad[0]->ptr(), g->ptr(), out_grad[0]->size(), 1.0);
 }
 
 template <typename F>
@@ -846,28 +1082,29 @@ bool AdditionOperation<F>::backward_dry_run(std::vector<Tensor<F> *> &in,
                                             std::vector<Tensor<F> *> &out,
                                             std::vector<Tensor<F> *> &in_grad,
                                             std::vector<Tensor<F> *> &out_grad) {
-    in_grad[0]->reshape(in[0]->shape);
-    in_grad[1]->reshape(in[1]->shape);
+    for (size_t i(0); i < in.size(); ++i)
+        in_grad[i]->reshape(in[i]->shape);
     return true;
 }
 
-template <typename F>
-void AdditionOperation<F>::forward(Tensor<F> &in1, Tensor<F> &in2, Tensor<F> &out) {
-    F alpha(1);
+template <typename F> TensorShape AdditionOperation<F>::output_shape(TensorShape in) { return in; }
 
-    add_cuda<F>(in1.ptr(), out.ptr(), in1.size(), 1.0);
-    add_cuda<F>(in2.ptr(), out.ptr(), in2.size(), 1.0);
+template <typename F>
+void AdditionReluOperation<F>::forward(vector<Tensor<F> *> &in, vector<Tensor<F> *> &out) {
+    for (size_t i(0); i + 1 < in.size(); ++i)
+        add_cuda<F>(in[i]->ptr(), out[0]->ptr(), in[i]->size(), 1.0);
+    add_relu_cuda<F>(in.back()->ptr(), out[0]->ptr(), in.back()->size());
 }
 
 template <typename F>
-void AdditionOperation<F>::backward(Tensor<F> &out_grad, Tensor<F> &in_grad1, Tensor<F> &in_grad2) {
-    F alpha(1);
-    add_cuda<F>(out_grad.ptr(), in_grad1.ptr(), out_grad.size(), 1.0);
-    add_cuda<F>(out_grad.ptr(), in_grad2.ptr(), out_grad.size(), 1.0);
+void AdditionReluOperation<F>::backward(std::vector<Tensor<F> *> &in,
+                                        std::vector<Tensor<F> *> &out,
+                                        std::vector<Tensor<F> *> &in_grad,
+                                        std::vector<Tensor<F> *> &out_grad) {
+    relu_mask_cuda<F>(out[0]->ptr(), out_grad[0]->ptr(), out[0]->size());
+    AdditionOperation<F>::backward(in, out, in_grad, out_grad);
 }
 
-template <typename F> TensorShape AdditionOperation<F>::output_shape(TensorShape in) { return in; }
-
 template <typename F> SigmoidOperation<F>::SigmoidOperation(F scale_) : scale(scale_) {
     cudnnCreateActivationDescriptor(&desc);
     cudnnSetActivationDescriptor(desc, CUDNN_ACTIVATION_SIGMOID, CUDNN_NOT_PROPAGATE_NAN, 0);
@@ -960,6 +1197,7 @@ template <typename F>
 bool InstanceNormalisationOperation<F>::forward_dry_run(std::vector<Tensor<F> *> &in,
                                                         std::vector<Tensor<F> *> &out) {
     out[0]->reshape(in[0]->shape);
+    tmp.set_format(in[0]->format);
     tmp.reshape(in[0]->shape);
     return true;
 }
@@ -1007,12 +1245,15 @@ void InstanceNormalisationOperation<F>::save(cereal::PortableBinaryOutputArchive
 template struct InputOperation<float>;
 template struct ConvolutionOperation<float>;
 template struct ConvolutionTransposeOperation<float>;
+template struct ConvolutionReluOperation<float>;
 template struct LocalNormalisationOperation<float>;
 template struct SquashOperation<float>;
 template struct UnsquashOperation<float>;
+template struct LayoutOperation<float>;
 template struct MergeOperation<float>;
 template struct SplitOperation<float>;
 template struct AdditionOperation<float>;
+template struct AdditionReluOperation<float>;
 template struct PoolingOperation<float>;
 template struct TanhOperation<float>;
 template struct SigmoidOperation<float>;
@@ -1025,12 +1266,15 @@ template struct InstanceNormalisationOperation<float>;
 template struct InputOperation<double>;
 template struct ConvolutionOperation<double>;
 template struct ConvolutionTransposeOperation<double>;
+template struct ConvolutionReluOperation<double>;
 template struct LocalNormalisationOperation<double>;
 template struct SquashOperation<double>;
 template struct UnsquashOperation<double>;
+template struct LayoutOperation<double>;
 template struct MergeOperation<double>;
 template struct SplitOperation<double>;
 template struct AdditionOperation<double>;
+template struct AdditionReluOperation<double>;
 template struct PoolingOperation<double>;
 template struct TanhOperation<double>;
 template struct SigmoidOperation<double>;
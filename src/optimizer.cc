@@ -1,4 +1,5 @@
 #include "dexe/optimizer.h"
+#include "dexe/profiler.h"
 
 using namespace std;
 
@@ -13,6 +14,10 @@ void Optimizer<F>::register_network(Network<F> &network) {}
 
 template <typename F> void Optimizer<F>::update() {}
 
+template <typename F> void Optimizer<F>::update(int begin, int end) {
+    throw std::runtime_error("Optimizer doesn't support partial updates");
+}
+
 /////////////////
 template <typename F> SGDOptimizer<F>::SGDOptimizer(F lr_) : lr(lr_) {}
 
@@ -21,15 +26,28 @@ void SGDOptimizer<F>::register_network(Network<F> &network_) {
     network = &network_;
     network->finish();
 
+    MemoryTag tag("SGDOptimizer::tmp");
     tmp.allocate(network->param_vec.N);
 }
 
 template <typename F> void SGDOptimizer<F>::update() {
     if (!network)
         throw std::runtime_error("No network registered");
-    tmp = network->grad_vec;
-    tmp *= lr;
-    network->param_vec += tmp;
+    update(0, network->param_vec.N);
+    network->touch_parameters();
+}
+
+template <typename F> void SGDOptimizer<F>::update(int begin, int end) {
+    if (!network)
+        throw std::runtime_error("No network registered");
+    ProfileScope scope("update", [] { return string("SGDOptimizer::update"); });
+    int n = end - begin;
+    CudaVec<F> grad(network->grad_vec.data + begin, n), param(network->param_vec.data + begin, n);
+    CudaVec<F> t(tmp.data + begin, n);
+
+    t = grad;
+    t *= lr * this->grad_scale;
+    param += t;
 }
 
 template <typename F> void SGDOptimizer<F>::set_lr(F lr_) { lr = lr_; }
@@ -43,29 +61,48 @@ void AdaOptimizer<F>::register_network(Network<F> &network_) {
     network = &network_;
     network->finish();
 
-    std.allocate(network->param_vec.N);
+    {
+        MemoryTag tag("AdaOptimizer::std");
+        std.allocate(network->param_vec.N);
+    }
     std += 0.1;
-    tmp.allocate(network->param_vec.N);
+    {
+        MemoryTag tag("AdaOptimizer::tmp");
+        tmp.allocate(network->param_vec.N);
+    }
+    MemoryTag tag("AdaOptimizer::tmp2");
     tmp2.allocate(network->param_vec.N);
 }
 
 template <typename F> void AdaOptimizer<F>::update() {
     if (!network)
         throw std::runtime_error("No network registered");
-    tmp = network->grad_vec;
-    tmp.pow(2);
-    tmp *= (1.0 - beta);
-    std *= beta;
-    std += tmp;
-
-    tmp = network->grad_vec;
-    tmp2 = std;
-    tmp2.sqrt();
-    tmp2 += eps;
-    tmp /= tmp2;
-
-    tmp *= lr;
-    network->param_vec += tmp;
+    update(0, network->param_vec.N);
+    network->touch_parameters();
+}
+
+template <typename F> void AdaOptimizer<F>::update(int begin, int end) {
+    if (!network)
+        throw std::runtime_error("No network registered");
+    ProfileScope scope("update", [] { return string("AdaOptimizer::update"); });
+    int n = end - begin;
+    CudaVec<F> grad(network->grad_vec.data + begin, n), param(network->param_vec.data + begin, n);
+    CudaVec<F> s(std.data + begin, n), t(tmp.data + begin, n), t2(tmp2.data + begin, n);
+
+    t = grad;
+    t.pow(2);
+    t *= (1.0 - beta) * this->grad_scale * this->grad_scale;
+    s *= beta;
+    s += t;
+
+    t = grad;
+    t2 = s;
+    t2.sqrt();
+    t2 += eps;
+    t /= t2;
+
+    t *= lr * this->grad_scale;
+    param += t;
 }
 
 template <typename F> void AdaOptimizer<F>::set_lr(F lr_) { lr = lr_; }
@@ -80,36 +117,59 @@ void AdamOptimizer<F>::register_network(Network<F> &network_) {
     network = &network_;
     network->finish();
 
-    momentum.allocate(network->param_vec.N);
-    std.allocate(network->param_vec.N);
+    {
+        MemoryTag tag("AdamOptimizer::momentum");
+        momentum.allocate(network->param_vec.N);
+    }
+    {
+        MemoryTag tag("AdamOptimizer::std");
+        std.allocate(network->param_vec.N);
+    }
     std += 0.1;
 
-    tmp.allocate(network->param_vec.N);
+    {
+        MemoryTag tag("AdamOptimizer::tmp");
+        tmp.allocate(network->param_vec.N);
+    }
+    MemoryTag tag("AdamOptimizer::tmp2");
     tmp2.allocate(network->param_vec.N);
 }
 
 template <typename F> void AdamOptimizer<F>::update() {
     if (!network)
         throw std::runtime_error("No network registered");
-    tmp = network->grad_vec;
-    tmp.pow(2);
-    tmp *= (1.0 - beta);
-    std *= beta;
-    std += tmp;
-
-    tmp2 = std;
-    tmp2.sqrt();
-    tmp2 += eps;
-    tmp = network->grad_vec;
-    tmp /= tmp2;
-
-    momentum *= momentum_factor;
-    tmp *= (1.0 - momentum_factor);
-    momentum += tmp;
-    tmp = momentum;
-    tmp *= lr;
-
-    network->param_vec += tmp;
+    update(0, network->param_vec.N);
+    network->touch_parameters();
+}
+
+template <typename F> void AdamOptimizer<F>::update(int begin, int end) {
+    if (!network)
+        throw std::runtime_error("No network registered");
+    ProfileScope scope("update", [] { return string("AdamOptimizer::update"); });
+    int n = end - begin;
+    CudaVec<F> grad(network->grad_vec.data + begin, n), param(network->param_vec.data + begin, n);
+    CudaVec<F> m(momentum.data + begin, n), s(std.data + begin, n);
+    CudaVec<F> t(tmp.data + begin, n), t2(tmp2.data + begin, n);
+
+    t = grad;
+    t.pow(2);
+    t *= (1.0 - beta) * this->grad_scale * this->grad_scale;
+    s *= beta;
+    s += t;
+
+    t2 = s;
+    t2.sqrt();
+    t2 += eps;
+    t = grad;
+    t /= t2;
+
+    m *= momentum_factor;
+    t *= (1.0 - momentum_factor) * this->grad_scale;
+    m += t;
+    t = m;
+    t *= lr;
+
+    param += t;
 }
 
 template <typename F> void AdamOptimizer<F>::set_lr(F lr_) { lr = lr_; }
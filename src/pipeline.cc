@@ -0,0 +1,411 @@
+#include "dexe/pipeline.h"
+#include "dexe/handler.h"
+#include "dexe/operations.h"
+#include "dexe/profiler.h"
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+
+using namespace std;
+
+namespace dexe {
+
+namespace {
+void add_unique(vector<int> &list, int value) {
+    if (find(list.begin(), list.end(), value) == list.end())
+        list.push_back(value);
+}
+} // namespace
+
+// Deliveries to a stage per micro-batch: activations by its producers, gradients by its consumers.
+// The mutex also serialises consumers adding into the gradients of our slots
+template <typename F> struct Pipeline<F>::Mailbox {
+    std::mutex mutex;
+    std::condition_variable changed;
+    vector<int> activations, gradients;
+};
+
+template <typename F>
+Pipeline<F>::Pipeline(Network<F> &network_, Optimizer<F> &optimizer_, int loss_, int n_stages_)
+    : network(network_), optimizer(optimizer_), loss(loss_), n_stages(n_stages_) {
+    if (n_stages < 1)
+        throw DexeException("Pipeline needs at least one stage, got:", n_stages);
+    network.finish();
+    for (int s(0); s < n_stages; ++s)
+        threads.emplace_back(&Pipeline<F>::work, this, s);
+}
+
+template <typename F> Pipeline<F>::~Pipeline() {
+    {
+        lock_guard<mutex> lock(stage_mutex);
+        stopping = true;
+    }
+    stage_changed.notify_all();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+// Every stage keeps its thread, so the handle its algorithms and workspace were chosen for in
+// prepare is the one that runs them
+template <typename F> void Pipeline<F>::work(int s) {
+    int seen(0);
+    while (true) {
+        {
+            unique_lock<mutex> lock(stage_mutex);
+            stage_changed.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping)
+                break;
+            seen = generation;
+        }
+        run_stage(s, *job_batches, *job_losses);
+        Handler::sync_stream();
+        {
+            lock_guard<mutex> lock(stage_mutex);
+            ++n_done;
+        }
+        stage_changed.notify_all();
+    }
+    // handles are per thread, clean up the ones this stage created
+    Handler::deinit();
+}
+
+template <typename F> void Pipeline<F>::balance(CostReport const &report) {
+    node_costs.assign(network.operations.size(), 0);
+    for (auto &node : report.nodes)
+        if (node.index >= 0 && size_t(node.index) < node_costs.size())
+            node_costs[node.index] = node.forward_time + node.backward_time;
+    partitioned = false; // partition again at the next step
+}
+
+// Cuts the non-input steps of the plan into contiguous stages, minimising the cost of the most
+// expensive stage, and sets up the replicas of every stage
+template <typename F>
+void Pipeline<F>::partition(vector<vector<Tensor<F> *>> const &micro_batches) {
+    partitioned = false;
+    n_micro = micro_batches.size();
+    for (size_t i(0); i < network.inputs.size(); ++i)
+        network.load_input(network.inputs[i], *micro_batches[0][i]);
+    // the network may evict the plan from its cache later, only its shapes are kept
+    auto &plan = network.compile(network.inputs, vector<int>{loss});
+    input_shapes = plan.input_shapes;
+
+    size_t n_nodes = network.operations.size();
+    shapes.assign(n_nodes, TensorShape());
+    for (size_t p(0); p < plan.steps.size(); ++p)
+        shapes[plan.steps[p].index] = plan.shapes[p];
+
+    vector<int> work;
+    vector<double> prefix{0};
+    for (size_t p(0); p < plan.steps.size(); ++p) {
+        auto &step = plan.steps[p];
+        if (step.is_input)
+            continue;
+        double cost(0);
+        if (node_costs.size() == n_nodes)
+            cost = node_costs[step.index];
+        else {
+            vector<TensorShape> in;
+            for (auto idx : network.input_indices[step.index])
+                in.push_back(shapes[idx]);
+            auto c = network.operations[step.index]->cost(in, shapes[step.index]);
+            cost = c.forward_flops + c.backward_flops;
+        }
+        work.push_back(p);
+        prefix.push_back(prefix.back() + cost);
+    }
+    int W = work.size(), S = n_stages;
+    if (S > W)
+        throw DexeException("Pipeline: more stages than steps, steps:", W);
+
+    // best[s][i]: smallest maximum stage cost when the first i steps form s + 1 stages
+    auto infinity = numeric_limits<double>::infinity();
+    vector<vector<double>> best(S, vector<double>(W + 1, infinity));
+    vector<vector<int>> cut(S, vector<int>(W + 1, 0));
+    for (int i(1); i <= W; ++i)
+        best[0][i] = prefix[i];
+    for (int s(1); s < S; ++s)
+        for (int i(s + 1); i <= W; ++i)
+            for (int j(s); j < i; ++j) {
+                double worst = max(best[s - 1][j], prefix[i] - prefix[j]);
+                if (worst < best[s][i]) {
+                    best[s][i] = worst;
+                    cut[s][i] = j;
+                }
+            }
+
+    stages.assign(S, PipelineStage());
+    owner.assign(n_nodes, -1);
+    for (int s(S - 1), end(W); s >= 0; --s) {
+        int start = cut[s][end];
+        auto &stage = stages[s];
+        stage.begin = work[start];
+        stage.end = work[end - 1] + 1;
+        stage.cost = prefix[end] - prefix[start];
+        stage.n_slots = min(S - s, n_micro);
+        for (int p(stage.begin); p < stage.end; ++p)
+            if (!plan.steps[p].is_input)
+                owner[plan.steps[p].index] = s;
+        end = start;
+    }
+
+    for (int s(0); s < S; ++s) {
+        auto &stage = stages[s];
+        for (int p(stage.begin); p < stage.end; ++p) {
+            if (plan.steps[p].is_input)
+                continue;
+            for (auto idx : network.input_indices[plan.steps[p].index]) {
+                if (owner[idx] < 0) {
+                    add_unique(stage.loads, idx);
+                } else if (owner[idx] != s) {
+                    auto &producer = stages[owner[idx]];
+                    add_unique(stage.receives, idx);
+                    add_unique(stage.producers, owner[idx]);
+                    add_unique(producer.sends, idx);
+                    add_unique(producer.consumers, s);
+                }
+            }
+        }
+    }
+
+    // every slot gets its own activations, parameters and their gradients are shared
+    slots.clear();
+    steps.clear();
+    slots.resize(S);
+    steps.resize(S);
+    for (int s(0); s < S; ++s) {
+        slots[s] = network.replicate(stages[s].n_slots); // gradients add into the network's
+        for (auto &replica : slots[s]) {
+            vector<ExecutionStep<F>> resolved;
+            for (int p(stages[s].begin); p < stages[s].end; ++p) {
+                if (plan.steps[p].is_input)
+                    continue;
+                ExecutionStep<F> step;
+                step.index = plan.steps[p].index;
+                for (auto idx : replica->input_indices[step.index]) {
+                    step.inputs.push_back(replica->tensors[idx].x.get());
+                    step.input_grads.push_back(replica->tensors[idx].grad.get());
+                }
+                step.outputs.push_back(replica->tensors[step.index].x.get());
+                step.output_grads.push_back(replica->tensors[step.index].grad.get());
+                resolved.emplace_back(std::move(step));
+            }
+            steps[s].emplace_back(std::move(resolved));
+        }
+    }
+    ready.assign(S, 0);
+
+    mailboxes.clear();
+    for (int s(0); s < S; ++s)
+        mailboxes.emplace_back(make_unique<Mailbox>());
+    partitioned = true;
+}
+
+// Sizes the tensors of every slot and runs the dry runs, on the thread of the stage
+// so algorithms and workspaces are chosen for its handle
+template <typename F> void Pipeline<F>::prepare(int s) {
+    MemoryTag tag("Pipeline::stage " + to_string(s));
+    auto &stage = stages[s];
+    for (int k(0); k < stage.n_slots; ++k) {
+        auto &replica = *slots[s][k];
+        auto reshape = [&](int idx, TensorShape shape) {
+            replica.tensors[idx].x->reshape(shape);
+            replica.tensors[idx].grad->reshape(shape);
+        };
+        for (auto &step : steps[s][k])
+            reshape(step.index, shapes[step.index]);
+        for (auto idx : stage.loads)
+            reshape(idx, shapes[idx]);
+        for (auto idx : stage.receives)
+            reshape(idx, shapes[idx]);
+
+        for (auto &step : steps[s][k]) {
+            ProfileScope scope("dry_run", [&] { return replica.label(step.index); });
+            if (!replica.operations[step.index]->forward_dry_run(step.inputs, step.outputs)) {
+                ostringstream oss;
+                oss << "Failure when preparing step [" << step.index
+                    << "]: " << replica.names[step.index] << endl;
+                throw std::runtime_error(oss.str());
+            }
+        }
+        for (auto it = steps[s][k].rbegin(); it != steps[s][k].rend(); ++it) {
+            ProfileScope scope("dry_run", [&] { return replica.label(it->index); });
+            replica.operations[it->index]->backward_dry_run(it->inputs, it->outputs,
+                                                            it->input_grads, it->output_grads);
+        }
+    }
+}
+
+template <typename F> void Pipeline<F>::wait(int s, function<bool(Mailbox &)> ready) {
+    auto &box = *mailboxes[s];
+    unique_lock<mutex> lock(box.mutex);
+    box.changed.wait(lock, [&] { return failed || ready(box); });
+    if (failed)
+        throw std::runtime_error("Pipeline: another stage failed");
+}
+
+template <typename F> void Pipeline<F>::deliver(vector<int> const &targets, bool gradients, int m) {
+    for (auto t : targets) {
+        auto &box = *mailboxes[t];
+        {
+            lock_guard<mutex> lock(box.mutex);
+            ++(gradients ? box.gradients : box.activations)[m];
+        }
+        box.changed.notify_all();
+    }
+}
+
+// Wakes up every waiting stage, they see the failure and give up
+template <typename F> void Pipeline<F>::fail() {
+    for (auto &box : mailboxes) {
+        { lock_guard<mutex> lock(box->mutex); }
+        box->changed.notify_all();
+    }
+}
+
+template <typename F>
+void Pipeline<F>::forward(int s, int m, vector<Tensor<F> *> const &inputs, vector<F> &losses) {
+    auto &stage = stages[s];
+    wait(s, [&](Mailbox &box) { return box.activations[m] == int(stage.producers.size()); });
+
+    // our slot was last used by micro-batch m - n_slots, whose backward already ran
+    auto &replica = *slots[s][m % stage.n_slots];
+    for (auto idx : stage.loads) {
+        auto i = find(network.inputs.begin(), network.inputs.end(), idx) - network.inputs.begin();
+        replica.load_input(idx, *inputs[i]);
+    }
+    for (auto idx : stage.receives) {
+        int p = owner[idx];
+        replica.tensors[idx].x->from_tensor(*slots[p][m % stages[p].n_slots]->tensors[idx].x);
+        replica.tensors[idx].grad->zero();
+    }
+    for (auto &step : steps[s][m % stage.n_slots]) {
+        ProfileScope scope("forward", [&] { return replica.label(step.index); });
+        step.outputs[0]->zero();
+        replica.operations[step.index]->forward(step.inputs, step.outputs);
+        // consumers in later stages add into it before our backward
+        step.output_grads[0]->zero();
+    }
+    Handler::sync_stream();
+    if (owner[loss] == s)
+        losses[m] = replica.tensors[loss].x->to_vector()[0];
+    deliver(stage.consumers, false, m);
+}
+
+template <typename F> void Pipeline<F>::backward(int s, int m) {
+    auto &stage = stages[s];
+    wait(s, [&](Mailbox &box) { return box.gradients[m] == int(stage.consumers.size()); });
+
+    auto &replica = *slots[s][m % stage.n_slots];
+    auto &resolved = steps[s][m % stage.n_slots];
+    for (auto it = resolved.rbegin(); it != resolved.rend(); ++it) {
+        ProfileScope scope("backward", [&] { return replica.label(it->index); });
+        replica.operations[it->index]->backward(it->inputs, it->outputs, it->input_grads,
+                                                it->output_grads);
+    }
+    Handler::sync_stream();
+
+    for (auto idx : stage.receives) {
+        int p = owner[idx];
+        auto &target = *slots[p][m % stages[p].n_slots]->tensors[idx].grad;
+        lock_guard<mutex> lock(mailboxes[p]->mutex);
+        target.add(*replica.tensors[idx].grad, 1);
+        Handler::sync_stream();
+    }
+    deliver(stage.producers, true, m);
+}
+
+// One forward one backward: a warm-up of forwards fills the pipeline, then every forward
+// is followed by the backward of the oldest micro-batch in flight
+template <typename F>
+void Pipeline<F>::run_stage(int s, vector<vector<Tensor<F> *>> const &micro_batches,
+                            vector<F> &losses) {
+    try {
+        if (!ready[s]) {
+            prepare(s);
+            ready[s] = true;
+        }
+        int M = micro_batches.size();
+        int warm_up = min(n_stages - s - 1, M);
+        for (int m(0); m < warm_up; ++m)
+            forward(s, m, micro_batches[m], losses);
+        for (int m(warm_up); m < M; ++m) {
+            forward(s, m, micro_batches[m], losses);
+            backward(s, m - warm_up);
+        }
+        for (int m(M - warm_up); m < M; ++m)
+            backward(s, m);
+    } catch (...) {
+        bool first(false);
+        if (failed.compare_exchange_strong(first, true))
+            error = current_exception();
+        fail();
+    }
+}
+
+template <typename F> F Pipeline<F>::step(vector<vector<Tensor<F> *>> const &micro_batches) {
+    if (micro_batches.empty())
+        throw DexeException("Pipeline::step: no micro-batches");
+    for (auto &inputs : micro_batches)
+        if (inputs.size() != network.inputs.size())
+            throw DexeException("Pipeline::step: expected one tensor per input, got:",
+                                inputs.size());
+
+    bool repartition = !partitioned || micro_batches.size() != size_t(n_micro);
+    for (size_t i(0); partitioned && i < network.inputs.size(); ++i)
+        if (micro_batches[0][i]->shape != input_shapes[i])
+            repartition = true;
+    if (repartition)
+        partition(micro_batches);
+
+    int M = micro_batches.size();
+    for (auto &box : mailboxes) {
+        box->activations.assign(M, 0);
+        box->gradients.assign(M, 0);
+    }
+    failed = false;
+    error = nullptr;
+    network.grad_vec.zero();
+    Handler::sync_stream(); // the stages run on their own streams
+
+    vector<F> losses(M);
+    {
+        unique_lock<mutex> lock(stage_mutex);
+        job_batches = &micro_batches;
+        job_losses = &losses;
+        n_done = 0;
+        ++generation;
+        stage_changed.notify_all();
+        stage_changed.wait(lock, [&] { return n_done == n_stages; });
+    }
+    if (error)
+        rethrow_exception(error);
+
+    F grad_scale = optimizer.grad_scale;
+    optimizer.grad_scale = grad_scale / M;
+    optimizer.update();
+    optimizer.grad_scale = grad_scale;
+
+    F total(0);
+    for (auto l : losses)
+        total += l;
+    return total / M;
+}
+
+template <typename F> void Pipeline<F>::describe(ostream &out) {
+    double total(0);
+    for (auto &stage : stages)
+        total += stage.cost;
+    for (size_t s(0); s < stages.size(); ++s) {
+        auto &stage = stages[s];
+        out << "stage " << s << ": steps " << stage.begin << "-" << stage.end << ", cost "
+            << stage.cost << " (" << (total > 0 ? 100 * stage.cost / total : 0)
+            << "%), slots " << stage.n_slots << ", receives " << stage.receives.size()
+            << " nodes, sends " << stage.sends.size() << " nodes" << endl;
+    }
+}
+
+template struct Pipeline<float>;
+template struct Pipeline<double>;
+
+} // namespace dexe
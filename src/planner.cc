@@ -0,0 +1,118 @@
+#include "dexe/planner.h"
+#include "dexe/memory.h"
+#include "dexe/util.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <numeric>
+
+using namespace std;
+
+namespace dexe {
+
+void MemoryPlan::describe(ostream &out) {
+    out << "buffers: " << offsets.size() << " naive: " << naive_bytes
+        << " planned: " << arena_bytes << " live peak: " << live_peak_bytes;
+    if (arena_bytes)
+        out << " saving: " << double(naive_bytes) / arena_bytes << "x";
+}
+
+MemoryPlan plan_memory(vector<BufferRequest> const &requests, size_t alignment) {
+    MemoryPlan plan;
+    plan.offsets.resize(requests.size());
+
+    auto aligned = [alignment](size_t bytes) {
+        return (bytes + alignment - 1) / alignment * alignment;
+    };
+
+    int last_step = 0;
+    for (auto &r : requests) {
+        plan.naive_bytes += r.bytes;
+        last_step = max(last_step, r.last);
+    }
+
+    // lower bound, the most memory that is live at any single step
+    vector<size_t> live(last_step + 1);
+    for (auto &r : requests)
+        for (int t(r.first); t <= r.last; ++t)
+            live[t] += r.bytes;
+    for (auto l : live)
+        plan.live_peak_bytes = max(plan.live_peak_bytes, l);
+
+    vector<int> order(requests.size());
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(),
+                [&requests](int a, int b) { return requests[a].bytes > requests[b].bytes; });
+
+    vector<int> placed;
+    vector<pair<size_t, size_t>> taken; // [begin, end) ranges of live placed buffers
+    for (auto i : order) {
+        auto &r = requests[i];
+        size_t bytes = aligned(r.bytes);
+
+        taken.clear();
+        for (auto j : placed)
+            if (requests[j].first <= r.last && r.first <= requests[j].last)
+                taken.emplace_back(plan.offsets[j], plan.offsets[j] + aligned(requests[j].bytes));
+        sort(taken.begin(), taken.end());
+
+        // find the smallest gap that fits, otherwise put it after everything that is live
+        size_t best_offset = 0, best_gap = SIZE_MAX;
+        size_t cursor = 0;
+        for (auto &t : taken) {
+            if (t.first > cursor) {
+                size_t gap = t.first - cursor;
+                if (gap >= bytes && gap < best_gap) {
+                    best_gap = gap;
+                    best_offset = cursor;
+                }
+            }
+            cursor = max(cursor, t.second);
+        }
+        if (best_gap == SIZE_MAX)
+            best_offset = cursor;
+
+        plan.offsets[i] = best_offset;
+        plan.arena_bytes = max(plan.arena_bytes, best_offset + bytes);
+        placed.push_back(i);
+    }
+    return plan;
+}
+
+Arena::Arena(ArenaLocation location_) : location(location_) {}
+
+Arena::~Arena() { free(); }
+
+void Arena::allocate(size_t bytes) {
+    if (bytes == size)
+        return;
+    free();
+    if (!bytes)
+        return;
+
+    if (location == ArenaLocation::DEVICE) {
+        MemoryTag tag("arena");
+        handle_error(cudaMalloc((void **)&data, bytes));
+        MemoryTracker::allocated(data, bytes);
+    } else {
+        data = reinterpret_cast<char *>(aligned_alloc(256, (bytes + 255) / 256 * 256));
+        if (!data)
+            throw DexeException("failed to allocate host arena of bytes:", bytes);
+    }
+    size = bytes;
+}
+
+void Arena::free() {
+    if (!data)
+        return;
+    if (location == ArenaLocation::DEVICE) {
+        MemoryTracker::released(data);
+        handle_error(cudaFree(data));
+    } else
+        std::free(data);
+    data = nullptr;
+    size = 0;
+}
+
+} // namespace dexe
@@ -0,0 +1,385 @@
+#include "dexe/process_group.h"
+#include "dexe/util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace dexe {
+
+namespace {
+uint64_t const SEGMENT_MAGIC = 0x6465786573686d31; // "dexeshm1"
+size_t const SLOT_ALIGNMENT = 4096;
+auto const JOIN_TIMEOUT = chrono::seconds(60);
+
+// Shared between launch and the workers it forks: the nonce of the run, which names the
+// segments of its groups, and whether the run is being torn down
+struct LaunchState {
+    atomic<uint64_t> nonce;
+    atomic<int> aborted;
+};
+LaunchState *launch_state = nullptr;
+
+// Linux cpu list format, e.g. "0-15,32-47"
+vector<int> parse_cpu_list(string list) {
+    vector<int> cpus;
+    stringstream ss(list);
+    string range;
+    while (getline(ss, range, ',')) {
+        if (range.empty() || range == "\n")
+            continue;
+        auto dash = range.find('-');
+        int first = stoi(range.substr(0, dash));
+        int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+        for (int cpu(first); cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+} // namespace
+
+// Lives at the start of the segment, atomics have to be lock free to work between processes
+struct ProcessGroup::Header {
+    atomic<uint64_t> magic;
+    atomic<uint64_t> nonce; // of the run that created the segment
+    atomic<int> joined;
+    atomic<int> arrived;
+    atomic<unsigned> generation;
+    atomic<int> aborted; // set by a rank that failed, the others stop waiting for it
+};
+
+#ifndef _WIN32
+
+ProcessGroup::ProcessGroup(string name_, int rank_, int world_size_, size_t slot_bytes_)
+    : rank(rank_), world_size(world_size_), name("/" + name_) {
+    static_assert(atomic<int>::is_always_lock_free && atomic<uint64_t>::is_always_lock_free,
+                  "shared memory barrier needs lock free atomics");
+    if (world_size < 1 || rank < 0 || rank >= world_size)
+        throw DexeException("ProcessGroup: invalid rank:", rank);
+
+    // a segment left behind by an earlier run can't have the name of this one
+    uint64_t nonce = launch_state ? launch_state->nonce.load() : 0;
+    if (nonce)
+        name += "." + to_string(nonce);
+
+    slot_bytes = (slot_bytes_ + SLOT_ALIGNMENT - 1) / SLOT_ALIGNMENT * SLOT_ALIGNMENT;
+    segment_bytes = SLOT_ALIGNMENT + slot_bytes * world_size;
+
+    int fd = -1;
+    auto deadline = chrono::steady_clock::now() + JOIN_TIMEOUT;
+    if (rank == 0) {
+        shm_unlink(name.c_str()); // left behind by a crashed run
+        fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0 || ftruncate(fd, segment_bytes) != 0)
+            throw std::runtime_error("ProcessGroup: couldn't create shared memory " + name + ": " +
+                                     strerror(errno));
+    } else {
+        // wait for rank 0 to create and size the segment
+        while (true) {
+            fd = shm_open(name.c_str(), O_RDWR, 0600);
+            struct stat st;
+            if (fd >= 0 && fstat(fd, &st) == 0 && size_t(st.st_size) == segment_bytes)
+                break;
+            if (fd >= 0)
+                close(fd);
+            if (chrono::steady_clock::now() > deadline)
+                throw std::runtime_error("ProcessGroup: timeout waiting for rank 0 to create " +
+                                         name);
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+
+    void *address = mmap(nullptr, segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED)
+        throw std::runtime_error(string("ProcessGroup: mmap failed: ") + strerror(errno));
+    segment = reinterpret_cast<char *>(address);
+    header = reinterpret_cast<Header *>(segment);
+
+    if (rank == 0) {
+        new (header) Header();
+        header->nonce = nonce;
+        header->joined = 0;
+        header->arrived = 0;
+        header->generation = 0;
+        header->aborted = 0;
+        header->magic = SEGMENT_MAGIC;
+    } else {
+        while (header->magic != SEGMENT_MAGIC) {
+            if (chrono::steady_clock::now() > deadline)
+                throw std::runtime_error("ProcessGroup: segment " + name + " never initialised");
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        if (header->nonce != nonce)
+            throw std::runtime_error("ProcessGroup: segment " + name + " belongs to another run");
+    }
+
+    // first touch by the owner places the slot on our NUMA node
+    memset(slot(rank), 0, slot_bytes);
+
+    ++header->joined;
+    while (header->joined < world_size) {
+        if (aborted())
+            throw std::runtime_error("ProcessGroup: aborted while joining " + name);
+        if (chrono::steady_clock::now() > deadline)
+            throw std::runtime_error("ProcessGroup: timeout waiting for all ranks to join " + name);
+        this_thread::yield();
+    }
+    // everyone has it mapped, so the name can go and a killed run leaves nothing behind
+    if (rank == 0)
+        shm_unlink(name.c_str());
+}
+
+ProcessGroup::~ProcessGroup() {
+    if (!segment)
+        return;
+    // nobody may still read our slot when it goes away. When we're unwinding from an error the
+    // others may never arrive, so they're told to give up instead.
+    if (uncaught_exceptions())
+        header->aborted = 1;
+    else
+        try {
+            barrier();
+        } catch (exception &e) {
+            cerr << e.what() << endl;
+        }
+    munmap(segment, segment_bytes);
+}
+
+bool ProcessGroup::aborted() {
+    return header->aborted.load() || (launch_state && launch_state->aborted.load());
+}
+
+// Sense reversing barrier: the last rank to arrive starts the next generation
+void ProcessGroup::barrier() {
+    ++generation;
+    if (header->arrived.fetch_add(1) == world_size - 1) {
+        header->arrived = 0;
+        header->generation.store(generation);
+        return;
+    }
+    auto deadline = chrono::steady_clock::now() + chrono::duration<double>(barrier_timeout);
+    int spins(0);
+    while (header->generation.load() != generation) {
+        if (++spins < 1000)
+            continue;
+        this_thread::yield();
+        if (spins % 1024)
+            continue;
+        if (aborted())
+            throw std::runtime_error("ProcessGroup: another rank failed, aborting " + name);
+        if (chrono::steady_clock::now() > deadline) {
+            header->aborted = 1;
+            throw std::runtime_error("ProcessGroup: barrier timeout in " + name);
+        }
+    }
+}
+
+int ProcessGroup::launch(int world_size, function<int(int rank)> worker) {
+    void *state = mmap(nullptr, sizeof(LaunchState), PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (state == MAP_FAILED)
+        throw std::runtime_error(string("ProcessGroup: mmap failed: ") + strerror(errno));
+    launch_state = new (state) LaunchState();
+    random_device random;
+    uint64_t nonce(0);
+    while (!nonce)
+        nonce = (uint64_t(random()) << 32) ^ random() ^ uint64_t(getpid());
+    launch_state->nonce = nonce;
+    launch_state->aborted = 0;
+
+    vector<pid_t> children;
+    int n_nodes = n_numa_nodes();
+    for (int rank(0); rank < world_size; ++rank) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            for (auto child : children)
+                kill(child, SIGKILL);
+            for (auto child : children)
+                waitpid(child, nullptr, 0);
+            throw std::runtime_error(string("ProcessGroup: fork failed: ") + strerror(errno));
+        }
+        if (pid == 0) {
+            int result(1);
+            try {
+                pin_to_numa_node(rank % n_nodes);
+                result = worker(rank);
+            } catch (exception &e) {
+                cerr << "rank " << rank << ": " << e.what() << endl;
+            }
+            // skip the exit handlers of the parent's copy of the process
+            cout.flush();
+            cerr.flush();
+            _exit(result);
+        }
+        children.push_back(pid);
+    }
+
+    // the first worker that fails takes the others down, ranks waiting for it would hang
+    int failed(0);
+    size_t n_running(children.size());
+    while (n_running) {
+        bool reaped(false);
+        for (auto &pid : children) {
+            int status(0);
+            if (!pid || waitpid(pid, &status, WNOHANG) != pid)
+                continue;
+            pid = 0;
+            --n_running;
+            reaped = true;
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+                continue;
+            ++failed;
+            if (!launch_state->aborted.exchange(1))
+                for (auto other : children)
+                    if (other)
+                        kill(other, SIGKILL);
+        }
+        if (!reaped)
+            this_thread::sleep_for(chrono::milliseconds(10));
+    }
+
+    munmap(state, sizeof(LaunchState));
+    launch_state = nullptr;
+    return failed;
+}
+
+int ProcessGroup::n_numa_nodes() {
+    int n(0);
+    while (ifstream("/sys/devices/system/node/node" + to_string(n) + "/cpulist"))
+        ++n;
+    return max(n, 1);
+}
+
+void ProcessGroup::pin_to_numa_node(int node) {
+#ifdef __linux__
+    ifstream in("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+    string list;
+    if (!in || !getline(in, list))
+        return; // no numa information, leave the scheduler alone
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : parse_cpu_list(list))
+        CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+        cerr << "ProcessGroup: couldn't pin to numa node " << node << endl;
+#endif
+}
+
+#else
+
+ProcessGroup::ProcessGroup(string name_, int rank_, int world_size_, size_t slot_bytes_) {
+    throw std::runtime_error("ProcessGroup needs POSIX shared memory");
+}
+ProcessGroup::~ProcessGroup() {}
+bool ProcessGroup::aborted() { return false; }
+void ProcessGroup::barrier() {}
+int ProcessGroup::launch(int world_size, function<int(int rank)> worker) {
+    throw std::runtime_error("ProcessGroup needs POSIX shared memory");
+}
+int ProcessGroup::n_numa_nodes() { return 1; }
+void ProcessGroup::pin_to_numa_node(int node) {}
+
+#endif
+
+char *ProcessGroup::slot(int r) {
+    return segment + SLOT_ALIGNMENT + slot_bytes * ((r + world_size) % world_size);
+}
+
+// Ring all-reduce in the slots. The data is cut in world_size chunks. In the reduce-scatter
+// every step adds the previous rank's partial sum of one chunk to our own, after world_size - 1
+// steps we hold the full sum of chunk rank + 1. The all-gather then passes the sums around.
+// Within a step every rank writes a different chunk than its successor reads.
+template <typename F> void ProcessGroup::all_reduce(F *data, size_t n) {
+    if (n * sizeof(F) > slot_bytes)
+        throw DexeException("ProcessGroup::all_reduce: data doesn't fit in a slot, bytes:",
+                            n * sizeof(F));
+    F *own = reinterpret_cast<F *>(slot(rank));
+    F *previous = reinterpret_cast<F *>(slot(rank - 1));
+    copy(data, data + n, own);
+    int W = world_size;
+    size_t chunk = (n + W - 1) / W;
+    auto range = [&](int c, size_t &begin, size_t &end) {
+        c = ((c % W) + W) % W;
+        begin = min(n, c * chunk);
+        end = min(n, begin + chunk);
+    };
+
+    barrier();
+    for (int s(0); s < W - 1; ++s) {
+        size_t begin, end;
+        range(rank - s - 1, begin, end);
+        for (size_t i(begin); i < end; ++i)
+            own[i] += previous[i];
+        barrier();
+    }
+    for (int s(0); s < W - 1; ++s) {
+        size_t begin, end;
+        range(rank - s, begin, end);
+        copy(previous + begin, previous + end, own + begin);
+        barrier();
+    }
+    copy(own, own + n, data);
+}
+
+template <typename F> void ProcessGroup::broadcast(F *data, size_t n, int root) {
+    if (root < 0 || root >= world_size)
+        throw DexeException("ProcessGroup::broadcast: invalid root:", root);
+    if (n * sizeof(F) > slot_bytes)
+        throw DexeException("ProcessGroup::broadcast: data doesn't fit in a slot, bytes:",
+                            n * sizeof(F));
+    F *source = reinterpret_cast<F *>(slot(root));
+    if (rank == root)
+        copy(data, data + n, source);
+    barrier();
+    if (rank != root)
+        copy(source, source + n, data);
+    barrier();
+}
+
+template <typename F> void ProcessGroup::broadcast_parameters(Network<F> &network, int root) {
+    auto params = network.to_vector();
+    broadcast(params.data(), params.size(), root);
+    network.from_vector(params);
+}
+
+template <typename F>
+void ProcessGroup::all_reduce_gradients(Network<F> &network, bool average) {
+    network.finish();
+    auto grad = network.grad_vec.to_vector();
+    all_reduce(grad.data(), grad.size());
+    if (average)
+        for (auto &g : grad)
+            g /= world_size;
+    network.grad_vec.from_vector(grad);
+}
+
+template void ProcessGroup::all_reduce<float>(float *, size_t);
+template void ProcessGroup::all_reduce<double>(double *, size_t);
+template void ProcessGroup::broadcast<float>(float *, size_t, int);
+template void ProcessGroup::broadcast<double>(double *, size_t, int);
+template void ProcessGroup::broadcast_parameters<float>(Network<float> &, int);
+template void ProcessGroup::broadcast_parameters<double>(Network<double> &, int);
+template void ProcessGroup::all_reduce_gradients<float>(Network<float> &, bool);
+template void ProcessGroup::all_reduce_gradients<double>(Network<double> &, bool);
+
+} // namespace dexe
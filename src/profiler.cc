@@ -0,0 +1,151 @@
+#include "dexe/profiler.h"
+#include "dexe/handler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+using namespace std;
+
+namespace dexe {
+
+namespace {
+atomic<bool> active(false);
+atomic<bool> synchronised(true);
+atomic<int> n_threads(0);
+Profiler::Clock::time_point const epoch = Profiler::Clock::now();
+mutex events_mutex;
+vector<ProfileEvent> recorded;
+
+int thread_index() {
+    thread_local int index = n_threads++;
+    return index;
+}
+
+double microseconds(Profiler::Clock::duration d) {
+    return chrono::duration<double, micro>(d).count();
+}
+
+void write_escaped(ostream &out, string const &s) {
+    for (auto c : s) {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20)
+            out << ' ';
+        else
+            out << c;
+    }
+}
+} // namespace
+
+void Profiler::enable(bool synchronise) {
+    synchronised = synchronise;
+    active = true;
+}
+
+void Profiler::disable() { active = false; }
+
+bool Profiler::enabled() { return active.load(memory_order_relaxed); }
+
+void Profiler::clear() {
+    lock_guard<mutex> lock(events_mutex);
+    recorded.clear();
+}
+
+double Profiler::timestamp(Clock::time_point t) { return microseconds(t - epoch); }
+
+void Profiler::record(string name, char const *category, Clock::time_point start) {
+    if (synchronised)
+        Handler::sync_stream();
+    auto end = Clock::now();
+
+    ProfileEvent event;
+    event.name = move(name);
+    event.category = category;
+    event.thread = thread_index();
+    event.duration = microseconds(end - start);
+
+    event.start = timestamp(start);
+    lock_guard<mutex> lock(events_mutex);
+    recorded.emplace_back(move(event));
+}
+
+vector<ProfileEvent> Profiler::events() {
+    lock_guard<mutex> lock(events_mutex);
+    return recorded;
+}
+
+void Profiler::write_trace(string path) {
+    ofstream out(path);
+    if (!out)
+        throw std::runtime_error("Couldn't open trace file " + path);
+
+    out << "{\"traceEvents\":[" << endl;
+    bool first(true);
+    out << fixed << setprecision(3);
+    for (auto &e : events()) {
+        if (!first)
+            out << "," << endl;
+        first = false;
+        out << "{\"name\":\"";
+        write_escaped(out, e.name);
+        out << "\",\"cat\":\"" << e.category << "\",\"ph\":\"X\",\"ts\":" << e.start
+            << ",\"dur\":" << e.duration << ",\"pid\":0,\"tid\":" << e.thread << "}";
+    }
+    for (auto &e : MemoryTracker::timeline()) {
+        if (!first)
+            out << "," << endl;
+        first = false;
+        out << "{\"name\":\"device memory\",\"ph\":\"C\",\"ts\":" << e.time
+            << ",\"pid\":0,\"args\":{\"MB\":" << e.total / 1e6 << "}}";
+    }
+    out << endl << "],\"displayTimeUnit\":\"ms\"}" << endl;
+}
+
+void Profiler::summary(ostream &out) {
+    map<pair<string, string>, vector<double>> durations;
+    for (auto &e : events())
+        durations[{e.category, e.name}].push_back(e.duration);
+
+    struct Row {
+        string category, name;
+        size_t count;
+        double total, mean, p95;
+    };
+    vector<Row> rows;
+    for (auto &entry : durations) {
+        auto &d = entry.second;
+        sort(d.begin(), d.end());
+        double total(0);
+        for (auto v : d)
+            total += v;
+        // nearest rank: the smallest value with at least 95% of the samples at or below it
+        size_t p95 = min(d.size() - 1, static_cast<size_t>(ceil(0.95 * d.size())) - 1);
+        rows.push_back(Row{entry.first.first, entry.first.second, d.size(), total / 1000,
+                           total / d.size() / 1000, d[p95] / 1000});
+    }
+    sort(rows.begin(), rows.end(), [](Row const &a, Row const &b) { return a.total > b.total; });
+
+    double total(0);
+    for (auto &r : rows)
+        total += r.total;
+
+    auto flags = out.flags();
+    out << left << setw(12) << "category" << setw(48) << "name" << right << setw(8) << "count"
+        << setw(12) << "total ms" << setw(10) << "mean ms" << setw(10) << "p95 ms" << setw(8)
+        << "%" << endl;
+    out << fixed << setprecision(3);
+    for (auto &r : rows)
+        out << left << setw(12) << r.category << setw(48) << r.name.substr(0, 47) << right
+            << setw(8) << r.count << setw(12) << r.total << setw(10) << r.mean << setw(10)
+            << r.p95 << setw(8) << setprecision(1) << (total > 0 ? 100 * r.total / total : 0)
+            << setprecision(3) << endl;
+    out.flags(flags);
+}
+
+} // namespace dexe
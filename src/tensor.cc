@@ -1,3 +1,4 @@
+#include <atomic>
 #include <cassert>
 #include <cstdlib>
 
@@ -13,6 +14,12 @@
 using namespace std;
 
 namespace dexe {
+
+namespace {
+// tensor versions are unique over all tensors, a new tensor at a freed address never looks unchanged
+atomic<uint64_t> tensor_clock{0};
+} // namespace
+
 TensorShape::TensorShape(int n, int c, int h) : dimensions{n, c, h} {}
 
 TensorShape::TensorShape(int n, int c, int h, int w) : dimensions{n, c, h, w} {}
@@ -23,19 +30,21 @@ TensorShape::TensorShape(int n, int c, int d, int h, int w)
 TensorShape::TensorShape(std::vector<int> dimensions_)
     : dimensions(dimensions_) {}
 
-int TensorShape::offset(int n_, int c_, int y_, int x_) {
+int TensorShape::offset(int n_, int c_, int y_, int x_, cudnnTensorFormat_t format) {
+    if (format == CUDNN_TENSOR_NHWC)
+        return n_ * (c() * w() * h()) + (y_ * w() + x_) * c() + c_;
     return n_ * (c() * w() * h()) + c_ * (w() * h()) + y_ * w() + x_;
 }
 
-int TensorShape::n_elements() {
+int TensorShape::n_elements() const {
     if (dimensions.empty())
         return 0;
     return calculate_product(dimensions);
 }
 
-int TensorShape::n_dimensions() { return dimensions.size(); }
+int TensorShape::n_dimensions() const { return dimensions.size(); }
 
-int TensorShape::n_pixels() {
+int TensorShape::n_pixels() const {
     if (dimensions.size() <= 2)
         return 1;
     std::vector<int> pixelDims(dimensions.begin() + 2, dimensions.end());
@@ -44,22 +53,22 @@ int TensorShape::n_pixels() {
 
 void TensorShape::set_c(int c) { dimensions[1] = c; }
 
-int TensorShape::n() { return dimensions[0]; }
+int TensorShape::n() const { return dimensions[0]; }
 
-int TensorShape::c() { return dimensions[1]; }
+int TensorShape::c() const { return dimensions[1]; }
 
-int TensorShape::d() {
+int TensorShape::d() const {
     if (dimensions.size() == 5)
         return dimensions[2];
     return 1;
 }
-int TensorShape::h() {
+int TensorShape::h() const {
     if (dimensions.size() == 5)
         return dimensions[3];
     return dimensions[2];
 }
 
-int TensorShape::w() {
+int TensorShape::w() const {
     if (dimensions.size() == 5)
         return dimensions[4];
     return dimensions[3];
@@ -75,6 +84,33 @@ bool TensorShape::operator!=(TensorShape const &other) const {
 
 int &TensorShape::operator[](int index) { return dimensions[index]; }
 
+int TensorShape::operator[](int index) const { return dimensions[index]; }
+
+// NHWC keeps the channels innermost, the spatial dimensions keep their order
+vector<int> dense_strides(TensorShape const &shape, cudnnTensorFormat_t format) {
+    int n_dims = shape.n_dimensions();
+    vector<int> strides(n_dims);
+    if (!n_dims)
+        return strides;
+    if (format == CUDNN_TENSOR_NHWC && n_dims >= 4) {
+        int stride(1);
+        strides[1] = stride;
+        stride *= shape[1];
+        for (int i(n_dims - 1); i > 1; --i) {
+            strides[i] = stride;
+            stride *= shape[i];
+        }
+        strides[0] = stride;
+        return strides;
+    }
+    int stride(1);
+    for (int i(n_dims - 1); i >= 0; --i) {
+        strides[i] = stride;
+        stride *= shape[i];
+    }
+    return strides;
+}
+
 template <typename F> Tensor<F>::Tensor() : owning(true) {
     handle_error(cudnnCreateTensorDescriptor(&td));
 }
@@ -103,7 +139,7 @@ template <typename F> void Tensor<F>::set_descriptor() {
 template <> void Tensor<float>::set_descriptor_typed() {
     if (!shape.n_dimensions() || !shape.n_elements())
         return;
-    handle_error(cudnnSetTensorNdDescriptorEx(td, format, CUDNN_DATA_FLOAT,
+    handle_error(cudnnSetTensorNdDescriptorEx(td, layout(), CUDNN_DATA_FLOAT,
                                               shape.n_dimensions(),
                                               shape.dimensions.data()));
 }
@@ -111,7 +147,7 @@ template <> void Tensor<float>::set_descriptor_typed() {
 template <> void Tensor<double>::set_descriptor_typed() {
     if (!shape.n_dimensions() || !shape.n_elements())
         return;
-    handle_error(cudnnSetTensorNdDescriptorEx(td, format, CUDNN_DATA_DOUBLE,
+    handle_error(cudnnSetTensorNdDescriptorEx(td, layout(), CUDNN_DATA_DOUBLE,
                                               shape.n_dimensions(),
                                               shape.dimensions.data()));
 }
@@ -135,6 +171,15 @@ template <typename F> void Tensor<F>::reshape(TensorShape new_shape) {
     // new shape is the same, no need to do anything
     if (new_shape == shape)
         return;
+    version = ++tensor_clock;
+
+    // bound memory was sized for the old shape, fall back to owning a buffer
+    if (bound && new_shape.n_elements() != shape.n_elements()) {
+        cudavec.data = nullptr;
+        cudavec.N = 0;
+        cudavec.own = true;
+        bound = false;
+    }
 
     // If sizes match but shapes don't, we don't want to deallocate
     if (new_shape.n_elements() != shape.n_elements()) {
@@ -146,15 +191,57 @@ template <typename F> void Tensor<F>::reshape(TensorShape new_shape) {
     set_descriptor();
 }
 
+template <typename F> void Tensor<F>::set_format(cudnnTensorFormat_t new_format) {
+    if (new_format == format)
+        return;
+    version = ++tensor_clock;
+    format = new_format;
+    set_descriptor();
+}
+
+template <typename F> cudnnTensorFormat_t Tensor<F>::layout() const {
+    return shape.n_dimensions() >= 4 ? format : CUDNN_TENSOR_NCHW;
+}
+
+template <typename F> void Tensor<F>::bind(F *data) { bind(data, shape); }
+
+// Binds with the given shape, without ever allocating memory for it
+template <typename F> void Tensor<F>::bind(F *data, TensorShape new_shape) {
+    version = ++tensor_clock;
+    if (!bound)
+        cudavec.free();
+    if (new_shape != shape) {
+        shape = new_shape;
+        set_descriptor();
+    }
+    cudavec.own = false;
+    cudavec.data = data;
+    cudavec.N = shape.n_elements();
+    bound = true;
+}
+
+template <typename F> void Tensor<F>::unbind() {
+    version = ++tensor_clock;
+    if (!bound)
+        return;
+    cudavec.data = nullptr;
+    cudavec.N = 0;
+    cudavec.own = true;
+    bound = false;
+    allocate();
+}
+
 template <typename F> Tensor<F>::~Tensor() {
     handle_error(cudnnDestroyTensorDescriptor(td));
 }
 
 template <typename F> void Tensor<F>::zero() {
+    version = ++tensor_clock;
     cudavec.zero();
 }
 
 template <typename F> void Tensor<F>::threshold(F value) {
+    version = ++tensor_clock;
     threshold_cuda(ptr(), size(), value);
 }
 
@@ -166,7 +253,10 @@ template <typename F> void Tensor<F>::to_ptr(F *target) {
     cudavec.to_ptr(target);
 }
 
+template <typename F> void Tensor<F>::touch() { version = ++tensor_clock; }
+
 template <typename F> void Tensor<F>::from_vector(vector<F> &in) {
+    version = ++tensor_clock;
     if (size() != in.size()) {
         throw DexeException("sizes don't match");
     }
@@ -174,6 +264,7 @@ template <typename F> void Tensor<F>::from_vector(vector<F> &in) {
 }
 
 template <typename F> void Tensor<F>::from_tensor(Tensor<F> &in, F alpha) {
+    version = ++tensor_clock;
     if (size() != in.size()) {
         throw DexeException("sizes don't match");
     }
@@ -182,19 +273,31 @@ template <typename F> void Tensor<F>::from_tensor(Tensor<F> &in, F alpha) {
                                       &beta, td, ptr()));
 }
 
+template <typename F> void Tensor<F>::from_tensor(TensorView<F> const &in, F alpha) {
+    version = ++tensor_clock;
+    if (shape != in.shape)
+        throw DexeException("shapes don't match, elements:", in.size());
+    F beta(0);
+    handle_error(cudnnTransformTensor(Handler::cudnn(), &alpha, in.td, in.data, &beta, td, ptr()));
+}
+
 template <typename F> void Tensor<F>::from_ptr(F const *source) {
+    version = ++tensor_clock;
     cudavec.from_ptr(source);
 }
 
 template <typename F> void Tensor<F>::init_normal(F mean, F std) {
+    version = ++tensor_clock;
     cudavec.init_normal(mean, std);
 }
 
 template <typename F> void Tensor<F>::init_uniform(F var) {
+    version = ++tensor_clock;
     dexe::init_uniform(ptr(), size(), var);
 }
 
 template <typename F> void Tensor<F>::add(Tensor<F> &in, F alpha) {
+    version = ++tensor_clock;
     if (size() != in.size()) {
         throw DexeException("sizes don't match");
     }
@@ -203,11 +306,25 @@ template <typename F> void Tensor<F>::add(Tensor<F> &in, F alpha) {
                                       &beta, td, ptr()));
 }
 
+template <typename F> void Tensor<F>::add(TensorView<F> const &in, F alpha) {
+    version = ++tensor_clock;
+    if (shape != in.shape)
+        throw DexeException("shapes don't match, elements:", in.size());
+    F beta(1);
+    handle_error(cudnnTransformTensor(Handler::cudnn(), &alpha, in.td, in.data, &beta, td, ptr()));
+}
+
+template <typename F> TensorView<F> Tensor<F>::view() {
+    return TensorView<F>(ptr(), shape, dense_strides(shape, format), this);
+}
+
 template <typename F> void Tensor<F>::scale(F alpha) {
+    version = ++tensor_clock;
     scale_cuda(ptr(), shape.n_elements(), alpha);
 }
 
 template <typename F> void Tensor<F>::fill(F val) {
+    version = ++tensor_clock;
     vector<F> vals(size());
     dexe::fill<F>(vals, val);
     from_vector(vals);
@@ -276,24 +393,28 @@ template <> double Tensor<double>::sum() {
 }
 
 template <typename F> Tensor<F> &Tensor<F>::operator*=(F val) {
+    version = ++tensor_clock;
     CudaVec<F> vec(ptr(), size());
     vec *= val;
     return *this;
 }
 
 template <typename F> Tensor<F> &Tensor<F>::operator/=(F val) {
+    version = ++tensor_clock;
     CudaVec<F> vec(ptr(), size());
     vec /= val;
     return *this;
 }
 
 template <typename F> Tensor<F> &Tensor<F>::operator-=(F val) {
+    version = ++tensor_clock;
     CudaVec<F> vec(ptr(), size());
     vec += -val;
     return *this;
 }
 
 template <typename F> Tensor<F> &Tensor<F>::operator+=(Tensor<F> &t) {
+    version = ++tensor_clock;
     CudaVec<F> vec(ptr(), size());
     CudaVec<F> other(t.ptr(), t.size());
     vec += other;
@@ -301,6 +422,7 @@ template <typename F> Tensor<F> &Tensor<F>::operator+=(Tensor<F> &t) {
 }
 
 template <typename F> Tensor<F> &Tensor<F>::operator*=(Tensor<F> &t) {
+    version = ++tensor_clock;
     CudaVec<F> vec(ptr(), size());
     CudaVec<F> other(t.ptr(), t.size());
     vec *= other;
@@ -308,12 +430,126 @@ template <typename F> Tensor<F> &Tensor<F>::operator*=(Tensor<F> &t) {
 }
 
 template <typename F> Tensor<F> &Tensor<F>::operator-=(Tensor<F> &t) {
+    version = ++tensor_clock;
     CudaVec<F> vec(ptr(), size());
     CudaVec<F> other(t.ptr(), t.size());
     vec -= other;
     return *this;
 }
 
+template <typename F>
+TensorView<F>::TensorView(F *data_, TensorShape shape_, vector<int> strides_, Tensor<F> *tensor_)
+    : data(data_), shape(shape_), strides(strides_), tensor(tensor_) {
+    if (strides.size() != shape.dimensions.size())
+        throw DexeException("TensorView needs a stride per dimension, dimensions:",
+                            shape.n_dimensions());
+    handle_error(cudnnCreateTensorDescriptor(&td));
+    set_descriptor();
+}
+
+template <typename F>
+TensorView<F>::TensorView(TensorView<F> const &other)
+    : TensorView(other.data, other.shape, other.strides, other.tensor) {}
+
+template <typename F> TensorView<F> &TensorView<F>::operator=(TensorView<F> const &other) {
+    data = other.data;
+    shape = other.shape;
+    strides = other.strides;
+    tensor = other.tensor;
+    set_descriptor();
+    return *this;
+}
+
+template <typename F> TensorView<F>::~TensorView() {
+    handle_error(cudnnDestroyTensorDescriptor(td));
+}
+
+template <typename F> void TensorView<F>::set_descriptor() {
+    if (!shape.n_dimensions() || !shape.n_elements())
+        return;
+    handle_error(cudnnSetTensorNdDescriptor(
+        td, (sizeof(F) == sizeof(float)) ? CUDNN_DATA_FLOAT : CUDNN_DATA_DOUBLE,
+        shape.n_dimensions(), shape.dimensions.data(), strides.data()));
+}
+
+template <typename F> void TensorView<F>::touch() {
+    if (tensor)
+        tensor->version = ++tensor_clock;
+}
+
+template <typename F> TensorView<F> TensorView<F>::slice(int dim, int begin, int end) const {
+    if (dim < 0 || dim >= shape.n_dimensions())
+        throw DexeException("TensorView: no such dimension:", dim);
+    if (begin < 0 || end > shape[dim] || begin >= end)
+        throw DexeException("TensorView: slice out of range, dimension size:", shape[dim]);
+    auto new_shape = shape;
+    new_shape[dim] = end - begin;
+    return TensorView<F>(data + size_t(begin) * strides[dim], new_shape, strides, tensor);
+}
+
+template <typename F>
+TensorView<F> TensorView<F>::crop(vector<int> origin, vector<int> size) const {
+    int n_spatial = shape.n_dimensions() - 2;
+    if (int(origin.size()) != n_spatial || int(size.size()) != n_spatial)
+        throw DexeException("TensorView: crop needs an origin and size per spatial dimension:",
+                            n_spatial);
+    auto view = *this;
+    for (int i(0); i < n_spatial; ++i)
+        view = view.slice(i + 2, origin[i], origin[i] + size[i]);
+    return view;
+}
+
+// Dense in NCHW order; size 1 dimensions can have any stride
+template <typename F> bool TensorView<F>::is_contiguous() const {
+    int stride(1);
+    for (int i(shape.n_dimensions() - 1); i >= 0; --i) {
+        if (shape[i] != 1 && strides[i] != stride)
+            return false;
+        stride *= shape[i];
+    }
+    return true;
+}
+
+template <typename F> unique_ptr<Tensor<F>> TensorView<F>::contiguous() const {
+    auto out = make_unique<Tensor<F>>();
+    if (is_contiguous())
+        out->bind(data, shape);
+    else
+        to_tensor(*out);
+    return out;
+}
+
+template <typename F> void TensorView<F>::to_tensor(Tensor<F> &out) const {
+    out.reshape(shape);
+    out.from_tensor(*this);
+}
+
+template <typename F> void TensorView<F>::from_tensor(Tensor<F> &in, F alpha) {
+    if (shape != in.shape)
+        throw DexeException("shapes don't match, elements:", in.size());
+    touch();
+    F beta(0);
+    handle_error(cudnnTransformTensor(Handler::cudnn(), &alpha, in.td, in.ptr(), &beta, td, data));
+}
+
+template <typename F> void TensorView<F>::add(TensorView<F> const &in, F alpha) {
+    if (shape != in.shape)
+        throw DexeException("shapes don't match, elements:", in.size());
+    touch();
+    F beta(1);
+    handle_error(cudnnTransformTensor(Handler::cudnn(), &alpha, in.td, in.data, &beta, td, data));
+}
+
+template <typename F> void TensorView<F>::scale(F alpha) {
+    touch();
+    handle_error(cudnnScaleTensor(Handler::cudnn(), td, data, &alpha));
+}
+
+template <typename F> void TensorView<F>::fill(F val) {
+    touch();
+    handle_error(cudnnSetTensor(Handler::cudnn(), td, data, &val));
+}
+
 template <typename F> TensorSet<F>::TensorSet(TensorShape shape_) {
     alloc_x(shape_);
     alloc_grad(TensorShape()); // always start with empty grad, we might just be
@@ -426,10 +662,12 @@ template <typename F> void FilterBank<F>::fill(F val) {
 }
 
 template struct Tensor<float>;
+template struct TensorView<float>;
 template struct TensorSet<float>;
 template struct FilterBank<float>;
 
 template struct Tensor<double>;
+template struct TensorView<double>;
 template struct TensorSet<double>;
 template struct FilterBank<double>;
 
@@ -0,0 +1,181 @@
+#include "dexe/threadpool.h"
+#include "dexe/handler.h"
+
+#include <exception>
+
+using namespace std;
+
+namespace dexe {
+
+namespace {
+thread_local ThreadPool *current_pool = nullptr;
+thread_local int current_worker = -1;
+} // namespace
+
+ThreadPool::ThreadPool(int n_threads) {
+    if (n_threads < 1)
+        n_threads = 1;
+    for (int n(0); n < n_threads; ++n)
+        queues.emplace_back(make_unique<Queue>());
+    for (int n(0); n < n_threads; ++n)
+        threads.emplace_back(&ThreadPool::work, this, n);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> lock(sleep_mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+void ThreadPool::submit(function<void()> task) {
+    int target = (current_pool == this) ? current_worker : next_queue++ % queues.size();
+    {
+        lock_guard<mutex> lock(queues[target]->mutex);
+        queues[target]->tasks.emplace_back(move(task));
+    }
+    {
+        lock_guard<mutex> lock(sleep_mutex);
+        ++n_queued;
+    }
+    wake.notify_one();
+}
+
+bool ThreadPool::pop(int worker, function<void()> &task) {
+    {
+        auto &own = *queues[worker];
+        lock_guard<mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t n(1); n < queues.size(); ++n) {
+        auto &other = *queues[(worker + n) % queues.size()];
+        lock_guard<mutex> lock(other.mutex);
+        if (!other.tasks.empty()) {
+            task = move(other.tasks.front());
+            other.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::work(int worker) {
+    current_pool = this;
+    current_worker = worker;
+
+    function<void()> task;
+    while (true) {
+        if (pop(worker, task)) {
+            --n_queued;
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        unique_lock<mutex> lock(sleep_mutex);
+        wake.wait(lock, [this] { return stop || n_queued > 0; });
+        if (stop && n_queued == 0)
+            break;
+    }
+
+    // handles are per thread, clean up the ones this worker created
+    Handler::deinit();
+}
+
+namespace {
+
+// State of one run_graph call. The submitted tasks share ownership, so it stays alive until the
+// last of them returns, even after run_graph itself has returned. The referenced graph and task
+// are only used before a node is counted down, while run_graph is still waiting.
+struct GraphRun {
+    ThreadPool &pool;
+    vector<vector<int>> const &dependents;
+    function<void(int)> const &task;
+
+    unique_ptr<atomic<int>[]> waiting;
+    int remaining;
+    atomic<bool> failed{false};
+    exception_ptr error;
+    mutex done_mutex;
+    condition_variable done;
+
+    GraphRun(ThreadPool &pool_, vector<vector<int>> const &dependents_,
+             function<void(int)> const &task_, vector<int> const &n_dependencies)
+        : pool(pool_), dependents(dependents_), task(task_),
+          waiting(new atomic<int>[n_dependencies.size()]), remaining(n_dependencies.size()) {
+        for (size_t i(0); i < n_dependencies.size(); ++i)
+            waiting[i] = n_dependencies[i];
+    }
+};
+
+void run_node(shared_ptr<GraphRun> run, int i) {
+    // after a failure the remaining nodes are only counted down, not run
+    if (!run->failed) {
+        try {
+            run->task(i);
+        } catch (...) {
+            lock_guard<mutex> lock(run->done_mutex);
+            if (!run->error)
+                run->error = current_exception();
+            run->failed = true;
+        }
+    }
+
+    for (auto d : run->dependents[i])
+        if (--run->waiting[d] == 0)
+            run->pool.submit([run, d] { run_node(run, d); });
+
+    lock_guard<mutex> lock(run->done_mutex);
+    if (--run->remaining == 0)
+        run->done.notify_all();
+}
+
+// Runs the graph in dependency order on the calling thread. Used for calls from a worker of the
+// same pool, which would otherwise block a worker on tasks that may be queued behind it.
+void run_inline(vector<vector<int>> const &dependents, vector<int> const &n_dependencies,
+                function<void(int)> const &task) {
+    vector<int> waiting(n_dependencies), ready;
+    for (size_t i(0); i < waiting.size(); ++i)
+        if (waiting[i] == 0)
+            ready.push_back(i);
+    while (!ready.empty()) {
+        int i = ready.back();
+        ready.pop_back();
+        task(i);
+        for (auto d : dependents[i])
+            if (--waiting[d] == 0)
+                ready.push_back(d);
+    }
+}
+
+} // namespace
+
+void run_graph(ThreadPool &pool, vector<vector<int>> const &dependents,
+               vector<int> const &n_dependencies, function<void(int)> const &task) {
+    int N = n_dependencies.size();
+    if (!N)
+        return;
+    if (current_pool == &pool) {
+        run_inline(dependents, n_dependencies, task);
+        return;
+    }
+
+    auto run = make_shared<GraphRun>(pool, dependents, task, n_dependencies);
+    for (int i(0); i < N; ++i)
+        if (n_dependencies[i] == 0)
+            pool.submit([run, i] { run_node(run, i); });
+
+    unique_lock<mutex> lock(run->done_mutex);
+    run->done.wait(lock, [&run] { return run->remaining == 0; });
+    if (run->error)
+        rethrow_exception(run->error);
+}
+
+} // namespace dexe
@@ -0,0 +1,150 @@
+#include "dexe/trainer.h"
+#include "dexe/handler.h"
+#include "dexe/profiler.h"
+#include "dexe/util.h"
+
+using namespace std;
+
+namespace dexe {
+
+void TrainerStats::describe(ostream &out) {
+    out << "steps: " << n_steps << " step: " << step_time << "s stall: " << stall_time
+        << "s load: " << load_time << "s fill: " << fill_time
+        << "s backpressure: " << backpressure_time << "s input bound: " << 100 * input_bound()
+        << "%" << endl;
+}
+
+template <typename F>
+Trainer<F>::Trainer(Network<F> &network_, Optimizer<F> &optimizer_, int loss_, FillFunc fill_,
+                    int n_workers_, int n_buffers, int n_accumulate_)
+    : network(network_), optimizer(optimizer_), loss(loss_), n_accumulate(n_accumulate_),
+      fill(fill_), n_workers(n_workers_), free_buffers(n_buffers), ready_buffers(n_buffers) {
+    if (n_workers < 1)
+        throw DexeException("Trainer needs at least one worker, got:", n_workers);
+    if (n_buffers < 1)
+        throw DexeException("Trainer needs at least one buffer, got:", n_buffers);
+    if (n_accumulate < 1)
+        throw DexeException("Trainer needs at least one batch per step, got:", n_accumulate);
+    network.finish();
+    if (n_accumulate > 1)
+        network.set_accumulate_grads(true);
+
+    buffers.resize(n_buffers);
+    for (int b(0); b < n_buffers; ++b) {
+        for (size_t i(0); i < network.inputs.size(); ++i)
+            buffers[b].emplace_back(new Tensor<F>(network.tensors[network.inputs[i]].shape()));
+        free_buffers.try_push(b);
+    }
+}
+
+template <typename F> Trainer<F>::~Trainer() { stop(); }
+
+template <typename F> void Trainer<F>::start() {
+    if (!workers.empty())
+        return;
+    stopping = false;
+    for (int w(0); w < n_workers; ++w)
+        workers.emplace_back(&Trainer<F>::work, this, w);
+}
+
+// Workers drop what they're doing at the next queue operation, batches already filled stay ready
+template <typename F> void Trainer<F>::stop() {
+    stopping = true;
+    for (auto &worker : workers)
+        worker.join();
+    workers.clear();
+}
+
+template <typename F> void Trainer<F>::work(int worker) {
+    auto abort = [this] { return stopping.load(); };
+    try {
+        while (!stopping) {
+            int b(-1);
+            Timer timer;
+            if (!free_buffers.pop(b, abort))
+                break;
+            double waited = timer.since();
+
+            timer.start();
+            {
+                ProfileScope scope("trainer", [&] { return "fill " + to_string(worker); });
+                fill(buffers[b], worker);
+                Handler::sync_stream(); // the upload has to be done before the loop reads it
+            }
+            {
+                lock_guard<mutex> lock(stats_mutex);
+                stats.backpressure_time += waited;
+                stats.fill_time += timer.since();
+            }
+            // never blocks, there are only as many indices as buffers
+            ready_buffers.push(b, abort);
+        }
+    } catch (...) {
+        // only the first failure is kept, later ones may be caused by it
+        bool first(false);
+        if (failed.compare_exchange_strong(first, true))
+            error = current_exception();
+    }
+    // handles are per thread, clean up the ones this worker created
+    Handler::deinit();
+}
+
+// Copies the next ready batch into the network inputs and hands its buffer back to the workers
+template <typename F> void Trainer<F>::load_next() {
+    int b(-1);
+    Timer timer;
+    if (!ready_buffers.pop(b, [this] { return failed.load(); })) {
+        stop(); // the failed worker may still be storing its exception
+        rethrow_exception(error);
+    }
+    stats.stall_time += timer.since();
+
+    timer.start();
+    auto &batch = buffers[b];
+    if (batch.size() != network.inputs.size())
+        throw DexeException("Trainer: fill changed the number of tensors to:", batch.size());
+    for (size_t i(0); i < network.inputs.size(); ++i)
+        network.load_input(network.inputs[i], *batch[i]);
+    // the copies have to be done before a worker refills the buffer
+    Handler::sync_stream();
+    free_buffers.push(b, [] { return false; });
+    stats.load_time += timer.since();
+}
+
+template <typename F> F Trainer<F>::step() {
+    start();
+
+    F total(0);
+    network.zero_grad();
+    for (int a(0); a < n_accumulate; ++a) {
+        load_next();
+        Timer timer;
+        network.forward(network.inputs, loss);
+        if (a > 0)
+            network.zero_activation_grads(); // parameter gradients keep adding up
+        network.backward();
+        total += network.tensors[loss].x->to_vector()[0];
+        stats.step_time += timer.since();
+    }
+
+    Timer timer;
+    F grad_scale = optimizer.grad_scale;
+    optimizer.grad_scale = grad_scale / n_accumulate;
+    optimizer.update();
+    optimizer.grad_scale = grad_scale;
+    stats.step_time += timer.since();
+    ++stats.n_steps;
+    return total / n_accumulate;
+}
+
+template <typename F> F Trainer<F>::train(int n_steps) {
+    F total(0);
+    for (int i(0); i < n_steps; ++i)
+        total += step();
+    return n_steps > 0 ? total / n_steps : 0;
+}
+
+template struct Trainer<float>;
+template struct Trainer<double>;
+
+} // namespace dexe
@@ -67,22 +67,22 @@ __global__ void add_normal_kerneld(int seed, double *data, int n, double mean, d
 
 template <>
 void init_normal<float>(float *a, int N, float mean, float std) {
-     normal_kernel<<<1, 32>>>(rand(), a, N, mean, std);
+     normal_kernel<<<1, 32, 0, Handler::stream()>>>(rand(), a, N, mean, std);
 }
 
 template <>
 void init_normal<double>(double *a, int N, double mean, double std) {
-     normal_kerneld<<<1, 32>>>(rand(), a, N, mean, std);
+     normal_kerneld<<<1, 32, 0, Handler::stream()>>>(rand(), a, N, mean, std);
 }
 
 template <>
 void add_normal<float>(float *a, int N, float mean, float std) {
-     add_normal_kernel<<<1, 32>>>(rand(), a, N, mean, std);
+     add_normal_kernel<<<1, 32, 0, Handler::stream()>>>(rand(), a, N, mean, std);
 }
 
 template <>
 void add_normal<double>(double *a, int N, double mean, double std) {
-     add_normal_kerneld<<<1, 32>>>(rand(), a, N, mean, std);
+     add_normal_kerneld<<<1, 32, 0, Handler::stream()>>>(rand(), a, N, mean, std);
 }
 
 __global__ void rand_init_kernel(int seed, curandStatePhilox4_32_10_t *states, int n) {
@@ -121,12 +121,12 @@ void rand_zero(float *data, int n, float p) {
 	  if (rand_states) cudaFree(rand_states);
 	  handle_error(cudaMalloc(&rand_states, sizeof(curandStatePhilox4_32_10_t) * n_threads));
 
-    rand_init_kernel<<<dimGrid, dimBlock>>>(rand(), rand_states, n_threads);
+    rand_init_kernel<<<dimGrid, dimBlock, 0, Handler::stream()>>>(rand(), rand_states, n_threads);
     n_rand_states = n_threads;
   }
 
 
-  rand_zero_kernel<<<dimGrid, dimBlock>>>(data, n, p, rand_states);
+  rand_zero_kernel<<<dimGrid, dimBlock, 0, Handler::stream()>>>(data, n, p, rand_states);
   handle_error( cudaGetLastError() );
   handle_error( cudaDeviceSynchronize());
 }
@@ -177,7 +177,7 @@ void shift(float const *in, float *out, int X, int Y, int C, int dx, int dy, flo
 	int dimBlock( BLOCKSIZE );
 	int dimGrid( (s  + BLOCKSIZE - 1) / BLOCKSIZE);
 
-	shift_kernel<<<dimGrid, dimBlock>>>(in, out, X, Y, C, dx, dy, beta);
+	shift_kernel<<<dimGrid, dimBlock, 0, Handler::stream()>>>(in, out, X, Y, C, dx, dy, beta);
 }
 
 void unshift(float const *in, float *out, int X, int Y, int C, int dx, int dy, float const beta) {
@@ -187,7 +187,7 @@ void unshift(float const *in, float *out, int X, int Y, int C, int dx, int dy, f
 	int dimBlock( BLOCKSIZE );
 	int dimGrid( (s  + BLOCKSIZE - 1) / BLOCKSIZE);
 
-	unshift_kernel<<<dimGrid, dimBlock>>>(in, out, X, Y, C, dx, dy, beta);
+	unshift_kernel<<<dimGrid, dimBlock, 0, Handler::stream()>>>(in, out, X, Y, C, dx, dy, beta);
 }
 
 }